@@ -0,0 +1,335 @@
+#include "ingestbenchmark.h"
+
+#include <iostream>
+#include <thread>
+
+#include <zmq/protowriter/monitor.h>
+#include <zmq/zmqutils.hpp>
+
+#include <proto/modelevent/modelevent.pb.h>
+#include <proto/systemevent/systemevent.pb.h>
+
+#include <google/protobuf/util/time_util.h>
+
+using google::protobuf::util::TimeUtil;
+
+namespace {
+    // Publishers top up to their target rate every tick
+    const std::chrono::milliseconds publish_tick(10);
+    // Gives SUB sockets time to send their subscriptions after connecting, zmq drops anything published before then
+    const std::chrono::milliseconds subscription_settle_time(500);
+    const std::chrono::seconds connection_timeout(30);
+    // Draining gives up once nothing has been written for this long
+    const std::chrono::seconds drain_stall_timeout(10);
+
+    double ToSeconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::duration<double> >(duration).count();
+    }
+}
+
+AggServer::IngestBenchmark::IngestBenchmark(const Options& options) :
+    options_(options),
+    experiment_name_("aggregation_benchmark_" + std::to_string(TimeUtil::TimestampToSeconds(TimeUtil::GetCurrentTime())))
+{
+    database_ = std::make_shared<DatabaseClient>(options_.connection_string);
+    experiment_tracker_ = std::unique_ptr<ExperimentTracker>(new ExperimentTracker(
+        database_,
+        options_.connection_string,
+        options_.pipeline_depth,
+        options_.spool_directory,
+        options_.port_event_rollup_interval
+    ));
+    nodemanager_handler_ = std::unique_ptr<NodeManagerProtoHandler>(new NodeManagerProtoHandler(database_, *experiment_tracker_));
+
+    const std::string environment_endpoint = zmq::TCPify("127.0.0.1", options_.base_port);
+    environment_writer_ = std::unique_ptr<zmq::ProtoWriter>(new zmq::ProtoWriter());
+    if (!environment_writer_->BindPublisherSocket(environment_endpoint)) {
+        throw std::runtime_error("Benchmark cannot bind environment endpoint: " + environment_endpoint);
+    }
+    environment_receiver_ = std::unique_ptr<zmq::ProtoReceiver>(new zmq::ProtoReceiver());
+    nodemanager_handler_->BindCallbacks(*environment_receiver_);
+    environment_receiver_->Filter("");
+    environment_receiver_->Connect(environment_endpoint);
+
+    for (int i = 0; i < options_.node_count; i++) {
+        NodePublisher node;
+        node.hostname = "benchmark-node-" + std::to_string(i);
+        node.system_endpoint = zmq::TCPify("127.0.0.1", options_.base_port + 1 + 2 * i);
+        node.model_endpoint = zmq::TCPify("127.0.0.1", options_.base_port + 2 + 2 * i);
+        node.system_writer = std::unique_ptr<zmq::ProtoWriter>(new zmq::ProtoWriter());
+        node.model_writer = std::unique_ptr<zmq::ProtoWriter>(new zmq::ProtoWriter());
+
+        for (auto writer : {node.system_writer.get(), node.model_writer.get()}) {
+            writer->RegisterMonitorCallback(ZMQ_EVENT_ACCEPTED, [this](int, std::string) {
+                accepted_connections_++;
+            });
+        }
+        if (!node.system_writer->BindPublisherSocket(node.system_endpoint) || !node.model_writer->BindPublisherSocket(node.model_endpoint)) {
+            throw std::runtime_error("Benchmark cannot bind logger endpoints for " + node.hostname);
+        }
+        nodes_.emplace_back(std::move(node));
+    }
+}
+
+AggServer::IngestBenchmark::~IngestBenchmark() {
+    for (auto& node : nodes_) {
+        node.system_writer->Terminate();
+        node.model_writer->Terminate();
+    }
+    environment_receiver_.reset();
+    environment_writer_->Terminate();
+}
+
+NodeManager::EnvironmentMessage AggServer::IngestBenchmark::BuildConfigureMessage() {
+    NodeManager::EnvironmentMessage message;
+    message.set_type(NodeManager::EnvironmentMessage::CONFIGURE_EXPERIMENT);
+    auto control_message = message.mutable_control_message();
+    control_message->set_type(NodeManager::ControlMessage::CONFIGURE);
+    control_message->set_experiment_id(experiment_name_);
+    *control_message->mutable_timestamp() = TimeUtil::GetCurrentTime();
+
+    for (int i = 0; i < options_.node_count; i++) {
+        auto& publisher = nodes_.at(i);
+        auto node = control_message->add_nodes();
+        node->mutable_info()->set_name(publisher.hostname);
+        node->mutable_info()->set_id("node_" + std::to_string(i));
+        node->set_ip_address("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256));
+
+        auto container = node->add_containers();
+        container->mutable_info()->set_name("container_" + std::to_string(i));
+        container->mutable_info()->set_id("container_" + std::to_string(i));
+        container->set_type(NodeManager::Container::GENERIC);
+
+        for (int j = 0; j < options_.components_per_node; j++) {
+            auto component = container->add_components();
+            const std::string component_id = "node_" + std::to_string(i) + "_component_" + std::to_string(j);
+            component->mutable_info()->set_name("component_" + std::to_string(j));
+            component->mutable_info()->set_id(component_id);
+            component->mutable_info()->set_type("BenchmarkComponent");
+            component->add_location("BenchmarkAssembly");
+            component->add_replicate_indices(i);
+
+            for (int k = 0; k < options_.ports_per_component; k++) {
+                auto port = component->add_ports();
+                port->mutable_info()->set_name("port_" + std::to_string(k));
+                port->mutable_info()->set_id(component_id + "_port_" + std::to_string(k));
+                port->mutable_info()->set_type("BenchmarkMessage");
+                port->set_kind(k % 2 == 0 ? NodeManager::Port::PUBLISHER : NodeManager::Port::SUBSCRIBER);
+                port->set_middleware(NodeManager::ZMQ);
+                publisher.ports.push_back(*port);
+                publisher.components.push_back(*component);
+            }
+        }
+
+        // The server connects to loggers once the whole topology has been written, so an accepted connection means CONFIGURE is done
+        const auto& system_port = std::to_string(options_.base_port + 1 + 2 * i);
+        const auto& model_port = std::to_string(options_.base_port + 2 + 2 * i);
+        auto system_logger = container->add_loggers();
+        system_logger->set_type(NodeManager::Logger::CLIENT);
+        system_logger->set_publisher_address("127.0.0.1");
+        system_logger->set_publisher_port(system_port);
+        auto model_logger = container->add_loggers();
+        model_logger->set_type(NodeManager::Logger::MODEL);
+        model_logger->set_publisher_address("127.0.0.1");
+        model_logger->set_publisher_port(model_port);
+    }
+    return message;
+}
+
+void AggServer::IngestBenchmark::WaitForLoggerConnections() {
+    const auto deadline = std::chrono::steady_clock::now() + connection_timeout;
+    while (accepted_connections_ < 2 * options_.node_count) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error(
+                "Timed out waiting for the server to connect to the benchmark's loggers, only "
+                + std::to_string(accepted_connections_) + " of " + std::to_string(2 * options_.node_count) + " connected"
+            );
+        }
+        std::this_thread::sleep_for(publish_tick);
+    }
+    std::this_thread::sleep_for(subscription_settle_time);
+}
+
+void AggServer::IngestBenchmark::PublishInfoEvent(NodePublisher& node) {
+    std::unique_ptr<SystemEvent::InfoEvent> info(new SystemEvent::InfoEvent());
+    info->set_hostname(node.hostname);
+    *info->mutable_timestamp() = TimeUtil::GetCurrentTime();
+    info->set_os_name("Linux");
+    info->set_cpu_model("Benchmark CPU");
+    info->set_physical_memory_kilobytes(16 * 1024 * 1024);
+    auto interface_info = info->add_interface_info();
+    interface_info->set_name("eth0");
+    interface_info->set_type("ethernet");
+    auto fs_info = info->add_file_system_info();
+    fs_info->set_name("/");
+    fs_info->set_type(SystemEvent::FileSystemInfo::FS_LOCAL_DISK);
+    fs_info->set_size_kilobytes(512 * 1024 * 1024);
+    node.system_writer->PushMessage(std::move(info));
+}
+
+void AggServer::IngestBenchmark::PublishStatusEvent(NodePublisher& node, int64_t message_id) {
+    std::unique_ptr<SystemEvent::StatusEvent> status(new SystemEvent::StatusEvent());
+    status->set_hostname(node.hostname);
+    status->set_message_id(message_id);
+    *status->mutable_timestamp() = TimeUtil::GetCurrentTime();
+    status->set_cpu_utilization((message_id % 100) / 100.0);
+    status->set_phys_mem_utilization(((message_id + 50) % 100) / 100.0);
+    auto interface_status = status->add_interfaces();
+    interface_status->set_name("eth0");
+    interface_status->set_rx_packets(message_id * 10);
+    interface_status->set_rx_bytes(message_id * 10000);
+    interface_status->set_tx_packets(message_id * 10);
+    interface_status->set_tx_bytes(message_id * 10000);
+    auto fs_status = status->add_file_systems();
+    fs_status->set_name("/");
+    fs_status->set_utilization(0.5);
+    node.system_writer->PushMessage(std::move(status));
+}
+
+void AggServer::IngestBenchmark::PublishUtilizationEvent(NodePublisher& node, std::size_t port_index, int64_t port_event_id) {
+    const auto& port = node.ports.at(port_index);
+    const auto& component = node.components.at(port_index);
+
+    std::unique_ptr<ModelEvent::UtilizationEvent> event(new ModelEvent::UtilizationEvent());
+    event->mutable_info()->set_hostname(node.hostname);
+    event->mutable_info()->set_experiment_name(experiment_name_);
+    *event->mutable_info()->mutable_timestamp() = TimeUtil::GetCurrentTime();
+    event->mutable_component()->set_name(component.info().name());
+    event->mutable_component()->set_id(component.info().id());
+    event->mutable_component()->set_type(component.info().type());
+    event->mutable_port()->set_name(port.info().name());
+    event->mutable_port()->set_id(port.info().id());
+    event->mutable_port()->set_type(port.info().type());
+    event->set_type(port.kind() == NodeManager::Port::PUBLISHER ? ModelEvent::UtilizationEvent::SENT : ModelEvent::UtilizationEvent::RECEIVED);
+    event->set_port_event_id(port_event_id);
+    node.model_writer->PushMessage(std::move(event));
+}
+
+void AggServer::IngestBenchmark::PublishNode(NodePublisher& node, std::chrono::steady_clock::time_point end_time) {
+    const auto start_time = std::chrono::steady_clock::now();
+    int64_t status_count = 0;
+    uint64_t utilization_count = 0;
+    const std::size_t port_count = node.ports.size();
+    std::vector<int64_t> port_event_ids(port_count, 0);
+
+    for (auto now = start_time; now < end_time; now = std::chrono::steady_clock::now()) {
+        const double elapsed = ToSeconds(now - start_time);
+
+        // Top up to the number of events that should have been sent by now, so a slow tick doesn't lower the rate
+        const auto status_target = static_cast<int64_t>(elapsed * options_.status_rate);
+        while (status_count < status_target) {
+            PublishStatusEvent(node, ++status_count);
+        }
+
+        const auto utilization_target = static_cast<uint64_t>(elapsed * options_.utilization_rate * port_count);
+        while (port_count > 0 && utilization_count < utilization_target) {
+            const std::size_t port_index = utilization_count % port_count;
+            PublishUtilizationEvent(node, port_index, ++port_event_ids[port_index]);
+            utilization_count++;
+        }
+
+        std::this_thread::sleep_for(publish_tick);
+    }
+    node.published_count = status_count + utilization_count;
+}
+
+std::chrono::steady_clock::time_point AggServer::IngestBenchmark::WaitForDrain(int experiment_run_id, uint64_t published_count) {
+    auto last_progress_time = std::chrono::steady_clock::now();
+    uint64_t last_handled_count = 0;
+
+    while (true) {
+        const auto& metrics = experiment_tracker_->GetIngestMetrics(experiment_run_id);
+        const uint64_t handled_count = metrics.processed_count + metrics.failed_count + metrics.dropped_count + metrics.spooled_count
+            + metrics.parked_count;
+        const auto now = std::chrono::steady_clock::now();
+
+        if (handled_count >= published_count && metrics.queue_depth == 0) {
+            return now;
+        }
+        if (handled_count != last_handled_count) {
+            last_handled_count = handled_count;
+            last_progress_time = now;
+        } else if (now - last_progress_time > drain_stall_timeout) {
+            std::cerr << "Stopped waiting for the server after " << handled_count << " of " << published_count
+                << " events were handled, the rest were lost in transit or are still spooled" << std::endl;
+            return last_progress_time;
+        }
+        std::this_thread::sleep_for(publish_tick);
+    }
+}
+
+void AggServer::IngestBenchmark::SendShutdown() {
+    std::unique_ptr<NodeManager::EnvironmentMessage> message(new NodeManager::EnvironmentMessage());
+    message->set_type(NodeManager::EnvironmentMessage::SHUTDOWN_EXPERIMENT);
+    message->mutable_control_message()->set_type(NodeManager::ControlMessage::NO_TYPE);
+    message->mutable_control_message()->set_experiment_id(experiment_name_);
+    *message->mutable_control_message()->mutable_timestamp() = TimeUtil::GetCurrentTime();
+    environment_writer_->PushMessage(std::move(message));
+}
+
+void AggServer::IngestBenchmark::Run() {
+    std::cout << "Benchmarking experiment " << experiment_name_ << ": "
+        << options_.node_count << " nodes, " << options_.components_per_node << " components per node, "
+        << options_.ports_per_component << " ports per component" << std::endl;
+
+    // The environment receiver needs to have subscribed before CONFIGURE is published
+    std::this_thread::sleep_for(subscription_settle_time);
+    const auto configure_start = std::chrono::steady_clock::now();
+    environment_writer_->PushMessage(std::unique_ptr<NodeManager::EnvironmentMessage>(
+        new NodeManager::EnvironmentMessage(BuildConfigureMessage())
+    ));
+    WaitForLoggerConnections();
+    const auto configure_time = std::chrono::steady_clock::now() - configure_start;
+
+    // Loggers are only connected after every topology table is written, so once the last connection is accepted the
+    // run is registered and every port and worker the events reference is cached
+    const int experiment_run_id = experiment_tracker_->GetCurrentRunID(experiment_tracker_->GetExperimentID(experiment_name_));
+
+    for (auto& node : nodes_) {
+        PublishInfoEvent(node);
+    }
+
+    const auto publish_start = std::chrono::steady_clock::now();
+    const auto publish_end = publish_start + options_.duration;
+    std::vector<std::thread> publisher_threads;
+    for (auto& node : nodes_) {
+        publisher_threads.emplace_back(&IngestBenchmark::PublishNode, this, std::ref(node), publish_end);
+    }
+    for (auto& thread : publisher_threads) {
+        thread.join();
+    }
+    const auto publish_time = std::chrono::steady_clock::now() - publish_start;
+
+    // InfoEvents go through the same queue, so they are counted as published too
+    uint64_t published_count = nodes_.size();
+    for (const auto& node : nodes_) {
+        published_count += node.published_count;
+    }
+
+    const auto drain_end = WaitForDrain(experiment_run_id, published_count);
+    const auto& metrics = experiment_tracker_->GetIngestMetrics(experiment_run_id);
+    // The run's own client writes the events, the shared client behind the tracker and NodeManagerProtoHandler did CONFIGURE
+    const uint64_t run_transaction_count = experiment_tracker_->GetDatabaseTransactionCount(experiment_run_id);
+    const uint64_t configure_transaction_count = database_->GetTransactionCount();
+    const uint64_t transaction_count = run_transaction_count + configure_transaction_count;
+    const double ingest_seconds = ToSeconds(drain_end - publish_start);
+
+    std::cout << "CONFIGURE took " << ToSeconds(configure_time) << "s" << std::endl;
+    std::cout << "Published " << published_count << " events in " << ToSeconds(publish_time) << "s ("
+        << published_count / ToSeconds(publish_time) << " events/s offered)" << std::endl;
+    std::cout << "Written " << metrics.processed_count << " events in " << ingest_seconds << "s ("
+        << (ingest_seconds > 0 ? metrics.processed_count / ingest_seconds : 0) << " events/s sustained), "
+        << metrics.failed_count << " failed, " << metrics.dropped_count << " dropped, " << metrics.spooled_count << " spooled, "
+        << metrics.parked_count << " parked, "
+        << (published_count - std::min(published_count, metrics.processed_count + metrics.failed_count + metrics.dropped_count + metrics.spooled_count + metrics.parked_count))
+        << " never received" << std::endl;
+    std::cout << "Drained " << ToSeconds(drain_end - std::min(drain_end, publish_end)) << "s after publishing stopped, publish to commit lag mean/max "
+        << metrics.mean_lag.count() << "/" << metrics.max_lag.count() << "us, peak queue depth " << metrics.peak_queue_depth << std::endl;
+    std::cout << "Database transactions: " << transaction_count << " (" << run_transaction_count << " by the run, "
+        << configure_transaction_count << " by CONFIGURE and the tracker, "
+        << (metrics.processed_count > 0 ? static_cast<double>(transaction_count) / metrics.processed_count : 0) << " per written event)" << std::endl;
+
+    SendShutdown();
+    // Lets the shutdown, and the rollup flushes it queues, reach the database before the tracker is torn down
+    std::this_thread::sleep_for(subscription_settle_time);
+}
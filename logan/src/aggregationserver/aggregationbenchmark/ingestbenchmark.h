@@ -0,0 +1,88 @@
+#ifndef INGESTBENCHMARK_H
+#define INGESTBENCHMARK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zmq/protoreceiver/protoreceiver.h>
+#include <zmq/protowriter/protowriter.h>
+
+#include <proto/controlmessage/controlmessage.pb.h>
+
+#include "../databaseclient.h"
+#include "../experimenttracker.h"
+#include "../nodemanagerprotohandler.h"
+
+namespace AggServer {
+
+// Drives a real ExperimentTracker end to end: CONFIGUREs a synthetic topology through NodeManagerProtoHandler,
+// then publishes SystemEvent and ModelEvent streams at fixed rates over loopback zmq sockets, exactly as the
+// environment manager and logan clients would, and reports what the server sustained.
+class IngestBenchmark {
+public:
+    struct Options {
+        std::string connection_string;
+        int node_count = 1;
+        int components_per_node = 1;
+        int ports_per_component = 1;
+        // StatusEvents per second from each node
+        double status_rate = 1;
+        // UtilizationEvents per second from each port
+        double utilization_rate = 10;
+        std::chrono::seconds duration{10};
+        // First of the loopback ports used for the environment and logger publishers
+        int base_port = 30000;
+        // Passed straight through to ExperimentTracker
+        std::size_t pipeline_depth = 0;
+        std::string spool_directory;
+        std::chrono::milliseconds port_event_rollup_interval{0};
+    };
+
+    IngestBenchmark(const Options& options);
+    ~IngestBenchmark();
+
+    // Configures, publishes for options.duration, waits for the server to drain then prints the results
+    void Run();
+
+private:
+    struct NodePublisher {
+        std::string hostname;
+        std::string system_endpoint;
+        std::string model_endpoint;
+        std::unique_ptr<zmq::ProtoWriter> system_writer;
+        std::unique_ptr<zmq::ProtoWriter> model_writer;
+        std::vector<NodeManager::Port> ports;
+        std::vector<NodeManager::Component> components;
+        uint64_t published_count = 0;
+    };
+
+    NodeManager::EnvironmentMessage BuildConfigureMessage();
+    void WaitForLoggerConnections();
+    void PublishNode(NodePublisher& node, std::chrono::steady_clock::time_point end_time);
+    void PublishInfoEvent(NodePublisher& node);
+    void PublishStatusEvent(NodePublisher& node, int64_t message_id);
+    void PublishUtilizationEvent(NodePublisher& node, std::size_t port_index, int64_t port_event_id);
+    // Returns once every published event has been written, dropped or spooled, or the server stops making progress
+    std::chrono::steady_clock::time_point WaitForDrain(int experiment_run_id, uint64_t published_count);
+    void SendShutdown();
+
+    const Options options_;
+    const std::string experiment_name_;
+
+    std::shared_ptr<DatabaseClient> database_;
+    std::unique_ptr<ExperimentTracker> experiment_tracker_;
+    std::unique_ptr<NodeManagerProtoHandler> nodemanager_handler_;
+    std::unique_ptr<zmq::ProtoReceiver> environment_receiver_;
+    std::unique_ptr<zmq::ProtoWriter> environment_writer_;
+
+    std::vector<NodePublisher> nodes_;
+    std::atomic<int> accepted_connections_{0};
+};
+
+}
+
+#endif //INGESTBENCHMARK_H
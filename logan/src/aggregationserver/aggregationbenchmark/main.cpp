@@ -0,0 +1,63 @@
+#include "ingestbenchmark.h"
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+
+int main(int argc, char** argv) {
+    // Variables to store the input parameters
+    std::string database_ip;
+    std::string password;
+    unsigned int duration_seconds;
+    unsigned int port_event_rollup_ms;
+    AggServer::IngestBenchmark::Options options;
+
+    // Parse command line options
+    boost::program_options::options_description desc("Aggregation Server Benchmark Options");
+    desc.add_options()("ip-address,i", boost::program_options::value<std::string>(&database_ip)->required(), "address of the postgres database to benchmark against (127.0.0.1)");
+    desc.add_options()("password,p", boost::program_options::value<std::string>(&password)->default_value(""), "the password for the database");
+    desc.add_options()("nodes,n", boost::program_options::value<int>(&options.node_count)->default_value(4), "number of synthetic nodes, each publishing its own SystemEvent and ModelEvent streams");
+    desc.add_options()("components,m", boost::program_options::value<int>(&options.components_per_node)->default_value(4), "components per node");
+    desc.add_options()("ports,P", boost::program_options::value<int>(&options.ports_per_component)->default_value(2), "ports per component");
+    desc.add_options()("status-rate", boost::program_options::value<double>(&options.status_rate)->default_value(1), "StatusEvents per second from each node");
+    desc.add_options()("utilization-rate", boost::program_options::value<double>(&options.utilization_rate)->default_value(100), "UtilizationEvents per second from each port");
+    desc.add_options()("duration,d", boost::program_options::value<unsigned int>(&duration_seconds)->default_value(30), "seconds to publish for");
+    desc.add_options()("base-port", boost::program_options::value<int>(&options.base_port)->default_value(30000), "first loopback port used by the benchmark's publishers, 1 + 2 * nodes ports are used");
+    desc.add_options()("pipeline-depth", boost::program_options::value<std::size_t>(&options.pipeline_depth)->default_value(0), "as for aggregation_server");
+    desc.add_options()("spool-directory", boost::program_options::value<std::string>(&options.spool_directory)->default_value(""), "as for aggregation_server");
+    desc.add_options()("port-event-rollup-ms", boost::program_options::value<unsigned int>(&port_event_rollup_ms)->default_value(0), "as for aggregation_server");
+    desc.add_options()("help,h", "Display help");
+
+    // Construct a variable_map
+    boost::program_options::variables_map vm;
+
+    try{
+        // Parse Argument variables
+        boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+        boost::program_options::notify(vm);
+    }catch(boost::program_options::error& e) {
+        std::cerr << "Arg Error: " << e.what() << std::endl << std::endl;
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    std::stringstream conn_string_stream;
+    conn_string_stream << "dbname = postgres user = postgres ";
+    conn_string_stream << "password = " << password << " hostaddr = " << database_ip << " port = 5432";
+    options.connection_string = conn_string_stream.str();
+    options.duration = std::chrono::seconds(duration_seconds);
+    options.port_event_rollup_interval = std::chrono::milliseconds(port_event_rollup_ms);
+
+    try {
+        AggServer::IngestBenchmark benchmark(options);
+        benchmark.Run();
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,18 +1,80 @@
 #include "aggregationbroker.h"
 
+#include <functional>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+    // Requests cheap enough to be dispatched ahead of queued event and utilisation queries
+    const std::unordered_set<std::string> priority_functions = {"GetExperimentRuns", "GetExperimentState"};
+}
+
 AggServer::AggregationBroker::AggregationBroker(const std::string& replier_ip,
         const std::string& database_ip,
-        const std::string& password) {
+        const std::string& password,
+        std::size_t max_points,
+        std::size_t cache_bytes,
+        std::size_t worker_count,
+        int worker_base_port,
+        std::size_t max_concurrent_requests,
+        std::chrono::milliseconds long_poll_timeout,
+        std::size_t max_long_polls,
+        std::chrono::milliseconds request_timeout) {
 
     std::stringstream conn_string_stream;
     conn_string_stream << "dbname = postgres user = postgres ";
     conn_string_stream << "password = " << password << " hostaddr = " << database_ip << " port = 5432";
     
-    
-    replier = std::unique_ptr<AggServer::AggregationReplier>(
-        new AggServer::AggregationReplier(std::make_shared<DatabaseClient>(conn_string_stream.str()))
-    );
+    std::shared_ptr<ResponseCache> response_cache;
+    if (cache_bytes > 0) {
+        response_cache = std::make_shared<ResponseCache>(cache_bytes);
+    }
+
+    if (worker_count == 0) {
+        repliers.emplace_back(new AggServer::AggregationReplier(
+            std::make_shared<DatabaseClient>(conn_string_stream.str()), max_points, response_cache
+        ));
+        repliers.back()->Bind(replier_ip);
+        repliers.back()->Start();
+        return;
+    }
 
-    replier->Bind(replier_ip);
-    replier->Start();
-}
\ No newline at end of file
+    if (max_concurrent_requests == 0) {
+        // One worker is kept free for priority requests, so a single worker has to be given an explicit limit
+        if (worker_count < 2) {
+            throw std::invalid_argument("Keeping a worker free for priority requests needs at least 2 workers");
+        }
+        max_concurrent_requests = worker_count - 1;
+    }
+
+    // Every long poll waits on the one watcher, which polls LastUpdated over its own connection
+    std::shared_ptr<RunUpdateWatcher> run_update_watcher;
+    std::function<std::size_t()> waiting_requests;
+    if (long_poll_timeout.count() > 0) {
+        if (max_long_polls == 0) {
+            max_long_polls = max_concurrent_requests;
+        }
+        run_update_watcher = std::make_shared<RunUpdateWatcher>(
+            std::make_shared<DatabaseClient>(conn_string_stream.str()), max_long_polls
+        );
+        waiting_requests = [run_update_watcher]() {
+            return run_update_watcher->GetWaiterCount();
+        };
+    }
+
+    std::vector<std::string> worker_endpoints;
+    for (std::size_t i = 0; i < worker_count; i++) {
+        worker_endpoints.push_back("tcp://127.0.0.1:" + std::to_string(worker_base_port + i));
+
+        repliers.emplace_back(new AggServer::AggregationReplier(
+            std::make_shared<DatabaseClient>(conn_string_stream.str()), max_points, response_cache,
+            run_update_watcher, long_poll_timeout
+        ));
+        repliers.back()->Bind(worker_endpoints.back());
+        repliers.back()->Start();
+    }
+
+    replier_pool = std::unique_ptr<ReplierPool>(
+        new ReplierPool(replier_ip, worker_endpoints, priority_functions, max_concurrent_requests, waiting_requests, request_timeout)
+    );
+}
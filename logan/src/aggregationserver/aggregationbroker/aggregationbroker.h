@@ -1,24 +1,46 @@
 #ifndef AGGREGATIONBROKER_H
 #define AGGREGATIONBROKER_H
 
+#include <chrono>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "../databaseclient.h"
 #include "aggregationreplier.h"
+#include "replierpool.h"
+#include "responsecache.h"
+#include "runupdatewatcher.h"
 
 namespace AggServer {
 
 class AggregationBroker {
 public:
+    // A worker_count of 0 serves every request from a single replier bound to receiver_ip. Otherwise worker_count
+    // repliers, each with their own database connection, are bound to loopback ports from worker_base_port and fed by
+    // a ReplierPool on receiver_ip, running at most max_concurrent_requests non priority requests at once
+    // (0 leaves one worker free for priority requests, which needs a worker_count of at least 2). Long polls, which need workers, hold their worker while they
+    // wait but don't count against max_concurrent_requests, at most max_long_polls wait at once (0 allows as many as
+    // max_concurrent_requests) and any more are answered straight away. A request the pool hasn't had a reply to within
+    // request_timeout (0 waits forever) is failed back to its client.
     AggregationBroker(const std::string& receiver_ip,
         const std::string& database_ip,
-        const std::string& password);
+        const std::string& password,
+        std::size_t max_points = 0,
+        std::size_t cache_bytes = 0,
+        std::size_t worker_count = 0,
+        int worker_base_port = 0,
+        std::size_t max_concurrent_requests = 0,
+        std::chrono::milliseconds long_poll_timeout = std::chrono::milliseconds(0),
+        std::size_t max_long_polls = 0,
+        std::chrono::milliseconds request_timeout = std::chrono::milliseconds(0));
 
         
 private:
     
-    std::unique_ptr<AggregationReplier> replier;
+    std::vector<std::unique_ptr<AggregationReplier> > repliers;
+    // Declared after the repliers so it stops forwarding requests before they are torn down
+    std::unique_ptr<ReplierPool> replier_pool;
     std::shared_ptr<DatabaseClient> database_client;
 };
 
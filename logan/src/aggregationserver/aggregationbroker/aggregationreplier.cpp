@@ -1,12 +1,24 @@
 #include "aggregationreplier.h"
 
+#include "downsampler.h"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <google/protobuf/util/time_util.h>
 
 using google::protobuf::util::TimeUtil;
 
 namespace detail {
-    std::string StringToPSQLTimestamp(const std::string& str) {
-        return DatabaseClient::StringToPSQLTimestamp(str);
+    std::string TimestampToEpochMicroseconds(const std::string& str) {
+        return DatabaseClient::TimestampToEpochMicroseconds(str);
+    }
+
+    google::protobuf::Timestamp FieldToTimestamp(const pqxx::field& field) {
+        return TimeUtil::MicrosecondsToTimestamp(field.as<int64_t>());
     }
 
     class ConditionPairList {
@@ -53,8 +65,18 @@ namespace detail {
 }
 using namespace detail;
 
-AggServer::AggregationReplier::AggregationReplier(std::shared_ptr<DatabaseClient> database) :
-    database_(database)
+AggServer::AggregationReplier::AggregationReplier(
+    std::shared_ptr<DatabaseClient> database,
+    std::size_t max_points,
+    std::shared_ptr<ResponseCache> response_cache,
+    std::shared_ptr<RunUpdateWatcher> run_update_watcher,
+    std::chrono::milliseconds long_poll_timeout
+) :
+    database_(database),
+    max_points_(max_points),
+    response_cache_(response_cache),
+    run_update_watcher_(run_update_watcher),
+    long_poll_timeout_(long_poll_timeout)
 {
     RegisterCallbacks();
     // const auto&& res = database_->GetPortLifecycleEventInfo(
@@ -89,98 +111,148 @@ void AggServer::AggregationReplier::RegisterCallbacks() {
     );
     RegisterProtoCallback<ExperimentStateRequest, ExperimentStateResponse>(
         "GetExperimentState",
-        std::bind(&AggregationReplier::ProcessExperimentStateRequest, this, std::placeholders::_1)
+        std::bind(
+            &AggregationReplier::ProcessCachedRequest<ExperimentStateRequest, ExperimentStateResponse>,
+            this, std::placeholders::_1, &AggregationReplier::ProcessExperimentStateRequest
+        )
     );
     RegisterProtoCallback<PortLifecycleRequest, PortLifecycleResponse>(
         "GetPortLifecycle",
-        std::bind(&AggregationReplier::ProcessPortLifecycleRequest, this, std::placeholders::_1)
+        std::bind(
+            &AggregationReplier::ProcessCachedRequest<PortLifecycleRequest, PortLifecycleResponse>,
+            this, std::placeholders::_1, &AggregationReplier::ProcessPortLifecycleRequest
+        )
     );
     RegisterProtoCallback<WorkloadRequest, WorkloadResponse>(
         "GetWorkload",
-        std::bind(&AggregationReplier::ProcessWorkloadEventRequest, this, std::placeholders::_1)
+        std::bind(
+            &AggregationReplier::ProcessCachedRequest<WorkloadRequest, WorkloadResponse>,
+            this, std::placeholders::_1, &AggregationReplier::ProcessWorkloadEventRequest
+        )
     );
     RegisterProtoCallback<MarkerRequest, MarkerResponse>(
         "GetMarkers",
-        std::bind(&AggregationReplier::ProcessMarkerRequest, this, std::placeholders::_1)
+        std::bind(
+            &AggregationReplier::ProcessCachedRequest<MarkerRequest, MarkerResponse>,
+            this, std::placeholders::_1, &AggregationReplier::ProcessMarkerRequest
+        )
     );
     RegisterProtoCallback<CPUUtilisationRequest, CPUUtilisationResponse>(
         "GetCPUUtilisation",
-        std::bind(&AggregationReplier::ProcessCPUUtilisationRequest, this, std::placeholders::_1)
+        std::bind(
+            &AggregationReplier::ProcessCachedRequest<CPUUtilisationRequest, CPUUtilisationResponse>,
+            this, std::placeholders::_1, &AggregationReplier::ProcessCPUUtilisationRequest
+        )
     );
     RegisterProtoCallback<MemoryUtilisationRequest, MemoryUtilisationResponse>(
         "GetMemoryUtilisation",
-        std::bind(&AggregationReplier::ProcessMemoryUtilisationRequest, this, std::placeholders::_1)
+        std::bind(
+            &AggregationReplier::ProcessCachedRequest<MemoryUtilisationRequest, MemoryUtilisationResponse>,
+            this, std::placeholders::_1, &AggregationReplier::ProcessMemoryUtilisationRequest
+        )
     );
 }
 
-std::unique_ptr<AggServer::ExperimentRunResponse>
-AggServer::AggregationReplier::ProcessExperimentRunRequest(const AggServer::ExperimentRunRequest& message) {
-    std::unique_ptr<ExperimentRunResponse> response(new ExperimentRunResponse());
+template <class Request, class Response>
+std::unique_ptr<Response> AggServer::AggregationReplier::ProcessCachedRequest(
+    const Request& message,
+    std::unique_ptr<Response> (AggregationReplier::*process)(const Request&)
+) {
+    if (!response_cache_ || !IsRunFinished(message.experiment_run_id())) {
+        return (this->*process)(message);
+    }
 
-    const std::string& exp_name = message.experiment_name();
-    std::vector<std::pair<std::string, int> > exp_name_id_pairs;
+    // Deterministic serialization so equal requests always produce the same key
+    std::string key = Request::descriptor()->full_name();
+    key.push_back('\0');
+    {
+        google::protobuf::io::StringOutputStream key_stream(&key);
+        google::protobuf::io::CodedOutputStream coded_stream(&key_stream);
+        coded_stream.SetSerializationDeterministic(true);
+        message.SerializeToCodedStream(&coded_stream);
+    }
 
-    if (exp_name == "") {
-        // If no name is provided ask the database for the list of all names and ExperimentIDs
-        const auto& results = database_->GetValues(
-            "Experiment",
-            {"Name", "ExperimentID"}
-        );
-        for (const auto& row : results) {
-            const auto& name = row.at("Name").as<std::string>();
-            const auto& id = row.at("ExperimentID").as<int>();
-            exp_name_id_pairs.emplace_back(std::make_pair(name, id));
+    std::string cached_response;
+    if (response_cache_->Get(key, cached_response)) {
+        std::unique_ptr<Response> response(new Response());
+        if (response->ParseFromString(cached_response)) {
+            return response;
         }
-    } else {
-        /*int id = database_->GetID(
-            "Experiment",
-            "Name LIKE " + database_->EscapeString("%"+exp_name+"%")
-        );
-        exp_name_id_pairs.emplace_back(std::make_pair(exp_name, id));*/
-        const auto& results = database_->GetValues(
-            "Experiment",
-            {"Name", "ExperimentID"},
-            "Name LIKE " + database_->EscapeString("%"+exp_name+"%")
-        );
-        for (const auto& row : results) {
-            const auto& name = row.at("Name").as<std::string>();
-            const auto& id = row.at("ExperimentID").as<int>();
-            exp_name_id_pairs.emplace_back(std::make_pair(name, id));
+        std::cerr << "Failed to parse cached " << Response::descriptor()->full_name() << ", querying the database" << std::endl;
+    }
+
+    auto response = (this->*process)(message);
+    response_cache_->Put(key, response->SerializeAsString());
+    return response;
+}
+
+bool AggServer::AggregationReplier::IsRunFinished(int experiment_run_id) {
+    {
+        std::lock_guard<std::mutex> lock(finished_runs_mutex_);
+        if (finished_runs_.count(experiment_run_id)) {
+            return true;
         }
     }
 
-    for (const auto& pair : exp_name_id_pairs) {
-        const auto& name = pair.first;
-        const auto& id = pair.second;
-        auto exp_info = response->add_experiments();
-        exp_info->set_name(name);
+    DatabaseClient::QueryParameters params;
+    const auto& results = database_->GetValues(
+        "ExperimentRun",
+        {"ExperimentRunID"},
+        "ExperimentRunID = " + params.Add(experiment_run_id) + " AND EndTime IS NOT NULL",
+        params
+    );
+    if (results.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(finished_runs_mutex_);
+    finished_runs_.insert(experiment_run_id);
+    return true;
+}
 
-        const auto& results = database_->GetValues(
-            "ExperimentRun",
-            {
-                "ExperimentRunID",
-                "JobNum",
-                StringToPSQLTimestamp("StartTime")+" AS StartTime",
-                StringToPSQLTimestamp("EndTime")+" AS EndTime"},
-            "ExperimentID = " + std::to_string(id)
-        );
+void AggServer::AggregationReplier::WaitForRunUpdate(
+    int experiment_run_id,
+    const google::protobuf::RepeatedPtrField<google::protobuf::Timestamp>& time_interval
+) {
+    if (!run_update_watcher_ || long_poll_timeout_.count() == 0 || time_interval.size() < 1) {
+        return;
+    }
+    const int64_t since = TimeUtil::TimestampToMicroseconds(time_interval[0]);
+    if (since == 0) {
+        return;
+    }
+    run_update_watcher_->Wait(experiment_run_id, since, long_poll_timeout_);
+}
 
-        for (const auto& row : results) {
-            auto run = exp_info->add_runs();
-            run->set_experiment_run_id(row.at("ExperimentRunID").as<int>());
-            run->set_job_num(row.at("JobNum").as<int>());
-            std::string start_time_str = row.at("StartTime").as<std::string>();
-            std::cout << start_time_str << std::endl;
-            bool success = TimeUtil::FromString(start_time_str, run->mutable_start_time());
-            if (!success) {
-                throw std::runtime_error("Unable to parse ExperimentRun.StartTime from in-database string representation");
-            }
-            try {
-                std::string end_time_str = row.at("EndTime").as<std::string>();
-                TimeUtil::FromString(end_time_str, run->mutable_end_time());
-            } catch (const std::exception& e) {
-                std::cerr << "An exception occurred while querying experiment run end time, likely due to null: " << e.what() << "\n";
-            }
+std::unique_ptr<AggServer::ExperimentRunResponse>
+AggServer::AggregationReplier::ProcessExperimentRunRequest(const AggServer::ExperimentRunRequest& message) {
+    std::unique_ptr<ExperimentRunResponse> response(new ExperimentRunResponse());
+
+    // An empty name lists every experiment, otherwise those whose name starts with it
+    const auto& results = database_->GetExperimentRunInfo(message.experiment_name());
+
+    AggServer::ExperimentInfo* exp_info = nullptr;
+    int current_experiment_id = -1;
+    for (const auto& row : results) {
+        const auto& experiment_id = row.at("ExperimentID").as<int>();
+        if (exp_info == nullptr || experiment_id != current_experiment_id) {
+            current_experiment_id = experiment_id;
+            exp_info = response->add_experiments();
+            exp_info->set_name(row.at("Name").as<std::string>());
+        }
+
+        // Experiments that have never been run have no runs to add
+        if (row.at("ExperimentRunID").is_null()) {
+            continue;
+        }
+
+        auto run = exp_info->add_runs();
+        run->set_experiment_run_id(row.at("ExperimentRunID").as<int>());
+        run->set_job_num(row.at("JobNum").as<int>());
+        *run->mutable_start_time() = FieldToTimestamp(row.at("StartTime"));
+        // EndTime is NULL until the run is shut down
+        if (!row.at("EndTime").is_null()) {
+            *run->mutable_end_time() = FieldToTimestamp(row.at("EndTime"));
         }
     }
 
@@ -194,32 +266,77 @@ AggServer::AggregationReplier::ProcessExperimentStateRequest(const AggServer::Ex
     const int run_id = message.experiment_run_id();
 
     try {
-        const auto& run_results = database_->GetValues(
-            "ExperimentRun",
+        // The run row and the topology are read with one query per table in a single REPEATABLE READ transaction,
+        // so the number of queries doesn't grow with the size of the experiment and every table comes from the same
+        // snapshot; a row's parent is always present unless the run's topology is inconsistent.
+        // Every query binds the run's ID as its only parameter
+        DatabaseClient::QueryParameters run_params;
+        const std::string run_filter = "ExperimentRunID = " + run_params.Add(run_id);
+        const std::string component_filter = "ComponentID IN (SELECT ComponentID FROM Component WHERE " + run_filter + ")";
+        const std::string component_instance_filter =
+            "ComponentInstanceID IN (SELECT ComponentInstanceID FROM ComponentInstance WHERE " + component_filter + ")";
+
+        const std::vector<DatabaseClient::SelectQuery> queries = {
             {
-                "JobNum",
-                StringToPSQLTimestamp("StartTime")+" AS StartTime",
-                StringToPSQLTimestamp("EndTime")+" AS EndTime",
-                StringToPSQLTimestamp("LastUpdated")+" AS LastUpdated"
+                "ExperimentRun",
+                {
+                    "JobNum",
+                    TimestampToEpochMicroseconds("StartTime")+" AS StartTime",
+                    TimestampToEpochMicroseconds("EndTime")+" AS EndTime",
+                    TimestampToEpochMicroseconds("LastUpdated")+" AS LastUpdated"
+                },
+                run_filter,
+                run_params
             },
-            "ExperimentRunID = " + std::to_string(run_id)
-        );
+            {"Node", {"NodeID", "Hostname", "IP"}, run_filter, run_params},
+            {
+                "Container",
+                {"ContainerID", "NodeID", "Name", "Type"},
+                "NodeID IN (SELECT NodeID FROM Node WHERE " + run_filter + ")",
+                run_params
+            },
+            {"Component", {"ComponentID", "Name"}, run_filter, run_params},
+            {"Worker", {"WorkerID", "Name"}, run_filter, run_params},
+            {
+                "ComponentInstance",
+                {"ComponentInstanceID", "ContainerID", "ComponentID", "Name", "Path", "GraphmlID"},
+                component_filter,
+                run_params
+            },
+            {
+                "Port",
+                {"ComponentInstanceID", "Name", "Kind", "Path", "GraphmlID", "Middleware"},
+                component_instance_filter,
+                run_params
+            },
+            {
+                "WorkerInstance",
+                {"ComponentInstanceID", "WorkerID", "Name", "Path", "GraphmlID"},
+                component_instance_filter,
+                run_params
+            }
+        };
+
+        const auto& snapshot = database_->GetValuesSnapshot(queries);
+        const auto& run_results = snapshot.at(0);
+        const auto& node_results = snapshot.at(1);
+        const auto& container_results = snapshot.at(2);
+        const auto& component_results = snapshot.at(3);
+        const auto& worker_results = snapshot.at(4);
+        const auto& component_instance_results = snapshot.at(5);
+        const auto& port_results = snapshot.at(6);
+        const auto& worker_instance_results = snapshot.at(7);
 
         // 0 results indicates experiment run, more than one means conflicting experiment runs exist
         if (run_results.size() == 1) {
-            try {
-                const auto& last_updated = run_results.at(0).at("LastUpdated").as<std::string>();
-                TimeUtil::FromString(last_updated, response->mutable_last_updated()); 
-            } catch (const std::exception& e) {
-                std::cerr << "Unable to retrieve the last time experiment run was updated:\n" << 
-                    e.what() << std::endl;
+            // Both are NULL until the run has received a sample and been shut down respectively
+            const auto& last_updated = run_results.at(0).at("LastUpdated");
+            if (!last_updated.is_null()) {
+                *response->mutable_last_updated() = FieldToTimestamp(last_updated);
             }
-            try {
-                const auto& last_updated = run_results.at(0).at("EndTime").as<std::string>();
-                TimeUtil::FromString(last_updated, response->mutable_end_time()); 
-            } catch (const std::exception& e) {
-                std::cerr << "Unable to retrieve the shutdown time of the experiment run:\n" << 
-                    e.what() << std::endl;
+            const auto& end_time = run_results.at(0).at("EndTime");
+            if (!end_time.is_null()) {
+                *response->mutable_end_time() = FieldToTimestamp(end_time);
             }
         } else {
             throw std::runtime_error(
@@ -228,33 +345,63 @@ AggServer::AggregationReplier::ProcessExperimentStateRequest(const AggServer::Ex
             );
         }
 
-        const auto& node_results = database_->GetValues(
-            "Node",
-            {"NodeID", "Hostname", "IP"},
-            "ExperimentRunID = "+std::to_string(run_id)
-        );
+        std::unordered_map<int, AggServer::Node*> nodes;
         for (const auto& row : node_results) {
-            FillNodeState(*response->add_nodes(), row, run_id);
+            auto node = response->add_nodes();
+            FillNodeState(*node, row);
+            nodes.emplace(row.at("NodeID").as<int>(), node);
         }
 
-        const auto& component_results = database_->GetValues(
-            "Component",
-            {"Name"},
-            "ExperimentRunID = "+std::to_string(run_id)
-        );
+        std::unordered_map<int, AggServer::Container*> containers;
+        for (const auto& row : container_results) {
+            const auto node_it = nodes.find(row.at("NodeID").as<int>());
+            if (node_it == nodes.end()) {
+                continue;
+            }
+            auto container = node_it->second->add_containers();
+            FillContainerState(*container, row);
+            containers.emplace(row.at("ContainerID").as<int>(), container);
+        }
+
+        std::unordered_map<int, std::string> component_names;
         for (const auto& row : component_results) {
             auto new_component = response->add_components();
             new_component->set_name(row.at("Name").as<std::string>());
+            component_names.emplace(row.at("ComponentID").as<int>(), new_component->name());
         }
 
-        const auto& worker_results = database_->GetValues(
-            "Worker",
-            {"Name"},
-            "ExperimentRunID = "+std::to_string(run_id)
-        );
+        std::unordered_map<int, std::string> worker_names;
         for (const auto& row : worker_results) {
             auto new_component = response->add_workers();
             new_component->set_name(row.at("Name").as<std::string>());
+            worker_names.emplace(row.at("WorkerID").as<int>(), new_component->name());
+        }
+
+        std::unordered_map<int, AggServer::ComponentInstance*> component_instances;
+        for (const auto& row : component_instance_results) {
+            const auto container_it = containers.find(row.at("ContainerID").as<int>());
+            const auto component_it = component_names.find(row.at("ComponentID").as<int>());
+            if (container_it == containers.end() || component_it == component_names.end()) {
+                continue;
+            }
+            auto component_instance = container_it->second->add_component_instances();
+            FillComponentInstanceState(*component_instance, row, component_it->second);
+            component_instances.emplace(row.at("ComponentInstanceID").as<int>(), component_instance);
+        }
+
+        for (const auto& row : port_results) {
+            const auto instance_it = component_instances.find(row.at("ComponentInstanceID").as<int>());
+            if (instance_it != component_instances.end()) {
+                FillPortState(*instance_it->second->add_ports(), row);
+            }
+        }
+
+        for (const auto& row : worker_instance_results) {
+            const auto instance_it = component_instances.find(row.at("ComponentInstanceID").as<int>());
+            const auto worker_it = worker_names.find(row.at("WorkerID").as<int>());
+            if (instance_it != component_instances.end() && worker_it != worker_names.end()) {
+                FillWorkerInstanceState(*instance_it->second->add_worker_instances(), row, worker_it->second);
+            }
         }
     } catch (const std::exception& e) {
         std::cerr << "An exception occured while populating ExperimentStateResponse with ExperimentRunID=" << run_id << std::endl;
@@ -319,43 +466,43 @@ AggServer::AggregationReplier::ProcessPortLifecycleRequest(const AggServer::Port
         condition_vals.emplace_back(component_name);
     }*/
 
+    WaitForRunUpdate(message.experiment_run_id(), message.time_interval());
+
     try {
-        const pqxx::result res = database_->GetPortLifecycleEventInfo(
+        database_->GetPortLifecycleEventInfo(
             message.experiment_run_id(),
             start,
             end,
             conditions.getColumns(),
-            conditions.getValues()
-            //condition_cols,
-            //condition_vals
-        );
-
-        for (const auto& row : res) {
-            auto event = response->add_events();
-
-            // Build Event
-            auto&& type_int = row["Type"].as<int>();
-            event->set_type((AggServer::LifecycleType)type_int);
-            auto&& timestamp_str = row["SampleTime"].as<std::string>();
-            bool did_parse = TimeUtil::FromString(timestamp_str, event->mutable_time());
-            if (!did_parse) {
-                throw std::runtime_error("Failed to parse SampleTime field from string: "+timestamp_str);
-            }
+            conditions.getValues(),
+            [&response](const pqxx::result& rows) {
+                // Look columns up once per chunk rather than by name for every field of every row
+                const auto type_col = rows.column_number("Type");
+                const auto time_col = rows.column_number("SampleTime");
+                const auto name_col = rows.column_number("PortName");
+                const auto path_col = rows.column_number("PortPath");
+                const auto kind_col = rows.column_number("PortKind");
+                const auto middleware_col = rows.column_number("Middleware");
+                const auto graphml_col = rows.column_number("PortGraphmlID");
+
+                for (const auto& row : rows) {
+                    auto event = response->add_events();
+
+                    // Build Event
+                    event->set_type((AggServer::LifecycleType)row[type_col].as<int>());
+                    *event->mutable_time() = FieldToTimestamp(row[time_col]);
+
+                    // Build Port
+                    auto port = event->mutable_port();
+                    port->set_name(row[name_col].c_str());
+                    port->set_path(row[path_col].c_str());
+                    port->set_kind((AggServer::Port::Kind)row[kind_col].as<int>());
+                    port->set_middleware(row[middleware_col].c_str());
+                    port->set_graphml_id(row[graphml_col].c_str());
 
-            // Build Port
-            auto port = event->mutable_port();
-            port->set_name(row["PortName"].as<std::string>());
-            port->set_path(row["PortPath"].as<std::string>());
-            Port::Kind kind;
-            bool did_parse_lifecycle = AggServer::Port::Kind_Parse(row["PortKind"].as<std::string>(), &kind);
-            if (!did_parse_lifecycle) {
-                throw std::runtime_error("Failed to parse Lifecycle Kind field from string: "+row["PortKind"].as<std::string>());
+                }
             }
-            port->set_kind(kind);
-            port->set_middleware(row["Middleware"].as<std::string>());
-            port->set_graphml_id(row["PortGraphmlID"].as<std::string>());
-
-        }
+        );
 
     } catch (const std::exception& ex) {
         std::cerr << "An exception occurred while querying PortLifecycleEvents:" << ex.what() << std::endl;
@@ -399,47 +546,43 @@ AggServer::AggregationReplier::ProcessWorkloadEventRequest(const AggServer::Work
         .add("Component.Name", message.component_names())
         .finish();
 
+    WaitForRunUpdate(message.experiment_run_id(), message.time_interval());
+
     try {
-        const pqxx::result res = database_->GetWorkloadEventInfo(
+        database_->GetWorkloadEventInfo(
             message.experiment_run_id(),
             start,
             end,
             conditions.getColumns(),
-            conditions.getValues()
-        );
+            conditions.getValues(),
+            [&response](const pqxx::result& rows) {
+                // Look columns up once per chunk rather than by name for every field of every row
+                const auto type_col = rows.column_number("Type");
+                const auto time_col = rows.column_number("SampleTime");
+                const auto function_col = rows.column_number("FunctionName");
+                const auto args_col = rows.column_number("Arguments");
+                const auto name_col = rows.column_number("WorkerInstanceName");
+                const auto path_col = rows.column_number("WorkerInstancePath");
+                const auto graphml_col = rows.column_number("WorkerInstanceGraphmlID");
+
+                for (const auto& row : rows) {
+                    auto event = response->add_events();
+
+                    // Build Event
+                    event->set_type((WorkloadEvent::WorkloadEventType)row[type_col].as<int>());
+                    *event->mutable_time() = FieldToTimestamp(row[time_col]);
+                    event->set_function_name(row[function_col].c_str());
+                    event->set_args(row[args_col].c_str());
+
+                    // Build Port
+                    auto worker_inst = event->mutable_worker_inst();
+                    worker_inst->set_name(row[name_col].c_str());
+                    worker_inst->set_path(row[path_col].c_str());
+                    worker_inst->set_graphml_id(row[graphml_col].c_str());
 
-        for (const auto& row : res) {
-            auto event = response->add_events();
-
-            // Build Event
-            WorkloadEvent::WorkloadEventType type;
-            std::string type_string = row["Type"].as<std::string>();
-            bool did_parse_workloadtype = WorkloadEvent::WorkloadEventType_Parse(type_string, &type);
-            if (!did_parse_workloadtype) {
-                // Workaround for string mismatch due to Windows being unable to handle ERROR as a name (LOG-94)
-                if (type_string == "ERROR") {
-                    type = WorkloadEvent::ERROR_EVENT;
-                } else {
-                    throw std::runtime_error("Unable to parse WorkloadEventType from string: "+type_string);
                 }
             }
-            event->set_type(type);
-            //event->set_type((AggServer::WorkloadEvent::WorkloadEventType)type_int);
-            auto&& timestamp_str = row["SampleTime"].as<std::string>();
-            bool did_parse = TimeUtil::FromString(timestamp_str, event->mutable_time());
-            if (!did_parse) {
-                throw std::runtime_error("Failed to parse SampleTime field from string: "+timestamp_str);
-            }
-            event->set_function_name(row["FunctionName"].as<std::string>());
-            event->set_args(row["Arguments"].as<std::string>());
-
-            // Build Port
-            auto worker_inst = event->mutable_worker_inst();
-            worker_inst->set_name(row["WorkerInstanceName"].as<std::string>());
-            worker_inst->set_path(row["WorkerInstancePath"].as<std::string>());
-            worker_inst->set_graphml_id(row["WorkerInstanceGraphmlID"].as<std::string>());
-
-        }
+        );
 
     } catch (const std::exception& ex) {
         std::cerr << "An exception occurred while querying WorkloadEvents:" << ex.what() << std::endl;
@@ -485,6 +628,7 @@ AggServer::AggregationReplier::ProcessMarkerRequest(const AggServer::MarkerReque
     try {
         const pqxx::result res = database_->GetMarkerInfo(
             message.experiment_run_id(),
+            WorkloadEvent::MARKER,
             start,
             end,
             conditions.getColumns(),
@@ -494,9 +638,21 @@ AggServer::AggregationReplier::ProcessMarkerRequest(const AggServer::MarkerReque
         std::unordered_map<std::string, AggServer::MarkerNameSet*> name_set_map;
         std::unordered_map<std::string, AggServer::MarkerIDSet*> id_set_map;
 
+        const auto label_col = res.column_number("Label");
+        const auto id_col = res.column_number("WorkloadID");
+        const auto time_col = res.column_number("SampleTime");
+        const auto comp_name_col = res.column_number("ComponentInstanceName");
+        const auto comp_path_col = res.column_number("ComponentInstancePath");
+        const auto comp_graphml_col = res.column_number("ComponentInstanceGraphmlID");
+        const auto comp_type_col = res.column_number("ComponentName");
+        const auto worker_name_col = res.column_number("WorkerInstanceName");
+        const auto worker_path_col = res.column_number("WorkerInstancePath");
+        const auto worker_graphml_col = res.column_number("WorkerInstanceGraphmlID");
+        const auto worker_type_col = res.column_number("WorkerName");
+
         for (const auto& row : res) {
             // Get label and create new name_set if one doesn't already exist
-            const std::string& label = row["Label"].as<std::string>();
+            const std::string& label = row[label_col].as<std::string>();
             AggServer::MarkerNameSet* name_set = nullptr;
             try {
                 name_set = name_set_map.at(label);
@@ -507,7 +663,7 @@ AggServer::AggregationReplier::ProcessMarkerRequest(const AggServer::MarkerReque
             }
 
             // Get id and create new id_set if one doesn't already exist for the given name+id combo
-            int id = row["WorkloadID"].as<int>();
+            int id = row[id_col].as<int>();
             std::string id_str = label + '_' + std::to_string(id);
             AggServer::MarkerIDSet* id_set = nullptr;
             try {
@@ -520,25 +676,21 @@ AggServer::AggregationReplier::ProcessMarkerRequest(const AggServer::MarkerReque
 
             // Build MarkerEvent
             AggServer::MarkerEvent* event = id_set->add_events();
-            auto&& timestamp_str = row["SampleTime"].as<std::string>();
-            bool did_parse = TimeUtil::FromString(timestamp_str, event->mutable_timestamp());
-            if (!did_parse) {
-                throw std::runtime_error("Failed to parse SampleTime field from string: "+timestamp_str);
-            }
+            *event->mutable_timestamp() = FieldToTimestamp(row[time_col]);
 
             // Build ComponentInstance
             auto comp_inst = event->mutable_component_instance();
-            comp_inst->set_name(row["ComponentInstanceName"].as<std::string>());
-            comp_inst->set_path(row["ComponentInstancePath"].as<std::string>());
-            comp_inst->set_graphml_id(row["ComponentInstanceGraphmlID"].as<std::string>());
-            comp_inst->set_type(row["ComponentName"].as<std::string>());
+            comp_inst->set_name(row[comp_name_col].c_str());
+            comp_inst->set_path(row[comp_path_col].c_str());
+            comp_inst->set_graphml_id(row[comp_graphml_col].c_str());
+            comp_inst->set_type(row[comp_type_col].c_str());
 
             // Build WorkerInstance
             auto worker_inst = comp_inst->add_worker_instances();
-            worker_inst->set_name(row["WorkerInstanceName"].as<std::string>());
-            worker_inst->set_path(row["WorkerInstancePath"].as<std::string>());
-            worker_inst->set_graphml_id(row["WorkerInstanceGraphmlID"].as<std::string>());
-            worker_inst->set_type(row["WorkerName"].as<std::string>());
+            worker_inst->set_name(row[worker_name_col].c_str());
+            worker_inst->set_path(row[worker_path_col].c_str());
+            worker_inst->set_graphml_id(row[worker_graphml_col].c_str());
+            worker_inst->set_type(row[worker_type_col].c_str());
         }
 
     } catch (const std::exception& ex) {
@@ -586,33 +738,68 @@ AggServer::AggregationReplier::ProcessCPUUtilisationRequest(const AggServer::CPU
         // NOTE: assumes that the database provides results sorted by hostname!!
         std::string current_hostname;
         AggServer::CPUUtilisationNode* current_node;
-        const pqxx::result res = database_->GetCPUUtilInfo(
+        // With a point budget each node's series is collected then reduced by LTTB before it is added
+        std::vector<SeriesPoint> series;
+        const auto& add_series = [this, &series, &current_node]() {
+            for (const auto& point : DownsampleLTTB(series, max_points_)) {
+                auto event = current_node->add_events();
+                *event->mutable_time() = point.time;
+                event->set_cpu_utilisation(point.value);
+            }
+            series.clear();
+        };
+        const auto& add_events = [this, &response, &current_hostname, &current_node, &series, &add_series](const pqxx::result& rows) {
+            // Look columns up once per chunk rather than by name for every field of every row
+            const auto hostname_col = rows.column_number("NodeHostname");
+            const auto ip_col = rows.column_number("NodeIP");
+            const auto time_col = rows.column_number("SampleTime");
+            const auto value_col = rows.column_number("CPUUtilisation");
+
+            for (const auto& row : rows) {
+                // Check if we need to create a new Node due to encoutnering a new hostname
+                const char* hostname = row[hostname_col].c_str();
+                if (current_hostname != hostname) {
+                    if (!series.empty()) {
+                        add_series();
+                    }
+                    current_hostname = hostname;
+                    current_node = response->add_nodes();
+                    current_node->mutable_node_info()->set_hostname(current_hostname);
+                    current_node->mutable_node_info()->set_ip(row[ip_col].c_str());
+                }
+
+                // Build Event
+                SeriesPoint point;
+                point.time = FieldToTimestamp(row[time_col]);
+                point.value = row[value_col].as<double>();
+
+                if (max_points_ > 0) {
+                    series.push_back(point);
+                } else {
+                    auto event = current_node->add_events();
+                    *event->mutable_time() = point.time;
+                    event->set_cpu_utilisation(point.value);
+                }
+            }
+        };
+
+        WaitForRunUpdate(message.experiment_run_id(), message.time_interval());
+        const int resolution = ChooseSystemStatusResolution(message.experiment_run_id(), message.time_interval());
+        const auto row_count = database_->GetCPUUtilInfo(
             message.experiment_run_id(),
             start,
             end,
             condition_cols,
-            condition_vals
+            condition_vals,
+            add_events,
+            resolution
         );
-
-        for (const auto& row : res) {
-            // Check if we need to create a new Node due to encoutnering a new hostname
-            std::string hostname = row["NodeHostname"].as<std::string>();
-            if (current_hostname != hostname) {
-                current_hostname = hostname;
-                current_node = response->add_nodes();
-                current_node->mutable_node_info()->set_hostname(hostname);
-                current_node->mutable_node_info()->set_ip(row["NodeIP"].as<std::string>());
-            }
-            auto event = current_node->add_events();
-
-            // Build Event
-            auto&& timestamp_str = row["SampleTime"].as<std::string>();
-            bool did_parse = TimeUtil::FromString(timestamp_str, event->mutable_time());
-            if (!did_parse) {
-                throw std::runtime_error("Failed to parse SampleTime field from string: "+timestamp_str);
-            }
-            event->set_cpu_utilisation(row["CPUUtilisation"].as<double>());
-
+        // Runs recorded before rollups were maintained only have raw samples
+        if (resolution > 0 && row_count == 0) {
+            database_->GetCPUUtilInfo(message.experiment_run_id(), start, end, condition_cols, condition_vals, add_events);
+        }
+        if (!series.empty()) {
+            add_series();
         }
     } catch (const std::exception& ex) {
         std::cerr << "An exception occurred while querying CPUUtilisationEvents:" << ex.what() << std::endl;
@@ -660,33 +847,68 @@ AggServer::AggregationReplier::ProcessMemoryUtilisationRequest(const AggServer::
         // NOTE: assumes that the database provides results sorted by hostname!!
         std::string current_hostname;
         AggServer::MemoryUtilisationNode* current_node;
-        const pqxx::result res = database_->GetMemUtilInfo(
+        // With a point budget each node's series is collected then reduced by LTTB before it is added
+        std::vector<SeriesPoint> series;
+        const auto& add_series = [this, &series, &current_node]() {
+            for (const auto& point : DownsampleLTTB(series, max_points_)) {
+                auto event = current_node->add_events();
+                *event->mutable_time() = point.time;
+                event->set_memory_utilisation(point.value);
+            }
+            series.clear();
+        };
+        const auto& add_events = [this, &response, &current_hostname, &current_node, &series, &add_series](const pqxx::result& rows) {
+            // Look columns up once per chunk rather than by name for every field of every row
+            const auto hostname_col = rows.column_number("NodeHostname");
+            const auto ip_col = rows.column_number("NodeIP");
+            const auto time_col = rows.column_number("SampleTime");
+            const auto value_col = rows.column_number("PhysMemUtilisation");
+
+            for (const auto& row : rows) {
+                // Check if we need to create a new Node due to encoutnering a new hostname
+                const char* hostname = row[hostname_col].c_str();
+                if (current_hostname != hostname) {
+                    if (!series.empty()) {
+                        add_series();
+                    }
+                    current_hostname = hostname;
+                    current_node = response->add_nodes();
+                    current_node->mutable_node_info()->set_hostname(current_hostname);
+                    current_node->mutable_node_info()->set_ip(row[ip_col].c_str());
+                }
+
+                // Build Event
+                SeriesPoint point;
+                point.time = FieldToTimestamp(row[time_col]);
+                point.value = row[value_col].as<double>();
+
+                if (max_points_ > 0) {
+                    series.push_back(point);
+                } else {
+                    auto event = current_node->add_events();
+                    *event->mutable_time() = point.time;
+                    event->set_memory_utilisation(point.value);
+                }
+            }
+        };
+
+        WaitForRunUpdate(message.experiment_run_id(), message.time_interval());
+        const int resolution = ChooseSystemStatusResolution(message.experiment_run_id(), message.time_interval());
+        const auto row_count = database_->GetMemUtilInfo(
             message.experiment_run_id(),
             start,
             end,
             condition_cols,
-            condition_vals
+            condition_vals,
+            add_events,
+            resolution
         );
-
-        for (const auto& row : res) {
-            // Check if we need to create a new Node due to encoutnering a new hostname
-            std::string hostname = row["NodeHostname"].as<std::string>();
-            if (current_hostname != hostname) {
-                current_hostname = hostname;
-                current_node = response->add_nodes();
-                current_node->mutable_node_info()->set_hostname(hostname);
-                current_node->mutable_node_info()->set_ip(row["NodeIP"].as<std::string>());
-            }
-            auto event = current_node->add_events();
-
-            // Build Event
-            auto&& timestamp_str = row["SampleTime"].as<std::string>();
-            bool did_parse = TimeUtil::FromString(timestamp_str, event->mutable_time());
-            if (!did_parse) {
-                throw std::runtime_error("Failed to parse SampleTime field from string: "+timestamp_str);
-            }
-            event->set_memory_utilisation(row["PhysMemUtilisation"].as<double>());
-
+        // Runs recorded before rollups were maintained only have raw samples
+        if (resolution > 0 && row_count == 0) {
+            database_->GetMemUtilInfo(message.experiment_run_id(), start, end, condition_cols, condition_vals, add_events);
+        }
+        if (!series.empty()) {
+            add_series();
         }
     } catch (const std::exception& ex) {
         std::cerr << "An exception occurred while querying CPUUtilisationEvents:" << ex.what() << std::endl;
@@ -698,128 +920,87 @@ AggServer::AggregationReplier::ProcessMemoryUtilisationRequest(const AggServer::
 }
 
 
-void AggServer::AggregationReplier::FillNodeState(
-    AggServer::Node& node,
-    const pqxx::row& node_values,
-    int experiment_run_id
+int AggServer::AggregationReplier::ChooseSystemStatusResolution(
+    int experiment_run_id,
+    const google::protobuf::RepeatedPtrField<google::protobuf::Timestamp>& time_interval
 ) {
+    if (max_points_ == 0) {
+        return 0;
+    }
 
-    auto node_id = node_values.at("NodeID").as<std::string>();
-    node.set_hostname(node_values.at("Hostname").as<std::string>());
-    node.set_ip(node_values.at("IP").as<std::string>());
+    // Unset (or zero) bounds default to the run's own extent, as does anything reaching past it
+    DatabaseClient::QueryParameters params;
+    const auto& results = database_->GetValues(
+        "ExperimentRun",
+        {
+            TimestampToEpochMicroseconds("StartTime") + " AS StartTime",
+            TimestampToEpochMicroseconds("COALESCE(EndTime, LastUpdated, now())") + " AS EndTime"
+        },
+        "ExperimentRunID = " + params.Add(experiment_run_id),
+        params
+    );
+    if (results.empty()) {
+        return 0;
+    }
+    const auto& run_start = FieldToTimestamp(results[0]["StartTime"]);
+    const auto& run_end = FieldToTimestamp(results[0]["EndTime"]);
 
-    try {
-        const auto& results = database_->GetValues(
-            "Container",
-            {"ContainerID", "Name", "Type"},
-            "NodeID = " + node_id
-        );
-        for (const auto& row : results) {
-            FillContainerState(*node.add_containers(), row, experiment_run_id);
+    int64_t start_seconds = TimeUtil::TimestampToSeconds(run_start);
+    int64_t end_seconds = TimeUtil::TimestampToSeconds(run_end);
+    if (time_interval.size() >= 1) {
+        start_seconds = std::max(start_seconds, TimeUtil::TimestampToSeconds(time_interval[0]));
+    }
+    if (time_interval.size() >= 2 && TimeUtil::TimestampToSeconds(time_interval[1]) != 0) {
+        end_seconds = std::min(end_seconds, TimeUtil::TimestampToSeconds(time_interval[1]));
+    }
+    const int64_t span_seconds = std::max<int64_t>(end_seconds - start_seconds, 0);
+
+    const auto& resolutions = SystemStatusRollup::GetResolutions();
+    for (const auto& resolution : resolutions) {
+        if (static_cast<std::size_t>(span_seconds / resolution) <= max_points_) {
+            return resolution;
         }
-    } catch (const std::exception& e) {
-        std::cerr << "An exception occured while populating ExperimentStateResponse Node with NodeID=" << node_id << std::endl;
-        throw;
     }
+    return resolutions.back();
 }
 
-void AggServer::AggregationReplier::FillContainerState(
-    AggServer::Container& container,
-    const pqxx::row& container_values,
-    int experiment_run_id
-) {
-    auto container_id = container_values.at("ContainerID").as<std::string>();
+void AggServer::AggregationReplier::FillNodeState(AggServer::Node& node, const pqxx::row& node_values) {
+    node.set_hostname(node_values.at("Hostname").as<std::string>());
+    node.set_ip(node_values.at("IP").as<std::string>());
+}
+
+void AggServer::AggregationReplier::FillContainerState(AggServer::Container& container, const pqxx::row& container_values) {
     container.set_name(container_values.at("Name").as<std::string>());
     Container::ContainerType type;
     Container::ContainerType_Parse(container_values.at("Type").as<std::string>(), &type);
     container.set_type(type);
-
-    try {
-        const auto& results = database_->GetValues(
-            "ComponentInstance",
-            {"ComponentInstanceID", "Name", "ComponentID", "Path", "GraphmlID"},
-            "ComponentID = " + container_id
-        );
-        for (const auto& row : results) {
-            FillComponentInstanceState(*container.add_component_instances(), row, experiment_run_id);
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "An exception occured while populating ExperimentStateResponse Container with ContainerID=" << container_id << std::endl;
-        throw;
-    }
 }
 
 void AggServer::AggregationReplier::FillComponentInstanceState(
     AggServer::ComponentInstance& component_instance,
     const pqxx::row& component_instance_values,
-    int experiment_run_id
+    const std::string& component_name
 ) {
-
-    auto component_instance_id = component_instance_values.at("ComponentInstanceID").as<std::string>();
     component_instance.set_name(component_instance_values.at("Name").as<std::string>());
     component_instance.set_path(component_instance_values.at("Path").as<std::string>());
     component_instance.set_graphml_id(component_instance_values.at("GraphmlID").as<std::string>());
-
-    const std::string& component_id = component_instance_values.at("ComponentID").as<std::string>();
-
-    try {
-        const auto& component_results = database_->GetValues(
-            "Component",
-            {"Name"},
-            "ComponentID = " + component_id + " AND ExperimentRunID = " + std::to_string(experiment_run_id)
-        );
-        for (const auto& row : component_results) {
-            component_instance.set_type(row.at("Name").as<std::string>());
-        }
-
-        const auto& port_results = database_->GetValues(
-            "Port",
-            {"Name", "Kind", "Path", "GraphmlID", "Middleware"},
-            "ComponentInstanceID = " + component_instance_id
-        );
-        for (const auto& row : port_results) {
-            FillPortState(*component_instance.add_ports(), row);
-        }
-
-        const auto& worker_instance_results = database_->GetValues(
-            "WorkerInstance",
-            {"Name", "WorkerID", "Path", "GraphmlID"},
-            "ComponentInstanceID = " + component_instance_id
-        );
-        for (const auto& row : worker_instance_results) {
-            FillWorkerInstanceState(*component_instance.add_worker_instances(), row, experiment_run_id);
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "An exception occured while populating ExperimentStateResponse ComponentInstance with ID=" << component_instance_id << std::endl;
-        throw;
-    }
+    component_instance.set_type(component_name);
 }
 
 void AggServer::AggregationReplier::FillWorkerInstanceState(
     AggServer::WorkerInstance& worker_instance,
     const pqxx::row& worker_instance_values,
-    int experiment_run_id
+    const std::string& worker_name
 ) {
     worker_instance.set_name(worker_instance_values.at("Name").as<std::string>());
     worker_instance.set_path(worker_instance_values.at("Path").as<std::string>());
     worker_instance.set_graphml_id(worker_instance_values.at("GraphmlID").as<std::string>());
-    const std::string& worker_id = worker_instance_values.at("WorkerID").as<std::string>();
-
-    const auto& worker_results = database_->GetValues(
-        "Worker",
-        {"Name"},
-        "WorkerID = " + worker_id + " AND ExperimentRunID = " + std::to_string(experiment_run_id)
-    );
-    for (const auto& row : worker_results) {
-        worker_instance.set_type(row.at("Name").as<std::string>());
-    }
+    worker_instance.set_type(worker_name);
 }
 
 void AggServer::AggregationReplier::FillPortState(AggServer::Port& port, const pqxx::row& port_values) {
     port.set_name(port_values.at("Name").as<std::string>());
-    Port::Kind kind;
-    Port::Kind_Parse(port_values.at("Kind").as<std::string>(), &kind);
-    port.set_kind(kind);
+    port.set_kind((Port::Kind)port_values.at("Kind").as<int>());
     port.set_path(port_values.at("Path").as<std::string>());
     port.set_middleware(port_values.at("Middleware").as<std::string>());
     port.set_graphml_id(port_values.at("GraphmlID").as<std::string>());
@@ -3,6 +3,13 @@
 
 #include <zmq/protoreplier/protoreplier.hpp>
 #include "../databaseclient.h"
+#include "../systemstatusrollup.h"
+#include "responsecache.h"
+#include "runupdatewatcher.h"
+
+#include <chrono>
+#include <mutex>
+#include <unordered_set>
 
 #include <proto/aggregationmessage/aggregationmessage.pb.h>
 
@@ -11,7 +18,24 @@ namespace AggServer {
 
 class AggregationReplier : public zmq::ProtoReplier {
 public:
-    AggregationReplier(std::shared_ptr<DatabaseClient> db_client);
+    // A max_points of 0 always reads raw hardware samples, otherwise CPU and memory utilisation requests are served
+    // from the finest Hardware.SystemStatusRollup resolution that keeps each node's series within max_points, and any
+    // series still over budget (ie. raw samples from a run without rollups) is LTTB downsampled to max_points
+    // Responses for runs that have finished are kept in response_cache when one is given, their data can't change.
+    // The cache may be shared between repliers.
+    // With a run_update_watcher and a long_poll_timeout, event and utilisation requests for a live run whose interval
+    // starts at or after the run's LastUpdated wait up to that long for newer samples before querying, so a dashboard
+    // that resumes from the last SampleTime it received is answered as soon as there is something new rather than
+    // polling for empty deltas. The watcher may be shared between repliers.
+    // Resuming is by SampleTime only: events at the resume time are returned again, so the client has to drop the
+    // ones it already holds itself, and an event committed with a SampleTime before the resume time is never returned.
+    AggregationReplier(
+        std::shared_ptr<DatabaseClient> db_client,
+        std::size_t max_points = 0,
+        std::shared_ptr<ResponseCache> response_cache = nullptr,
+        std::shared_ptr<RunUpdateWatcher> run_update_watcher = nullptr,
+        std::chrono::milliseconds long_poll_timeout = std::chrono::milliseconds(0)
+    );
 
     std::unique_ptr<AggServer::ExperimentRunResponse>
     ProcessExperimentRunRequest(
@@ -50,27 +74,48 @@ public:
 
 private:
     std::shared_ptr<DatabaseClient> database_;
+    const std::size_t max_points_;
 
-    void FillNodeState(
-        AggServer::Node& node,
-        const pqxx::row& node_values,
-        int experiment_run_id
+    std::shared_ptr<ResponseCache> response_cache_;
+    std::mutex finished_runs_mutex_;
+    std::unordered_set<int> finished_runs_;
+
+    // Serves the response from response_cache_ when the request's run has finished, otherwise calls process directly
+    template <class Request, class Response>
+    std::unique_ptr<Response> ProcessCachedRequest(
+        const Request& message,
+        std::unique_ptr<Response> (AggregationReplier::*process)(const Request&)
     );
-    void FillContainerState(
-        AggServer::Container& container,
-        const pqxx::row& container_values,
-        int experiment_run_id
+    // Once a run's EndTime is set it is remembered without asking the database again
+    bool IsRunFinished(int experiment_run_id);
+
+    // Blocks until the run's LastUpdated passes the start of time_interval, the run finishes or long_poll_timeout_
+    // elapses. Returns straight away when long polling is disabled, the interval has no start or the watcher is full.
+    void WaitForRunUpdate(
+        int experiment_run_id,
+        const google::protobuf::RepeatedPtrField<google::protobuf::Timestamp>& time_interval
     );
+    std::shared_ptr<RunUpdateWatcher> run_update_watcher_;
+    const std::chrono::milliseconds long_poll_timeout_;
+
+    // Returns 0 when the raw samples should be read
+    int ChooseSystemStatusResolution(
+        int experiment_run_id,
+        const google::protobuf::RepeatedPtrField<google::protobuf::Timestamp>& time_interval
+    );
+
+    void FillNodeState(AggServer::Node& node, const pqxx::row& node_values);
+    void FillContainerState(AggServer::Container& container, const pqxx::row& container_values);
     void FillComponentInstanceState(
         AggServer::ComponentInstance& component_instance,
         const pqxx::row& component_instance_values,
-        int experiment_run_id
+        const std::string& component_name
     );
     void FillWorkerInstanceState(
         AggServer::WorkerInstance& worker_instance,
         const pqxx::row& worker_instance_values,
-        int experiment_run_id
-        );
+        const std::string& worker_name
+    );
     void FillPortState(AggServer::Port& port, const pqxx::row& port_values);
 
     void RegisterCallbacks();
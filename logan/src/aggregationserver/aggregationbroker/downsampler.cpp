@@ -0,0 +1,66 @@
+#include "downsampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <google/protobuf/util/time_util.h>
+
+using google::protobuf::util::TimeUtil;
+
+std::vector<AggServer::SeriesPoint> AggServer::DownsampleLTTB(const std::vector<SeriesPoint>& series, std::size_t max_points) {
+    // Fewer than 3 points leaves no room for a bucket between the end points
+    if (max_points < 3 || series.size() <= max_points) {
+        return series;
+    }
+
+    // Times are measured from the first sample so the triangle areas keep their precision
+    const int64_t origin_us = TimeUtil::TimestampToMicroseconds(series.front().time);
+    std::vector<double> times;
+    times.reserve(series.size());
+    for (const auto& point : series) {
+        times.push_back(static_cast<double>(TimeUtil::TimestampToMicroseconds(point.time) - origin_us));
+    }
+
+    std::vector<SeriesPoint> sampled;
+    sampled.reserve(max_points);
+    sampled.push_back(series.front());
+
+    const double bucket_size = static_cast<double>(series.size() - 2) / static_cast<double>(max_points - 2);
+    std::size_t previous = 0;
+
+    for (std::size_t bucket = 0; bucket < max_points - 2; bucket++) {
+        const std::size_t bucket_start = static_cast<std::size_t>(std::floor(bucket * bucket_size)) + 1;
+        const std::size_t bucket_end = static_cast<std::size_t>(std::floor((bucket + 1) * bucket_size)) + 1;
+
+        // The next bucket's average stands in for the point that will be kept from it, the last bucket uses the end point
+        const std::size_t next_start = bucket_end;
+        const std::size_t next_end = std::min(static_cast<std::size_t>(std::floor((bucket + 2) * bucket_size)) + 1, series.size());
+        double next_time = 0;
+        double next_value = 0;
+        for (std::size_t i = next_start; i < next_end; i++) {
+            next_time += times[i];
+            next_value += series[i].value;
+        }
+        next_time /= static_cast<double>(next_end - next_start);
+        next_value /= static_cast<double>(next_end - next_start);
+
+        double max_area = -1;
+        std::size_t chosen = bucket_start;
+        for (std::size_t i = bucket_start; i < bucket_end; i++) {
+            const double area = std::fabs(
+                (times[previous] - next_time) * (series[i].value - series[previous].value)
+                - (times[previous] - times[i]) * (next_value - series[previous].value)
+            );
+            if (area > max_area) {
+                max_area = area;
+                chosen = i;
+            }
+        }
+
+        sampled.push_back(series[chosen]);
+        previous = chosen;
+    }
+
+    sampled.push_back(series.back());
+    return sampled;
+}
@@ -0,0 +1,23 @@
+#ifndef DOWNSAMPLER_H
+#define DOWNSAMPLER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <google/protobuf/timestamp.pb.h>
+
+namespace AggServer {
+
+struct SeriesPoint {
+    google::protobuf::Timestamp time;
+    double value;
+};
+
+// Largest-Triangle-Three-Buckets: keeps the first and last points and, from each of the max_points - 2 buckets in
+// between, the point forming the largest triangle with the previously kept point and the next bucket's average.
+// Unlike averaging this keeps spikes visible. Series already within max_points are returned unchanged.
+std::vector<SeriesPoint> DownsampleLTTB(const std::vector<SeriesPoint>& series, std::size_t max_points);
+
+}
+
+#endif //DOWNSAMPLER_H
@@ -29,12 +29,28 @@ int main(int argc, char** argv) {
     std::string database_ip;
     std::string replier_endpoint;
     std::string password;
+    std::size_t max_points;
+    std::size_t cache_mb;
+    std::size_t worker_count;
+    int worker_base_port;
+    std::size_t max_concurrent_requests;
+    unsigned int long_poll_ms;
+    std::size_t max_long_polls;
+    unsigned int request_timeout_ms;
 
     // Parse command line options
     boost::program_options::options_description desc("Aggregation Server Options");
     desc.add_options()("ip-address,i", boost::program_options::value<std::string>(&database_ip)->multitoken()->required(), "address of the postgres database (192.168.1.1)");
     desc.add_options()("bind-address,b", boost::program_options::value<std::string>(&replier_endpoint)->multitoken()->required(), "address of the endpoint to which clients will be connecting");
     desc.add_options()("password,p", boost::program_options::value<std::string>(&password)->default_value(""), "the password for the database");
+    desc.add_options()("max-points", boost::program_options::value<std::size_t>(&max_points)->default_value(0), "point budget per node for CPU and memory utilisation responses, served from hardware rollups when exceeded and LTTB downsampled to fit, 0 always returns raw samples");
+    desc.add_options()("cache-mb", boost::program_options::value<std::size_t>(&cache_mb)->default_value(256), "memory in MB for caching responses about finished experiment runs, 0 disables the cache");
+    desc.add_options()("workers", boost::program_options::value<std::size_t>(&worker_count)->default_value(0), "number of repliers, each with their own database connection, serving requests concurrently, 0 serves requests one at a time");
+    desc.add_options()("worker-base-port", boost::program_options::value<int>(&worker_base_port)->default_value(40000), "first loopback port the workers bind to, one port per worker");
+    desc.add_options()("max-concurrent-requests", boost::program_options::value<std::size_t>(&max_concurrent_requests)->default_value(0), "limit on event and utilisation requests running at once across the workers, 0 keeps one worker free for experiment run and state requests, which needs --workers 2 or more");
+    desc.add_options()("long-poll-ms", boost::program_options::value<unsigned int>(&long_poll_ms)->default_value(0), "how long an event or utilisation request for a live run, starting at or after the run's last sample, waits for new samples before answering, 0 answers immediately, requires --workers");
+    desc.add_options()("max-long-polls", boost::program_options::value<std::size_t>(&max_long_polls)->default_value(0), "limit on long polls waiting at once, each holding a worker without counting against --max-concurrent-requests, further ones are answered immediately, 0 allows as many as --max-concurrent-requests");
+    desc.add_options()("request-timeout-ms", boost::program_options::value<unsigned int>(&request_timeout_ms)->default_value(60000), "how long a worker has to answer a request before the client is sent an error and the worker is given no more requests until it answers, 0 waits forever, must be longer than --long-poll-ms");
     desc.add_options()("help,h", "Display help");
 
     // Construct a variable_map
@@ -50,10 +66,34 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // With a single worker there is none left to keep free for experiment run and state requests
+    if (worker_count == 1 && max_concurrent_requests == 0) {
+        std::cerr << "Arg Error: --workers 1 needs an explicit --max-concurrent-requests, the default keeps one worker free" << std::endl << std::endl;
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    // A long poll holds its replier for the whole wait, without workers it would hold up every other request
+    if (long_poll_ms > 0 && worker_count == 0) {
+        std::cerr << "Arg Error: --long-poll-ms requires --workers greater than 0" << std::endl << std::endl;
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    // Otherwise every long poll that runs its full length would be failed as timed out
+    if (request_timeout_ms > 0 && long_poll_ms >= request_timeout_ms) {
+        std::cerr << "Arg Error: --request-timeout-ms must be longer than --long-poll-ms" << std::endl << std::endl;
+        std::cout << desc << std::endl;
+        return 1;
+    }
 
 
     //const std::string connect_address("tcp://localhost:12345");
-    AggServer::AggregationBroker aggserver(replier_endpoint, database_ip, password);
+    AggServer::AggregationBroker aggserver(
+        replier_endpoint, database_ip, password, max_points, cache_mb * 1024 * 1024,
+        worker_count, worker_base_port, max_concurrent_requests, std::chrono::milliseconds(long_poll_ms), max_long_polls,
+        std::chrono::milliseconds(request_timeout_ms)
+    );
     execution.Start();
     
     return 0;
@@ -0,0 +1,220 @@
+#include "replierpool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    // How often the pool checks whether it has been asked to stop
+    const long poll_timeout_ms = 100;
+
+    std::string WorkerID(std::size_t index) {
+        return "worker_" + std::to_string(index);
+    }
+}
+
+AggServer::ReplierPool::ReplierPool(
+    const std::string& frontend_endpoint,
+    const std::vector<std::string>& worker_endpoints,
+    const std::unordered_set<std::string>& priority_functions,
+    std::size_t max_concurrent_requests,
+    std::function<std::size_t()> waiting_requests,
+    std::chrono::milliseconds request_timeout
+) :
+    priority_functions_(priority_functions),
+    max_concurrent_requests_(max_concurrent_requests),
+    waiting_requests_(waiting_requests),
+    request_timeout_(request_timeout),
+    frontend_(context_, ZMQ_ROUTER),
+    backend_(context_, ZMQ_ROUTER),
+    running_(true)
+{
+    if (worker_endpoints.empty()) {
+        throw std::invalid_argument("ReplierPool requires at least one worker endpoint");
+    }
+
+    const int linger_ms = 0;
+    frontend_.setsockopt(ZMQ_LINGER, &linger_ms, sizeof(linger_ms));
+    backend_.setsockopt(ZMQ_LINGER, &linger_ms, sizeof(linger_ms));
+    // Fail sends to workers that haven't connected yet instead of silently dropping the request
+    const int mandatory = 1;
+    backend_.setsockopt(ZMQ_ROUTER_MANDATORY, &mandatory, sizeof(mandatory));
+
+    frontend_.bind(frontend_endpoint);
+    for (std::size_t i = 0; i < worker_endpoints.size(); i++) {
+        const std::string worker_id = WorkerID(i);
+        backend_.setsockopt(ZMQ_CONNECT_RID, worker_id.data(), worker_id.size());
+        backend_.connect(worker_endpoints[i]);
+        idle_workers_.push_back(worker_id);
+    }
+
+    thread_ = std::thread(&ReplierPool::Run, this);
+}
+
+AggServer::ReplierPool::~ReplierPool() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void AggServer::ReplierPool::Run() {
+    while (running_) {
+        zmq::pollitem_t items[] = {
+            {static_cast<void*>(frontend_), 0, ZMQ_POLLIN, 0},
+            {static_cast<void*>(backend_), 0, ZMQ_POLLIN, 0}
+        };
+
+        try {
+            zmq::poll(items, 2, poll_timeout_ms);
+
+            // Replies are [worker id, client envelope..., reply], the worker is free again once it has replied
+            if (items[1].revents & ZMQ_POLLIN) {
+                auto parts = ReceiveMultipart(backend_);
+                const std::string worker_id(static_cast<const char*>(parts.front().data()), parts.front().size());
+                auto busy_it = busy_workers_.find(worker_id);
+                if (busy_it != busy_workers_.end()) {
+                    if (!busy_it->second.priority) {
+                        concurrent_requests_--;
+                    }
+                    busy_workers_.erase(busy_it);
+                }
+                idle_workers_.push_back(worker_id);
+
+                // The client of a timed out request has already been answered
+                if (timed_out_workers_.erase(worker_id) == 0) {
+                    parts.erase(parts.begin());
+                    SendMultipart(frontend_, parts);
+                }
+            }
+
+            // Requests are [client id, empty delimiter, function name, ...]
+            if (items[0].revents & ZMQ_POLLIN) {
+                Request request{ReceiveMultipart(frontend_), false};
+                if (request.parts.size() >= 3) {
+                    const auto& function_frame = request.parts[2];
+                    const std::string function_name(static_cast<const char*>(function_frame.data()), function_frame.size());
+                    request.priority = priority_functions_.count(function_name) > 0;
+                }
+                if (request.priority) {
+                    priority_requests_.push_back(std::move(request));
+                } else {
+                    requests_.push_back(std::move(request));
+                }
+            }
+
+            ExpireRequests();
+            DispatchRequests();
+        } catch (const zmq::error_t& e) {
+            std::cerr << "An exception occurred in the aggregation broker's replier pool: " << e.what() << std::endl;
+        }
+    }
+}
+
+void AggServer::ReplierPool::DispatchRequests() {
+    // A request blocked in a long poll frees its slot once it starts waiting, it is picked up on the next poll
+    const std::size_t waiting_requests = waiting_requests_ ? waiting_requests_() : 0;
+    const std::size_t querying_requests = concurrent_requests_ - std::min(waiting_requests, concurrent_requests_);
+
+    // Each worker gets one attempt per call so a worker that isn't connected yet is retried on the next poll
+    std::size_t attempts = idle_workers_.size();
+    std::size_t dispatched_requests = 0;
+    while (attempts-- > 0 && !idle_workers_.empty()) {
+        std::deque<Request>* queue = nullptr;
+        if (!priority_requests_.empty()) {
+            queue = &priority_requests_;
+        } else if (!requests_.empty() && querying_requests + dispatched_requests < max_concurrent_requests_) {
+            queue = &requests_;
+        } else {
+            return;
+        }
+
+        const std::string worker_id = idle_workers_.front();
+        idle_workers_.pop_front();
+
+        // Sending empties the frames, so the client's envelope is copied first in case the request times out
+        BusyWorker busy_worker{queue->front().priority, Multipart(), std::chrono::steady_clock::now() + request_timeout_};
+        for (const auto& frame : queue->front().parts) {
+            busy_worker.envelope.emplace_back(frame.data(), frame.size());
+            if (frame.size() == 0) {
+                break;
+            }
+        }
+
+        if (!SendToWorker(worker_id, queue->front())) {
+            idle_workers_.push_back(worker_id);
+            continue;
+        }
+
+        const bool priority = queue->front().priority;
+        queue->pop_front();
+        busy_workers_[worker_id] = std::move(busy_worker);
+        if (!priority) {
+            concurrent_requests_++;
+            dispatched_requests++;
+        }
+    }
+}
+
+void AggServer::ReplierPool::ExpireRequests() {
+    if (request_timeout_.count() == 0) {
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    for (auto busy_it = busy_workers_.begin(); busy_it != busy_workers_.end(); ) {
+        if (now < busy_it->second.deadline) {
+            ++busy_it;
+            continue;
+        }
+
+        const std::string& worker_id = busy_it->first;
+        std::cerr << "Request on " << worker_id << " took longer than " << request_timeout_.count()
+            << "ms, failing it and holding the worker back until it replies" << std::endl;
+
+        // Answered the way a replier answers a request whose callback threw, no function name or type and the error as the body
+        const std::string error = "Aggregation broker request timed out after " + std::to_string(request_timeout_.count()) + "ms";
+        Multipart reply = std::move(busy_it->second.envelope);
+        reply.emplace_back();
+        reply.emplace_back();
+        reply.emplace_back(error.data(), error.size());
+        SendMultipart(frontend_, reply);
+
+        if (!busy_it->second.priority) {
+            concurrent_requests_--;
+        }
+        timed_out_workers_.insert(worker_id);
+        busy_it = busy_workers_.erase(busy_it);
+    }
+}
+
+bool AggServer::ReplierPool::SendToWorker(const std::string& worker_id, Request& request) {
+    zmq::message_t id_frame(worker_id.data(), worker_id.size());
+    try {
+        backend_.send(id_frame, ZMQ_SNDMORE);
+    } catch (const zmq::error_t& e) {
+        if (e.num() == EHOSTUNREACH) {
+            return false;
+        }
+        throw;
+    }
+
+    SendMultipart(backend_, request.parts);
+    return true;
+}
+
+AggServer::ReplierPool::Multipart AggServer::ReplierPool::ReceiveMultipart(zmq::socket_t& socket) {
+    Multipart parts;
+    do {
+        parts.emplace_back();
+        socket.recv(&parts.back());
+    } while (parts.back().more());
+    return parts;
+}
+
+void AggServer::ReplierPool::SendMultipart(zmq::socket_t& socket, Multipart& parts) {
+    for (std::size_t i = 0; i < parts.size(); i++) {
+        socket.send(parts[i], (i + 1 == parts.size()) ? 0 : ZMQ_SNDMORE);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef REPLIERPOOL_H
+#define REPLIERPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <zmq.hpp>
+
+namespace AggServer {
+
+// Load balancing front end for a pool of ProtoRepliers.
+// Clients connect to the ROUTER bound on frontend_endpoint as they would a single replier, each request is handed to an
+// idle worker over a ROUTER connected to every worker endpoint, so a slow query only ties up the worker running it.
+// Requests for priority_functions (cheap lookups such as GetExperimentRuns) are dispatched ahead of anything queued and
+// at most max_concurrent_requests of the rest run at once, leaving the remaining workers free for priority requests.
+// waiting_requests, when given, returns how many dispatched requests are blocked in a long poll rather than querying,
+// those don't count against max_concurrent_requests.
+// A request that hasn't been answered within request_timeout (0 waits forever) is failed back to its client, and its
+// worker isn't given another request until the late reply, which is dropped, arrives.
+class ReplierPool {
+public:
+    ReplierPool(
+        const std::string& frontend_endpoint,
+        const std::vector<std::string>& worker_endpoints,
+        const std::unordered_set<std::string>& priority_functions,
+        std::size_t max_concurrent_requests,
+        std::function<std::size_t()> waiting_requests = nullptr,
+        std::chrono::milliseconds request_timeout = std::chrono::milliseconds(0)
+    );
+    ~ReplierPool();
+
+private:
+    typedef std::vector<zmq::message_t> Multipart;
+
+    struct Request {
+        Multipart parts;
+        bool priority;
+    };
+
+    struct BusyWorker {
+        bool priority;
+        // The client's routing frames, up to and including the empty delimiter, to fail the request with
+        Multipart envelope;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void Run();
+    void DispatchRequests();
+    // Returns false, leaving the request untouched, if the worker isn't connected yet
+    bool SendToWorker(const std::string& worker_id, Request& request);
+    // Fails requests that have passed their deadline back to their clients
+    void ExpireRequests();
+
+    static Multipart ReceiveMultipart(zmq::socket_t& socket);
+    static void SendMultipart(zmq::socket_t& socket, Multipart& parts);
+
+    const std::unordered_set<std::string> priority_functions_;
+    const std::size_t max_concurrent_requests_;
+    const std::function<std::size_t()> waiting_requests_;
+    const std::chrono::milliseconds request_timeout_;
+
+    zmq::context_t context_;
+    zmq::socket_t frontend_;
+    zmq::socket_t backend_;
+
+    std::deque<Request> priority_requests_;
+    std::deque<Request> requests_;
+    std::deque<std::string> idle_workers_;
+    std::unordered_map<std::string, BusyWorker> busy_workers_;
+    // Workers whose request was failed by ExpireRequests, held back until they reply
+    std::unordered_set<std::string> timed_out_workers_;
+    std::size_t concurrent_requests_ = 0;
+
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+}
+
+#endif //REPLIERPOOL_H
@@ -0,0 +1,46 @@
+#include "responsecache.h"
+
+AggServer::ResponseCache::ResponseCache(std::size_t max_bytes) :
+    max_bytes_(max_bytes)
+{
+}
+
+bool AggServer::ResponseCache::Get(const std::string& key, std::string& response) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto lookup_it = entry_lookup_.find(key);
+    if (lookup_it == entry_lookup_.end()) {
+        return false;
+    }
+    entries_.splice(entries_.begin(), entries_, lookup_it->second);
+    response = lookup_it->second->second;
+    return true;
+}
+
+void AggServer::ResponseCache::Put(const std::string& key, std::string response) {
+    const std::size_t entry_bytes = key.size() + response.size();
+    if (entry_bytes > max_bytes_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto lookup_it = entry_lookup_.find(key);
+    if (lookup_it != entry_lookup_.end()) {
+        // Stored by a concurrent request for the same key, the responses are identical
+        entries_.splice(entries_.begin(), entries_, lookup_it->second);
+        return;
+    }
+
+    EvictLocked(entry_bytes);
+    entries_.emplace_front(key, std::move(response));
+    entry_lookup_.emplace(key, entries_.begin());
+    used_bytes_ += entry_bytes;
+}
+
+void AggServer::ResponseCache::EvictLocked(std::size_t required_bytes) {
+    while (!entries_.empty() && used_bytes_ + required_bytes > max_bytes_) {
+        const auto& oldest = entries_.back();
+        used_bytes_ -= oldest.first.size() + oldest.second.size();
+        entry_lookup_.erase(oldest.first);
+        entries_.pop_back();
+    }
+}
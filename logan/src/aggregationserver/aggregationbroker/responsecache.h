@@ -0,0 +1,40 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace AggServer {
+
+// Serialized responses keyed by their serialized request, evicting the least recently used once max_bytes is reached.
+// Only responses that can never change should be stored, nothing is invalidated.
+class ResponseCache {
+public:
+    explicit ResponseCache(std::size_t max_bytes);
+
+    // Returns false on a miss
+    bool Get(const std::string& key, std::string& response);
+    // Responses larger than the whole cache are not stored
+    void Put(const std::string& key, std::string response);
+
+private:
+    typedef std::list<std::pair<std::string, std::string> > EntryList;
+
+    void EvictLocked(std::size_t required_bytes);
+
+    const std::size_t max_bytes_;
+    std::size_t used_bytes_ = 0;
+
+    std::mutex mutex_;
+    // Most recently used first
+    EntryList entries_;
+    std::unordered_map<std::string, EntryList::iterator> entry_lookup_;
+};
+
+}
+
+#endif //RESPONSECACHE_H
@@ -0,0 +1,148 @@
+#include "runupdatewatcher.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+const std::chrono::milliseconds AggServer::RunUpdateWatcher::default_poll_interval(250);
+
+AggServer::RunUpdateWatcher::RunUpdateWatcher(
+    std::shared_ptr<DatabaseClient> database,
+    std::size_t max_waiters,
+    std::chrono::milliseconds poll_interval
+) :
+    database_(database),
+    max_waiters_(max_waiters),
+    poll_interval_(poll_interval)
+{
+    thread_ = std::thread(&RunUpdateWatcher::PollLoop, this);
+}
+
+AggServer::RunUpdateWatcher::~RunUpdateWatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        terminate_ = true;
+    }
+    poll_condition_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void AggServer::RunUpdateWatcher::Wait(int experiment_run_id, int64_t since_us, std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (terminate_ || waiter_count_ >= max_waiters_) {
+        return;
+    }
+    waiter_count_++;
+    auto& run = runs_[experiment_run_id];
+    run.waiter_count++;
+    if (!run.polled) {
+        poll_condition_.notify_one();
+    }
+
+    // Only a newer sample ends the wait early, ones sharing since are still returned once it ends
+    update_condition_.wait_until(lock, deadline, [this, &run, since_us]() {
+        return terminate_ || (run.polled && (run.finished || run.last_updated_us > since_us));
+    });
+
+    waiter_count_--;
+    if (--run.waiter_count == 0) {
+        runs_.erase(experiment_run_id);
+    }
+}
+
+std::size_t AggServer::RunUpdateWatcher::GetWaiterCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return waiter_count_;
+}
+
+void AggServer::RunUpdateWatcher::PollLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!terminate_) {
+        // Sleeps until there is a run waiting, then polls every poll_interval_, or straight away for a newly waited on run
+        poll_condition_.wait_for(lock, poll_interval_, [this]() {
+            if (terminate_) {
+                return true;
+            }
+            for (const auto& run : runs_) {
+                if (!run.second.polled) {
+                    return true;
+                }
+            }
+            return false;
+        });
+        if (terminate_) {
+            break;
+        }
+        if (runs_.empty()) {
+            continue;
+        }
+
+        lock.unlock();
+        PollRuns();
+        lock.lock();
+    }
+    update_condition_.notify_all();
+}
+
+void AggServer::RunUpdateWatcher::PollRuns() {
+    std::vector<int> run_ids;
+    std::vector<std::string> run_id_values;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& run : runs_) {
+            run_ids.push_back(run.first);
+            run_id_values.push_back(std::to_string(run.first));
+        }
+    }
+
+    // LastUpdated is only advanced as samples are written, so checking it is far cheaper than rerunning the event query
+    std::unordered_map<int, RunState> polled_runs;
+    bool failed = false;
+    try {
+        DatabaseClient::QueryParameters params;
+        const auto& results = database_->GetValues(
+            "ExperimentRun",
+            {
+                "ExperimentRunID",
+                DatabaseClient::TimestampToEpochMicroseconds("LastUpdated") + " AS LastUpdated",
+                "EndTime IS NOT NULL AS Finished"
+            },
+            "ExperimentRunID = ANY(" + params.AddArray(run_id_values) + "::int[])",
+            params
+        );
+        for (const auto& row : results) {
+            auto& polled_run = polled_runs[row["ExperimentRunID"].as<int>()];
+            polled_run.finished = row["Finished"].as<bool>();
+            if (!row["LastUpdated"].is_null()) {
+                polled_run.last_updated_us = row["LastUpdated"].as<int64_t>();
+            }
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Failed to poll experiment runs for updates: " << ex.what() << std::endl;
+        failed = true;
+    }
+
+    // Runs first waited on while the query ran are left for the next poll
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& run_id : run_ids) {
+        auto run_it = runs_.find(run_id);
+        if (run_it == runs_.end()) {
+            continue;
+        }
+        auto& run = run_it->second;
+        run.polled = true;
+        auto polled_it = polled_runs.find(run_id);
+        if (failed || polled_it == polled_runs.end()) {
+            // A missing run, or a database we can't reach, is answered straight away rather than held until the timeout
+            run.finished = true;
+        } else {
+            run.finished = polled_it->second.finished;
+            run.last_updated_us = polled_it->second.last_updated_us;
+        }
+    }
+    update_condition_.notify_all();
+}
@@ -0,0 +1,68 @@
+#ifndef RUNUPDATEWATCHER_H
+#define RUNUPDATEWATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "../databaseclient.h"
+
+namespace AggServer {
+
+// Watches ExperimentRun.LastUpdated for the runs long polls are waiting on, so every waiting request shares one query
+// per poll_interval rather than each polling the database itself. At most max_waiters requests wait at once, the rest
+// are answered straight away.
+class RunUpdateWatcher {
+public:
+    RunUpdateWatcher(
+        std::shared_ptr<DatabaseClient> database,
+        std::size_t max_waiters,
+        std::chrono::milliseconds poll_interval = default_poll_interval
+    );
+    ~RunUpdateWatcher();
+
+    // Blocks until the run's LastUpdated passes since_us, the run finishes or timeout elapses.
+    // Returns straight away if max_waiters requests are already waiting.
+    void Wait(int experiment_run_id, int64_t since_us, std::chrono::milliseconds timeout);
+
+    // Requests currently blocked in Wait
+    std::size_t GetWaiterCount() const;
+
+    static const std::chrono::milliseconds default_poll_interval;
+
+private:
+    struct RunState {
+        std::size_t waiter_count = 0;
+        // Unset until the run has been polled once
+        bool polled = false;
+        bool finished = false;
+        int64_t last_updated_us = 0;
+    };
+
+    void PollLoop();
+    void PollRuns();
+
+    std::shared_ptr<DatabaseClient> database_;
+    const std::size_t max_waiters_;
+    const std::chrono::milliseconds poll_interval_;
+
+    mutable std::mutex mutex_;
+    // Wakes waiters once their runs have been polled
+    std::condition_variable update_condition_;
+    // Wakes the poll thread when a run is first waited on, or to stop it
+    std::condition_variable poll_condition_;
+    std::unordered_map<int, RunState> runs_;
+    std::size_t waiter_count_ = 0;
+    bool terminate_ = false;
+
+    std::thread thread_;
+};
+
+}
+
+#endif //RUNUPDATEWATCHER_H
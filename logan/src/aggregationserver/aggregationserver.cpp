@@ -44,12 +44,18 @@ int main(int argc, char** argv) {
     std::string database_ip;
     std::string password;
     std::string environment_manager_endpoint;
+    std::size_t pipeline_depth;
+    std::string spool_directory;
+    unsigned int port_event_rollup_ms;
 
     //Parse command line options
     boost::program_options::options_description desc("Aggregation Server Options");
     desc.add_options()("ip-address,i", boost::program_options::value<std::string>(&database_ip)->multitoken()->required(), "address of the postgres database (192.168.1.1)");
     desc.add_options()("password,p", boost::program_options::value<std::string>(&password)->default_value(""), "the password for the database");
     desc.add_options()("environment-manager,e", boost::program_options::value<std::string>(&environment_manager_endpoint)->required(), "Environment manager fully qualified endpoint ie. (tcp://192.168.111.230:20000).");
+    desc.add_options()("pipeline-depth", boost::program_options::value<std::size_t>(&pipeline_depth)->default_value(0), "number of event inserts kept in flight per experiment run, 0 waits on every insert");
+    desc.add_options()("spool-directory", boost::program_options::value<std::string>(&spool_directory)->default_value(""), "directory to spool events to while the database is unavailable or falling behind, disabled if empty");
+    desc.add_options()("port-event-rollup-ms", boost::program_options::value<unsigned int>(&port_event_rollup_ms)->default_value(0), "interval in milliseconds of the per port PortEventRollup rows written alongside raw PortEvents, 0 disables rollups");
     desc.add_options()("help,h", "Display help");
 
     //Construct a variable_map
@@ -68,7 +74,7 @@ int main(int argc, char** argv) {
 
     
     std::unique_ptr<AggregationServer> aggServer = std::unique_ptr<AggregationServer>(
-        new AggregationServer(database_ip, password, environment_manager_endpoint)
+        new AggregationServer(database_ip, password, environment_manager_endpoint, pipeline_depth, spool_directory, port_event_rollup_ms)
     );
     
     std::cout << "Started AggregationServer without throwing any exceptions" << std::endl;
@@ -86,7 +92,10 @@ int main(int argc, char** argv) {
 AggregationServer::AggregationServer(
     const std::string& database_ip,
     const std::string& password,
-    const std::string& environment_endpoint
+    const std::string& environment_endpoint,
+    std::size_t pipeline_depth,
+    const std::string& spool_directory,
+    unsigned int port_event_rollup_ms
 ) {
 
     std::stringstream conn_string_stream;
@@ -94,8 +103,12 @@ AggregationServer::AggregationServer(
     conn_string_stream << "password = " << password << " hostaddr = " << database_ip << " port = 5432";
     
 
-    database_client = std::make_shared<DatabaseClient>(conn_string_stream.str());
-    experiment_tracker = std::unique_ptr<ExperimentTracker>(new ExperimentTracker(database_client));
+    const std::string connection_string = conn_string_stream.str();
+
+    database_client = std::make_shared<DatabaseClient>(connection_string);
+    experiment_tracker = std::unique_ptr<ExperimentTracker>(new ExperimentTracker(database_client, connection_string, pipeline_depth, spool_directory,
+        std::chrono::milliseconds(port_event_rollup_ms)
+    ));
 
     nodemanager_protohandler = std::unique_ptr<AggregationProtoHandler>(new NodeManagerProtoHandler(database_client, *experiment_tracker));
    
@@ -34,7 +34,10 @@ public:
     AggregationServer(
         const std::string& database_ip,
         const std::string& password,
-        const std::string& environment_endpoint
+        const std::string& environment_endpoint,
+        std::size_t pipeline_depth = 0,
+        const std::string& spool_directory = "",
+        unsigned int port_event_rollup_ms = 0
     );
     
     void StimulatePorts(const std::vector<ModelEvent::LifecycleEvent>& events, zmq::ProtoWriter& writer);
@@ -0,0 +1,207 @@
+#include "../eventspool.h"
+#include "../sequencetracker.h"
+#include "../aggregationbroker/downsampler.h"
+#include "../aggregationbroker/responsecache.h"
+
+#include <google/protobuf/util/time_util.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using google::protobuf::util::TimeUtil;
+
+namespace {
+    int failure_count = 0;
+
+    void Check(bool condition, const std::string& test_name, const std::string& description) {
+        if (!condition) {
+            failure_count++;
+            std::cerr << test_name << ": FAILED " << description << std::endl;
+        }
+    }
+
+    void TestSequenceTracker() {
+        const std::string test_name = "SequenceTracker";
+
+        SequenceTracker tracker(8);
+        Check(tracker.Observe("host", 1) && tracker.Observe("host", 2), test_name, "in order numbers are accepted");
+        Check(!tracker.Observe("host", 1), test_name, "a re-delivered first message is a duplicate");
+        Check(tracker.GetMetrics().reset_count == 0, test_name, "a re-delivered first message doesn't reset the producer");
+
+        Check(tracker.Observe("host", 5), test_name, "a jump forward is accepted");
+        Check(tracker.GetMetrics().missing_count == 2, test_name, "the numbers jumped over are missing");
+        Check(tracker.Observe("host", 3), test_name, "a late number inside the window is accepted");
+        Check(!tracker.Observe("host", 3), test_name, "a late number is only accepted once");
+        Check(tracker.GetMetrics().missing_count == 1 && tracker.GetMetrics().reordered_count == 1, test_name,
+            "a late number fills its gap");
+
+        Check(tracker.Observe("host", 20) && tracker.Observe("host", 4), test_name, "a number behind the window is let through");
+        Check(tracker.GetMetrics().behind_window_count == 1 && tracker.GetMetrics().reordered_count == 1, test_name,
+            "a number behind the window isn't counted as reordered");
+
+        Check(tracker.Observe("host", 1) && tracker.GetMetrics().reset_count == 1, test_name,
+            "a first message that isn't a duplicate restarts the producer");
+
+        tracker.Forget("host", 1);
+        Check(tracker.Observe("host", 1) && tracker.GetMetrics().reset_count == 1, test_name,
+            "the retry of a forgotten first message isn't a restart");
+        Check(tracker.Observe("host", 2), test_name, "numbering carries on after a retried first message");
+        tracker.Forget("host", 2);
+        Check(tracker.Observe("host", 2) && !tracker.Observe("host", 2), test_name, "a forgotten number is accepted once more");
+
+        Check(tracker.Observe("other", 100) && tracker.GetMetrics().producer_count == 2, test_name,
+            "producers are tracked separately");
+    }
+
+    void TestEventSpool() {
+        const std::string test_name = "EventSpool";
+        // Unique per run, a spool left by an earlier run would be replayed
+        const std::string directory = "aggregation_tests_spool_"
+            + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        const std::size_t segment_size = 64;
+
+        {
+            EventSpool spool(directory, segment_size);
+            Check(spool.Empty(), test_name, "a new spool is empty");
+            for (int i = 0; i < 10; i++) {
+                spool.Append("Event", std::string(20, static_cast<char>('a' + i)));
+            }
+
+            EventSpool::Frame frame;
+            bool in_order = true;
+            for (int i = 0; i < 4; i++) {
+                in_order = in_order && spool.Peek(frame) && frame.type_name == "Event" && frame.payload[0] == 'a' + i;
+                spool.Pop();
+            }
+            Check(in_order, test_name, "frames are read back in order across segments");
+        }
+
+        {
+            // Only the frames left unconsumed by the previous instance are replayed
+            EventSpool spool(directory, segment_size);
+            EventSpool::Frame frame;
+            int replayed_count = 0;
+            bool resumed = false;
+            while (spool.Peek(frame)) {
+                if (replayed_count == 0) {
+                    resumed = frame.payload[0] == 'e';
+                }
+                spool.Pop();
+                replayed_count++;
+            }
+            Check(resumed && replayed_count == 6, test_name, "a reopened spool resumes after the last consumed frame");
+            Check(spool.Empty(), test_name, "a fully read spool is empty");
+
+            spool.Append("Event", "last");
+        }
+
+        // A length far past the end of the file, as a crash part way through a frame could leave, after "last"
+        int last_segment = 0;
+        {
+            while (!std::ifstream(directory + "/segment_" + std::to_string(last_segment) + ".spool").good()) {
+                last_segment++;
+            }
+            std::ofstream segment(directory + "/segment_" + std::to_string(last_segment) + ".spool", std::ios::binary | std::ios::app);
+            const char corrupt_length[4] = {'\xFF', '\xFF', '\xFF', '\x7F'};
+            segment.write(corrupt_length, 4);
+        }
+
+        {
+            EventSpool spool(directory, segment_size);
+            EventSpool::Frame frame;
+            Check(spool.Peek(frame) && frame.payload == "last", test_name, "frames before a corrupt tail are replayed");
+            spool.Pop();
+            Check(!spool.Peek(frame) && spool.Empty(), test_name, "a corrupt frame length is skipped as a truncated tail");
+        }
+
+        // The last read segment and the one the final instance opened are left for a later writer
+        for (int segment = last_segment; segment <= last_segment + 1; segment++) {
+            std::remove((directory + "/segment_" + std::to_string(segment) + ".spool").c_str());
+        }
+        std::remove((directory + "/head").c_str());
+        std::remove(directory.c_str());
+    }
+
+    std::vector<AggServer::SeriesPoint> MakeSeries(std::size_t size) {
+        std::vector<AggServer::SeriesPoint> series;
+        for (std::size_t i = 0; i < size; i++) {
+            AggServer::SeriesPoint point;
+            point.time = TimeUtil::MicrosecondsToTimestamp(static_cast<int64_t>(i) * 1000000);
+            point.value = static_cast<double>(i % 10);
+            series.push_back(point);
+        }
+        return series;
+    }
+
+    void TestDownsampler() {
+        const std::string test_name = "DownsampleLTTB";
+
+        const auto& short_series = MakeSeries(5);
+        Check(AggServer::DownsampleLTTB(short_series, 10).size() == 5, test_name, "a series within max_points is unchanged");
+
+        auto series = MakeSeries(1000);
+        series[500].value = 1000;
+        const auto& sampled = AggServer::DownsampleLTTB(series, 50);
+        Check(sampled.size() == 50, test_name, "a series over max_points is reduced to max_points");
+        Check(sampled.front().time == series.front().time && sampled.back().time == series.back().time, test_name,
+            "the first and last points are kept");
+
+        bool spike_kept = false;
+        bool in_order = true;
+        for (std::size_t i = 0; i < sampled.size(); i++) {
+            spike_kept = spike_kept || sampled[i].value == 1000;
+            if (i > 0 && sampled[i].time <= sampled[i - 1].time) {
+                in_order = false;
+            }
+        }
+        Check(spike_kept, test_name, "a spike is kept");
+        Check(in_order, test_name, "points stay in time order");
+    }
+
+    void TestResponseCache() {
+        const std::string test_name = "ResponseCache";
+
+        // Entries are charged their key and response bytes, so each of these takes 10 of the 30
+        AggServer::ResponseCache cache(30);
+        std::string response;
+        Check(!cache.Get("a", response), test_name, "a missing key misses");
+
+        cache.Put("a", "123456789");
+        cache.Put("b", "123456789");
+        cache.Put("c", "123456789");
+        Check(cache.Get("a", response) && response == "123456789", test_name, "a stored response is returned");
+
+        // a was just used, so b is the least recently used
+        cache.Put("d", "123456789");
+        Check(!cache.Get("b", response), test_name, "the least recently used entry is evicted");
+        Check(cache.Get("a", response) && cache.Get("c", response) && cache.Get("d", response), test_name,
+            "entries within the byte budget are kept");
+
+        cache.Put("e", std::string(30, 'x'));
+        Check(!cache.Get("e", response), test_name, "a response larger than the cache isn't stored");
+        Check(cache.Get("a", response), test_name, "an oversized response doesn't evict anything");
+
+        cache.Put("f", "1234");
+        cache.Put("g", "1234");
+        Check(!cache.Get("c", response) && cache.Get("d", response), test_name,
+            "evicts only as many bytes as the new entry needs");
+    }
+}
+
+int main(int argc, char** argv) {
+    TestSequenceTracker();
+    TestEventSpool();
+    TestDownsampler();
+    TestResponseCache();
+
+    if (failure_count > 0) {
+        std::cerr << failure_count << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
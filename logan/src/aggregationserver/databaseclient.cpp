@@ -6,17 +6,28 @@
 #include <algorithm>
 
 #include <chrono>
+#include <cmath>
+#include <limits>
+#include <locale>
+
+#include <google/protobuf/util/time_util.h>
 
 #include "utils.h"
 
 DatabaseClient::DatabaseClient(const std::string& connection_details) : 
     connection_(connection_details),
-    batched_connection_(connection_details)
+    batched_connection_(connection_details),
+    connection_details_(connection_details)
 {
 
 }
 
 DatabaseClient::~DatabaseClient() {
+    {
+        // Whatever owns the callbacks may already be gone, so the writes are committed without them
+        std::lock_guard<std::mutex> pipeline_lock(pipeline_mutex_);
+        FlushPipelineLocked(nullptr);
+    }
     std::lock_guard<std::mutex> trans_lock(batched_transaction_mutex_);
     FlushBatchedTransaction();
 }
@@ -38,6 +49,7 @@ void DatabaseClient::CreateTable(const std::string& table_name,
 
     try {
         pqxx::work transaction(connection_, "CreateTableTransaction");
+        transaction_count_++;
         transaction.exec(query_stream.str());
         transaction.commit();
     } catch (const std::exception& e) {
@@ -129,6 +141,7 @@ int DatabaseClient::InsertValuesUnique(const std::string& table_name,
     std::vector<std::string> unique_vals = std::vector<std::string>(unique_cols.size());
 
     std::stringstream query_stream;
+    QueryParameters params;
 
     query_stream << "WITH i AS (" << std::endl;
     query_stream << "INSERT INTO " << connection_.esc(table_name);
@@ -153,11 +166,12 @@ int DatabaseClient::InsertValuesUnique(const std::string& table_name,
         }
     }
 
+    // Untyped so each value takes its column's type
     query_stream << std::endl << " VALUES (";
     for (unsigned int i=0; i<values.size()-1; i++) {
-        query_stream << connection_.quote(values.at(i)) << ",";
+        query_stream << params.Add(values.at(i), "") << ",";
     }
-    query_stream << connection_.quote(values.at(values.size()-1)) << ")" << std::endl;
+    query_stream << params.Add(values.at(values.size()-1), "") << ")" << std::endl;
 
     query_stream << "ON CONFLICT " << BuildColTuple(unique_cols) << " DO UPDATE" << std::endl;
     //query_stream << "ON CONFLICT  ON CONSTRAINT " << BuildColTuple(unique_cols) << " DO UPDATE" << std::endl;
@@ -167,7 +181,7 @@ int DatabaseClient::InsertValuesUnique(const std::string& table_name,
 
     query_stream << "SELECT " << id_column << " FROM i" << std::endl;
     query_stream << "UNION ALL" << std::endl;
-    query_stream << "SELECT " << id_column << " FROM " << table_name << " " << BuildWhereAllEqualClause(unique_cols, unique_vals) << std::endl;
+    query_stream << "SELECT " << id_column << " FROM " << table_name << " " << BuildWhereAllEqualClause(unique_cols, unique_vals, params) << std::endl;
     //query_stream << "SELECT " << id_column << " FROM " << table_name << " WHERE " << unique_col << " = " << connection_.quote(unique_val) << std::endl;
     query_stream << "LIMIT 1" << std::endl;
 
@@ -178,7 +192,8 @@ int DatabaseClient::InsertValuesUnique(const std::string& table_name,
 
     try {
         pqxx::work transaction(connection_, "InsertValuesUniqueTransaction");
-        auto&& result = transaction.exec(query_stream.str());
+        transaction_count_++;
+        auto&& result = ExecutePreparedQuery(transaction, query_stream.str(), params);
         transaction.commit();
         
         std::string lower_id_column(id_column);
@@ -217,8 +232,170 @@ int DatabaseClient::InsertValuesUnique(const std::string& table_name,
    return id_value;
 }
 
-const pqxx::result DatabaseClient::GetValues(const std::string table_name,
-                            const std::vector<std::string>& columns, const std::string& query) {
+std::vector<int> DatabaseClient::InsertMultipleValuesUnique(
+    const TableRows& table,
+    const std::vector<std::string>& unique_cols
+) {
+    std::vector<int> ids(table.rows.size(), -1);
+    if (table.rows.empty()) {
+        return ids;
+    }
+
+    QueryParameters params;
+    const auto& query = BuildMultiRowUpsert(table, unique_cols, params);
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        pqxx::work transaction(connection_, "InsertMultipleValuesUniqueTransaction");
+        transaction_count_++;
+        auto&& result = transaction.exec_params(query, pqxx::prepare::make_dynamic_params(params.GetValues()));
+        transaction.commit();
+
+        std::string lower_id_column(strip_schema(table.table_name) + "ID");
+        std::transform(lower_id_column.begin(), lower_id_column.end(), lower_id_column.begin(), ::tolower);
+        const auto ordinal_colnum = result.column_number("inputordinal");
+        const auto id_colnum = result.column_number(lower_id_column);
+
+        for (const auto& row : result) {
+            // Ordinality counts from 1
+            ids.at(row.at(ordinal_colnum).as<std::size_t>() - 1) = row.at(id_colnum).as<int>();
+        }
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while inserting " << table.rows.size() << " rows uniquely into "
+            << table.table_name << ": " << e.what() << std::endl;
+        throw;
+    }
+
+    // A row committed by another connection after our snapshot was taken is neither inserted nor visible
+    for (std::size_t i = 0; i < ids.size(); i++) {
+        if (ids[i] == -1) {
+            throw std::runtime_error("No ID returned for row " + std::to_string(i) + " of unique insert into " + table.table_name);
+        }
+    }
+    return ids;
+}
+
+void DatabaseClient::InsertMultipleValues(
+    const std::vector<TableRows>& tables,
+    int experiment_run_id,
+    const DatabaseValue& last_sample_time,
+    const WriteCallback& on_written
+) {
+    if (IsPipelining()) {
+        EnqueuePipelinedWrite(tables, experiment_run_id, last_sample_time, on_written);
+        return;
+    }
+
+    std::size_t value_count = last_sample_time.GetType() != DatabaseValue::Type::Null ? 1 : 0;
+    for (const auto& table : tables) {
+        value_count += table.rows.size() * table.columns.size();
+    }
+
+    if (value_count > max_bound_parameters) {
+        InsertMultipleValueLiterals(tables, experiment_run_id, last_sample_time);
+    } else {
+        InsertMultipleValueParameters(tables, experiment_run_id, last_sample_time);
+    }
+    if (on_written) {
+        on_written(true);
+    }
+}
+
+void DatabaseClient::InsertMultipleValueParameters(
+    const std::vector<TableRows>& tables,
+    int experiment_run_id,
+    const DatabaseValue& last_sample_time
+) {
+    const bool has_last_sample_time = last_sample_time.GetType() != DatabaseValue::Type::Null;
+
+    QueryParameters params;
+    std::vector<std::string> statements;
+    for (const auto& table : tables) {
+        if (!table.rows.empty()) {
+            statements.push_back(BuildMultiRowInsert(table, &params));
+        }
+    }
+    if (has_last_sample_time) {
+        statements.push_back(BuildUpdateLastSampleTime(experiment_run_id, params.AddValue(last_sample_time)));
+    }
+    if (statements.empty()) {
+        return;
+    }
+
+    // Bound parameters need a single statement, so all but the last write become data modifying CTEs.
+    // The batch still costs a single round trip.
+    std::stringstream query_stream;
+    for (std::size_t i = 0; i + 1 < statements.size(); i++) {
+        query_stream << (i == 0 ? "WITH " : ", ") << "write_" << i << " AS (" << std::endl;
+        query_stream << statements.at(i) << std::endl << ")" << std::endl;
+    }
+    query_stream << statements.back();
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        pqxx::work transaction(connection_, "InsertMultipleValuesTransaction");
+        transaction_count_++;
+        transaction.exec_params(query_stream.str(), pqxx::prepare::make_dynamic_params(params.GetValues()));
+        transaction.commit();
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while inserting multiple rows into the database: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+void DatabaseClient::InsertMultipleValueLiterals(
+    const std::vector<TableRows>& tables,
+    int experiment_run_id,
+    const DatabaseValue& last_sample_time
+) {
+    std::stringstream query_stream;
+
+    for (const auto& table : tables) {
+        if (!table.rows.empty()) {
+            query_stream << BuildMultiRowInsert(table) << ";" << std::endl;
+        }
+    }
+    if (last_sample_time.GetType() != DatabaseValue::Type::Null) {
+        query_stream << BuildUpdateLastSampleTime(experiment_run_id, FormatValue(last_sample_time)) << ";" << std::endl;
+    }
+
+    const auto& query = query_stream.str();
+    if (query.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        // Statements are sent together so the whole batch costs a single round trip
+        pqxx::work transaction(connection_, "InsertMultipleValuesTransaction");
+        transaction_count_++;
+        transaction.exec(query);
+        transaction.commit();
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while inserting multiple rows into the database: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+void DatabaseClient::InsertRow(
+    const std::string& table_name,
+    const std::vector<std::string>& columns,
+    const DatabaseRow& values,
+    int experiment_run_id,
+    const DatabaseValue& last_sample_time,
+    const WriteCallback& on_written
+) {
+    InsertMultipleValues({{table_name, columns, {values}}}, experiment_run_id, last_sample_time, on_written);
+}
+
+std::string DatabaseClient::BuildSelectQuery(
+    const std::string& table_name,
+    const std::vector<std::string>& columns,
+    const std::string& condition
+) {
     std::stringstream query_stream;
 
     query_stream << "SELECT ";
@@ -230,34 +407,101 @@ const pqxx::result DatabaseClient::GetValues(const std::string table_name,
     }
     query_stream << std::endl;
     query_stream << " FROM " << table_name << std::endl;
-    if (query != "") {
-        query_stream << " WHERE (" << query << ")";
+    if (condition != "") {
+        query_stream << " WHERE (" << condition << ")";
     }
     query_stream << ";" << std::endl;
+    return query_stream.str();
+}
+
+const pqxx::result DatabaseClient::GetValues(const std::string table_name,
+                            const std::vector<std::string>& columns, const std::string& query) {
+    const auto& select_query = BuildSelectQuery(table_name, columns, query);
 
     std::lock_guard<std::mutex> conn_guard(conn_mutex_);
 
     try {
         pqxx::work transaction(connection_, "GetValuesTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
+        transaction_count_++;
+        const auto& pg_result = transaction.exec(select_query);
         transaction.commit();
 
         return pg_result;
     } catch (const std::exception& e)  {
         std::cerr << "An exception occurred while querying values from the database: " <<std::endl;
-        std::cerr << query_stream.str() << std::endl;
+        std::cerr << select_query << std::endl;
+        std::cerr << e.what() << std::endl;
+        throw;
+    }
+}
+
+const pqxx::result DatabaseClient::GetValues(
+    const std::string& table_name,
+    const std::vector<std::string>& columns,
+    const std::string& query,
+    const QueryParameters& params
+) {
+    const auto& select_query = BuildSelectQuery(table_name, columns, query);
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        pqxx::work transaction(connection_, "GetValuesTransaction");
+        transaction_count_++;
+        const auto& pg_result = ExecutePreparedQuery(transaction, select_query, params);
+        transaction.commit();
+
+        return pg_result;
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while querying values from the database: " <<std::endl;
+        std::cerr << select_query << std::endl;
+        std::cerr << e.what() << std::endl;
+        throw;
+    }
+}
+
+std::vector<pqxx::result> DatabaseClient::GetValuesSnapshot(const std::vector<SelectQuery>& queries) {
+    std::vector<std::string> query_strings;
+    for (const auto& select : queries) {
+        query_strings.push_back(BuildSelectQuery(select.table_name, select.columns, select.condition));
+    }
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    std::vector<pqxx::result> results;
+    results.reserve(queries.size());
+    try {
+        pqxx::transaction<pqxx::isolation_level::repeatable_read, pqxx::readwrite_policy::read_only> transaction(
+            connection_, "GetValuesSnapshotTransaction"
+        );
+        transaction_count_++;
+        for (unsigned int i=0; i < queries.size(); i++) {
+            results.push_back(ExecutePreparedQuery(transaction, query_strings.at(i), queries.at(i).params));
+        }
+        transaction.commit();
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while querying values from the database: " << std::endl;
+        if (results.size() < query_strings.size()) {
+            std::cerr << query_strings.at(results.size()) << std::endl;
+        }
         std::cerr << e.what() << std::endl;
         throw;
     }
+    return results;
 }
 
 int DatabaseClient::GetID(const std::string& table_name, const std::string& query) {
+    return GetID(table_name, query, QueryParameters());
+}
+
+int DatabaseClient::GetID(const std::string& table_name, const std::string& query, const QueryParameters& params) {
     std::string&& id_column_name = table_name+"ID";
 
     const auto& results = GetValues(
         table_name,
         {id_column_name},
-        query
+        query,
+        params
     );
 
     if (results.empty()) {
@@ -276,16 +520,101 @@ int DatabaseClient::GetID(const std::string& table_name, const std::string& quer
     throw std::runtime_error("Did not find ID amongst returned database columns when calling GetID on "+table_name);
 }
 
-const pqxx::result DatabaseClient::GetPortLifecycleEventInfo(
+int DatabaseClient::FindID(
+    const std::string& table_name,
+    const std::string& id_column,
+    const std::vector<std::string>& columns,
+    const std::vector<std::string>& values
+) {
+    QueryParameters params;
+    std::stringstream query_stream;
+    query_stream << "SELECT " << id_column << " FROM " << table_name << " " << BuildWhereAllEqualClause(columns, values, params) << " LIMIT 1";
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        pqxx::work transaction(connection_, "FindIDTransaction");
+        transaction_count_++;
+        const auto& result = ExecutePreparedQuery(transaction, query_stream.str(), params);
+        transaction.commit();
+        if (result.empty()) {
+            return -1;
+        }
+        return result[0][0].as<int>();
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while looking up an ID in " << table_name << ": " << e.what() << std::endl;
+        throw;
+    }
+}
+
+const pqxx::result DatabaseClient::ExecuteQuery(const std::string& query) {
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        pqxx::work transaction(connection_, "ExecuteQueryTransaction");
+        transaction_count_++;
+        const auto& pg_result = transaction.exec(query);
+        transaction.commit();
+
+        return pg_result;
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while executing query: " << e.what() << std::endl;
+        std::cerr << query << std::endl;
+        throw;
+    }
+}
+
+const pqxx::result DatabaseClient::GetExperimentRunInfo(const std::string& name_prefix) {
+    std::stringstream query_stream;
+
+    query_stream << "SELECT Experiment.Name, Experiment.ExperimentID, ExperimentRun.ExperimentRunID, ExperimentRun.JobNum,\n";
+    query_stream << "   " << TimestampToEpochMicroseconds("ExperimentRun.StartTime") << " AS StartTime, " << TimestampToEpochMicroseconds("ExperimentRun.EndTime") << " AS EndTime\n";
+    query_stream << "FROM Experiment LEFT JOIN ExperimentRun ON Experiment.ExperimentID = ExperimentRun.ExperimentID\n";
+    QueryParameters params;
+    if (!name_prefix.empty()) {
+        // Anchored at the start so IX_Experiment_Name_Pattern can serve it, wildcards in the prefix are matched literally
+        std::string escaped_prefix;
+        for (const auto& character : name_prefix) {
+            if (character == '%' || character == '_' || character == '\\') {
+                escaped_prefix.push_back('\\');
+            }
+            escaped_prefix.push_back(character);
+        }
+        query_stream << "WHERE Experiment.Name LIKE " << params.Add(escaped_prefix + "%") << "\n";
+    }
+    query_stream << "ORDER BY Experiment.Name, Experiment.ExperimentID, ExperimentRun.JobNum";
+    query_stream << std::endl;
+
+    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
+
+    try {
+        pqxx::work transaction(connection_, "GetExperimentRunTransaction");
+        transaction_count_++;
+        // Not prepared, a generic plan can't turn LIKE on a parameter into an IX_Experiment_Name_Pattern range scan
+        const auto& pg_result = transaction.exec_params(
+            query_stream.str(),
+            pqxx::prepare::make_dynamic_params(params.GetValues())
+        );
+        transaction.commit();
+
+        return pg_result;
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while querying ExperimentRun info: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+std::size_t DatabaseClient::GetPortLifecycleEventInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback
 ) {
     std::stringstream query_stream;
 
-    query_stream << "SELECT PortLifecycleEvent.Type, " << StringToPSQLTimestamp("SampleTime") << " AS SampleTime,\n";
+    query_stream << "SELECT PortLifecycleEvent.Type, " << TimestampToEpochMicroseconds("SampleTime") << " AS SampleTime,\n";
     query_stream << "   Port.Name AS PortName, Port.Type AS PortType, Port.Kind AS PortKind, Port.Path AS PortPath, Port.Middleware, Port.GraphmlID AS PortGraphmlID, \n";
     query_stream << "   ComponentInstance.Name AS ComponentInstanceName, ComponentInstance.Path AS ComponentInstancePath, ComponentInstance.GraphmlID AS ComponentInstanceGraphmlID,\n";
     query_stream << "   Component.Name AS ComponentName, Component.GraphmlID AS ComponentGraphmlID, Component.ExperimentRunID AS RunID,\n";
@@ -297,47 +626,43 @@ const pqxx::result DatabaseClient::GetPortLifecycleEventInfo(
     query_stream << "   INNER JOIN Container ON ComponentInstance.ContainerID = Container.ContainerID\n";
     query_stream << "   INNER JOIN Node ON Container.NodeID = Node.NodeID\n";
 
-
-
+    QueryParameters params;
     if (condition_columns.size() != 0) {
-        query_stream << BuildWhereLikeClause(condition_columns, condition_values) << " AND ";
+        query_stream << BuildWhereLikeClause(condition_columns, condition_values, params) << " AND ";
     } else {
         query_stream << "WHERE ";
     }
-    query_stream << "Node.ExperimentRunID = " << experiment_run_id << " AND ";
+    const auto& run_id = params.Add(experiment_run_id);
+    query_stream << "Node.ExperimentRunID = " << run_id << " AND ";
+    query_stream << BuildEventRunFilter("PortLifecycleEvent", run_id) << " AND ";
 
-    query_stream << "PortLifecycleEvent.SampleTime >= '" << /*connection_.quote(*/start_time/*)*/ << "'";
+    query_stream << "PortLifecycleEvent.SampleTime >= " << params.Add(start_time, "timestamp");
 
     if (end_time != AggServer::FormatTimestamp(0.0)) {
-        query_stream << "AND PortLifecycleEvent.SampleTime <= '" << /*connection_.quote(*/end_time/*)*/ << "'";
+        query_stream << " AND PortLifecycleEvent.SampleTime <= " << params.Add(end_time, "timestamp");
     }
     query_stream << " ORDER BY PortLifecycleEvent.SampleTime";
     query_stream << std::endl;
 
-    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
-
     try {
-        pqxx::work transaction(connection_, "GetPortLifecycleEventTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
-        transaction.commit();
-
-        return pg_result;
+        return ExecuteCursorQuery(query_stream.str(), params, "GetPortLifecycleEvent", chunk_callback);
     } catch (const std::exception& e)  {
         std::cerr << "An exception occurred while querying PortLifecycleEvents: " << e.what() << std::endl;
         throw;
     }
 }
 
-const pqxx::result DatabaseClient::GetWorkloadEventInfo(
+std::size_t DatabaseClient::GetWorkloadEventInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback
 ) {
     std::stringstream query_stream;
 
-    query_stream << "SELECT WorkloadEvent.Type, " << StringToPSQLTimestamp("SampleTime") << " AS SampleTime, WorkloadEvent.Function AS FunctionName, WorkloadEvent.Arguments AS Arguments,\n";
+    query_stream << "SELECT WorkloadEvent.Type, " << TimestampToEpochMicroseconds("SampleTime") << " AS SampleTime, WorkloadEvent.Function AS FunctionName, WorkloadEvent.Arguments AS Arguments,\n";
     query_stream << "   WorkerInstance.Name AS WorkerInstanceName, WorkerInstance.Path AS WorkerInstancePath, WorkerInstance.GraphmlID AS WorkerInstanceGraphmlID, \n";
     query_stream << "   Worker.Name AS WorkerName, Worker.GraphmlID AS WorkerGraphmlID, \n";
     query_stream << "   ComponentInstance.Name AS ComponentInstanceName, ComponentInstance.Path AS ComponentInstancePath, ComponentInstance.GraphmlID AS ComponentInstanceGraphmlID,\n";
@@ -351,29 +676,26 @@ const pqxx::result DatabaseClient::GetWorkloadEventInfo(
     query_stream << "   INNER JOIN Container ON ComponentInstance.ContainerID = Container.ContainerID\n";
     query_stream << "   INNER JOIN Node ON Container.NodeID = Node.NodeID\n";
 
+    QueryParameters params;
     if (condition_columns.size() != 0) {
-        query_stream << BuildWhereLikeClause(condition_columns, condition_values) << " AND ";
+        query_stream << BuildWhereLikeClause(condition_columns, condition_values, params) << " AND ";
     } else {
         query_stream << "WHERE ";
     }
-    query_stream << "Node.ExperimentRunID = " << experiment_run_id << " AND ";
+    const auto& run_id = params.Add(experiment_run_id);
+    query_stream << "Node.ExperimentRunID = " << run_id << " AND ";
+    query_stream << BuildEventRunFilter("WorkloadEvent", run_id) << " AND ";
 
-    query_stream << "WorkloadEvent.SampleTime >= '" << start_time << "'";
+    query_stream << "WorkloadEvent.SampleTime >= " << params.Add(start_time, "timestamp");
 
     if (end_time != AggServer::FormatTimestamp(0.0)) {
-        query_stream << "AND WorkloadEvent.SampleTime <= '" << /*connection_.quote(*/end_time/*)*/ << "'";
+        query_stream << " AND WorkloadEvent.SampleTime <= " << params.Add(end_time, "timestamp");
     }
     query_stream << " ORDER BY WorkloadEvent.SampleTime";
     query_stream << std::endl;
 
-    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
-
     try {
-        pqxx::work transaction(connection_, "GetWorkloadEventsTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
-        transaction.commit();
-
-        return pg_result;
+        return ExecuteCursorQuery(query_stream.str(), params, "GetWorkloadEvents", chunk_callback);
     } catch (const std::exception& e)  {
         std::cerr << "An exception occurred while querying Workload info: " << e.what() << std::endl;
         throw;
@@ -382,6 +704,7 @@ const pqxx::result DatabaseClient::GetWorkloadEventInfo(
 
 const pqxx::result DatabaseClient::GetMarkerInfo(
         int experiment_run_id,
+        int marker_type,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
@@ -389,7 +712,7 @@ const pqxx::result DatabaseClient::GetMarkerInfo(
 ) {
     std::stringstream query_stream;
 
-    query_stream << "SELECT WorkloadEvent.Type, " << StringToPSQLTimestamp("SampleTime") << " AS SampleTime, WorkloadEvent.Function AS FunctionName, WorkloadEvent.Arguments AS Label, WorkloadEvent.WorkloadID AS WorkloadID,\n";
+    query_stream << "SELECT WorkloadEvent.Type, " << TimestampToEpochMicroseconds("SampleTime") << " AS SampleTime, WorkloadEvent.Function AS FunctionName, WorkloadEvent.Arguments AS Label, WorkloadEvent.WorkloadID AS WorkloadID,\n";
     query_stream << "   WorkerInstance.Name AS WorkerInstanceName, WorkerInstance.Path AS WorkerInstancePath, WorkerInstance.GraphmlID AS WorkerInstanceGraphmlID, \n";
     query_stream << "   Worker.Name AS WorkerName, Worker.GraphmlID AS WorkerGraphmlID, \n";
     query_stream << "   ComponentInstance.Name AS ComponentInstanceName, ComponentInstance.Path AS ComponentInstancePath, ComponentInstance.GraphmlID AS ComponentInstanceGraphmlID,\n";
@@ -402,20 +725,24 @@ const pqxx::result DatabaseClient::GetMarkerInfo(
     query_stream << "   INNER JOIN Component ON ComponentInstance.ComponentID = Component.ComponentID\n";
     query_stream << "   INNER JOIN Container ON ComponentInstance.ContainerID = Container.ContainerID\n";
     query_stream << "   INNER JOIN Node ON Container.NodeID = Node.NodeID\n";
-    query_stream << "WHERE WorkloadEvent.Type = 'MARKER' AND ";
+    query_stream << "WHERE WorkloadEvent.Type = " << marker_type << " AND ";
 
+    QueryParameters params;
     if (condition_columns.size() != 0) {
-        query_stream << BuildWhereLikeClause(condition_columns, condition_values) << " AND ";
+        // Strip the clause's own WHERE, this query already has one
+        query_stream << BuildWhereLikeClause(condition_columns, condition_values, params).substr(6) << " AND ";
     } 
 
-    query_stream << "Node.ExperimentRunID = " << experiment_run_id;
+    const auto& run_id = params.Add(experiment_run_id);
+    query_stream << "Node.ExperimentRunID = " << run_id;
+    query_stream << " AND " << BuildEventRunFilter("WorkloadEvent", run_id);
 
     if (!start_time.empty()) {
-        query_stream << " AND WorkloadEvent.SampleTime >= '" << start_time << "'";
+        query_stream << " AND WorkloadEvent.SampleTime >= " << params.Add(start_time, "timestamp");
     }
 
     if (!end_time.empty()) {
-        query_stream << " AND WorkloadEvent.SampleTime <= '" << end_time << "'";
+        query_stream << " AND WorkloadEvent.SampleTime <= " << params.Add(end_time, "timestamp");
     }
     query_stream << " ORDER BY Label, WorkloadEvent.WorkloadID, WorkloadEvent.SampleTime";
     query_stream << std::endl;
@@ -424,7 +751,8 @@ const pqxx::result DatabaseClient::GetMarkerInfo(
 
     try {
         pqxx::work transaction(connection_, "GetMarkerTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
+        transaction_count_++;
+        const auto& pg_result = ExecutePreparedQuery(transaction, query_stream.str(), params);
         transaction.commit();
 
         return pg_result;
@@ -434,90 +762,148 @@ const pqxx::result DatabaseClient::GetMarkerInfo(
     }
 }
 
-const pqxx::result DatabaseClient::GetCPUUtilInfo(
+std::size_t DatabaseClient::GetCPUUtilInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback,
+        int resolution_seconds
 ) {
-    std::stringstream query_stream;
-
-    query_stream << "SELECT Hardware.SystemStatus.CPUUtilisation AS CPUUtilisation, " << StringToPSQLTimestamp("SampleTime") << " AS SampleTime,\n";
-    query_stream << "   Node.Hostname AS NodeHostname, Node.IP AS NodeIP, Node.GraphmlID AS NodeGraphmlID, Node.ExperimentRunID AS RunID\n";
-    query_stream << "FROM Hardware.SystemStatus INNER JOIN Hardware.System ON Hardware.SystemStatus.SystemID = Hardware.System.SystemID\n";
-    query_stream << "   INNER JOIN Node ON Hardware.System.NodeID = Node.NodeID\n";
+    QueryParameters params;
+    const auto& query = BuildSystemStatusQuery(
+        "CPUUtilisation", "CPUAvg", experiment_run_id, start_time, end_time, condition_columns, condition_values, resolution_seconds,
+        params
+    );
 
-    if (condition_columns.size() != 0) {
-        query_stream << BuildWhereLikeClause(condition_columns, condition_values) << " AND ";
-    } else {
-        query_stream << "WHERE ";
+    try {
+        return ExecuteCursorQuery(query, params, "GetCPUUtilisation", chunk_callback);
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while querying CPUUtilisation info: " << e.what() << std::endl;
+        throw;
     }
-    query_stream << "Node.ExperimentRunID = " << experiment_run_id << " AND ";
+}
 
-    query_stream << "Hardware.SystemStatus.SampleTime >= '" << start_time << "'";
+std::size_t DatabaseClient::GetMemUtilInfo(
+        int experiment_run_id,
+        std::string start_time,
+        std::string end_time,
+        const std::vector<std::string>& condition_columns,
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback,
+        int resolution_seconds
+) {
+    QueryParameters params;
+    const auto& query = BuildSystemStatusQuery(
+        "PhysMemUtilisation", "PhysMemAvg", experiment_run_id, start_time, end_time, condition_columns, condition_values, resolution_seconds,
+        params
+    );
 
-    if (end_time != AggServer::FormatTimestamp(0.0)) {
-        query_stream << "AND Hardware.SystemStatus.SampleTime <= '" << /*connection_.quote(*/end_time/*)*/ << "'";
+    try {
+        return ExecuteCursorQuery(query, params, "GetMemUtilisation", chunk_callback);
+    } catch (const std::exception& e)  {
+        std::cerr << "An exception occurred while querying MemUtilisation info: " << e.what() << std::endl;
+        throw;
     }
-    query_stream << " ORDER BY Node.HostName, Hardware.SystemStatus.SampleTime ASC";
-    query_stream << std::endl;
+}
 
+std::size_t DatabaseClient::ExecuteCursorQuery(
+    const std::string& query,
+    const QueryParameters& params,
+    const std::string& cursor_name,
+    const ResultChunkCallback& chunk_callback
+) {
     std::lock_guard<std::mutex> conn_guard(conn_mutex_);
 
-    try {
-        pqxx::work transaction(connection_, "GetCPUUtilisationTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
-        transaction.commit();
+    pqxx::work transaction(connection_, cursor_name + "Transaction");
+    transaction_count_++;
 
-        return pg_result;
-    } catch (const std::exception& e)  {
-        std::cerr << "An exception occurred while querying CPUUtilisation info: " << e.what() << std::endl;
-        throw;
+    // Rows stay on the server until fetched, so only one chunk is ever held by the client.
+    // pqxx's cursor classes can't bind parameters, so the cursor is declared and fetched from directly.
+    const std::string quoted_cursor = transaction.conn().quote_name(cursor_name);
+    transaction.exec_params(
+        "DECLARE " + quoted_cursor + " NO SCROLL CURSOR FOR " + query,
+        pqxx::prepare::make_dynamic_params(params.GetValues())
+    );
+    const std::string fetch = "FETCH FORWARD " + std::to_string(cursor_fetch_size) + " FROM " + quoted_cursor;
+
+    std::size_t row_count = 0;
+    while (true) {
+        const auto& chunk = transaction.exec(fetch);
+        if (chunk.empty()) {
+            break;
+        }
+        row_count += chunk.size();
+        chunk_callback(chunk);
+        if (chunk.size() < static_cast<std::size_t>(cursor_fetch_size)) {
+            break;
+        }
     }
+    transaction.commit();
+
+    return row_count;
 }
 
-const pqxx::result DatabaseClient::GetMemUtilInfo(
+pqxx::result DatabaseClient::ExecutePreparedQuery(
+    pqxx::transaction_base& transaction,
+    const std::string& query,
+    const QueryParameters& params
+) {
+    auto statement = prepared_statements_.find(query);
+    if (statement == prepared_statements_.end()) {
+        const std::string name = "aggserver_" + std::to_string(prepared_statements_.size());
+        connection_.prepare(name, query);
+        statement = prepared_statements_.emplace(query, name).first;
+    }
+    return transaction.exec_prepared(statement->second, pqxx::prepare::make_dynamic_params(params.GetValues()));
+}
+
+const std::string DatabaseClient::BuildSystemStatusQuery(
+        const std::string& value_column,
+        const std::string& rollup_value_column,
         int experiment_run_id,
-        std::string start_time,
-        std::string end_time,
+        const std::string& start_time,
+        const std::string& end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        int resolution_seconds,
+        QueryParameters& params
 ) {
+    // Rollup rows are read in place of the raw samples, one per interval, reporting the interval's average at its start
+    const bool use_rollup = resolution_seconds > 0;
+    const std::string status_table = use_rollup ? "Hardware.SystemStatusRollup" : "Hardware.SystemStatus";
+    const std::string time_column = status_table + (use_rollup ? ".IntervalStart" : ".SampleTime");
+    const std::string value = status_table + "." + (use_rollup ? rollup_value_column : value_column);
+
     std::stringstream query_stream;
 
-    query_stream << "SELECT Hardware.SystemStatus.PhysMemUtilisation AS PhysMemUtilisation, " << StringToPSQLTimestamp("SampleTime") << " AS SampleTime,\n";
+    query_stream << "SELECT " << value << " AS " << value_column << ", " << TimestampToEpochMicroseconds(time_column) << " AS SampleTime,\n";
     query_stream << "   Node.Hostname AS NodeHostname, Node.IP AS NodeIP, Node.GraphmlID AS NodeGraphmlID, Node.ExperimentRunID AS RunID\n";
-    query_stream << "FROM Hardware.SystemStatus INNER JOIN Hardware.System ON Hardware.SystemStatus.SystemID = Hardware.System.SystemID\n";
+    query_stream << "FROM " << status_table << " INNER JOIN Hardware.System ON " << status_table << ".SystemID = Hardware.System.SystemID\n";
     query_stream << "   INNER JOIN Node ON Hardware.System.NodeID = Node.NodeID\n";
 
     if (condition_columns.size() != 0) {
-        query_stream << BuildWhereLikeClause(condition_columns, condition_values) << " AND ";
+        query_stream << BuildWhereLikeClause(condition_columns, condition_values, params) << " AND ";
     } else {
         query_stream << "WHERE ";
     }
-    query_stream << "Node.ExperimentRunID = " << experiment_run_id << "   AND ";
-    
-    query_stream << "Hardware.SystemStatus.SampleTime >= '" << start_time << "'";
+    const auto& run_id = params.Add(experiment_run_id);
+    query_stream << "Node.ExperimentRunID = " << run_id << " AND ";
+    query_stream << BuildEventRunFilter(status_table, run_id) << " AND ";
+    if (use_rollup) {
+        query_stream << status_table << ".ResolutionSeconds = " << params.Add(resolution_seconds) << " AND ";
+    }
+
+    query_stream << time_column << " >= " << params.Add(start_time, "timestamp");
 
     if (end_time != AggServer::FormatTimestamp(0.0)) {
-        query_stream << "AND Hardware.SystemStatus.SampleTime <= '" << /*connection_.quote(*/end_time/*)*/ << "'";
+        query_stream << " AND " << time_column << " <= " << params.Add(end_time, "timestamp");
     }
-    query_stream << " ORDER BY Node.HostName, Hardware.SystemStatus.SampleTime ASC";
+    query_stream << " ORDER BY Node.HostName, " << time_column << " ASC";
     query_stream << std::endl;
 
-    std::lock_guard<std::mutex> conn_guard(conn_mutex_);
-
-    try {
-        pqxx::work transaction(connection_, "GetMemUtilisationTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
-        transaction.commit();
-
-        return pg_result;
-    } catch (const std::exception& e)  {
-        std::cerr << "An exception occurred while querying MemUtilisation info: " << e.what() << std::endl;
-        throw;
-    }
+    return query_stream.str();
 }
 
 void DatabaseClient::UpdateShutdownTime(
@@ -533,6 +919,7 @@ void DatabaseClient::UpdateShutdownTime(
 
     try {
         pqxx::work transaction(connection_, "UpdateShutdownTransaction");
+        transaction_count_++;
         const auto& pg_result = transaction.exec(query_stream.str());
         transaction.commit();
     } catch (const std::exception& e)  {
@@ -545,21 +932,15 @@ void DatabaseClient::UpdateLastSampleTime(
     int experiment_run_id,
     const std::string& sample_time
 ) {
-    std::stringstream query_stream;
-
-    std::string time_val = connection_.quote(sample_time);
-
-    query_stream
-        << "UPDATE ExperimentRun SET LastUpdated = " << time_val
-        << " WHERE (ExperimentRunID = " << experiment_run_id
-        << " AND (LastUpdated < " << time_val << "::timestamp OR LastUpdated IS NULL))";
-
+    QueryParameters params;
+    const auto& query = BuildUpdateLastSampleTime(experiment_run_id, params.Add(sample_time, "timestamp"));
 
     std::lock_guard<std::mutex> conn_guard(conn_mutex_);
 
     try {
         pqxx::work transaction(connection_, "UpdateLastSampleTransaction");
-        const auto& pg_result = transaction.exec(query_stream.str());
+        transaction_count_++;
+        const auto& pg_result = ExecutePreparedQuery(transaction, query, params);
         transaction.commit();
     } catch (const std::exception& e)  {
         std::cerr << "An exception occurred while updating experiment run's last sample time: " << e.what() << std::endl;
@@ -571,44 +952,97 @@ std::string DatabaseClient::EscapeString(const std::string& str) {
     return connection_.quote(str);
 }
 
-std::string DatabaseClient::StringToPSQLTimestamp(const std::string& str) {
-    return "to_char(("+str+"::timestamp), 'YYYY-MM-DD\"T\"HH24:MI:SS.US\"Z\"')";
+uint64_t DatabaseClient::GetTransactionCount() const {
+    return transaction_count_;
 }
 
-const std::string DatabaseClient::BuildWhereAllEqualClause(const std::vector<std::string>& cols, const std::vector<std::string>& vals) {
-    std::stringstream where_stream;
+std::string DatabaseClient::TimestampToEpochMicroseconds(const std::string& str) {
+    return "round(EXTRACT(EPOCH FROM ("+str+"::timestamp)) * 1000000)::bigint";
+}
 
-    where_stream << "WHERE (";
-    
-    auto col = cols.begin();
-    auto val = vals.begin();
-    while (col != cols.end() || val != vals.end()) {
-        where_stream << *col << " = '" << *val << "'";
-        col++;
-        val++;
-        if (col != cols.end()) {
-            where_stream << " AND ";
+std::string DatabaseClient::QueryParameters::Add(const std::string& value, const std::string& type) {
+    values_.push_back(value);
+    return Placeholder(type);
+}
+
+std::string DatabaseClient::QueryParameters::Add(int value) {
+    values_.push_back(std::to_string(value));
+    return Placeholder("int");
+}
+
+std::string DatabaseClient::QueryParameters::AddValue(const DatabaseValue& value) {
+    if (value.GetType() == DatabaseValue::Type::Null) {
+        return "NULL";
+    }
+    values_.push_back(ValueToText(value));
+    return Placeholder("");
+}
+
+std::string DatabaseClient::QueryParameters::AddArray(const std::vector<std::string>& values) {
+    std::string literal = "{";
+    for (const auto& value : values) {
+        if (literal.size() > 1) {
+            literal += ',';
         }
+        AppendArrayElement(literal, value);
     }
+    literal += '}';
+    return Add(literal, "text[]");
+}
 
-    where_stream << ")";
+std::string DatabaseClient::QueryParameters::AddArray(const std::vector<DatabaseValue>& values) {
+    std::string literal = "{";
+    for (const auto& value : values) {
+        if (literal.size() > 1) {
+            literal += ',';
+        }
+        if (value.GetType() == DatabaseValue::Type::Null) {
+            literal += "NULL";
+        } else {
+            AppendArrayElement(literal, ValueToText(value));
+        }
+    }
+    literal += '}';
+    return Add(literal, "text[]");
+}
 
-    return where_stream.str();
+void DatabaseClient::QueryParameters::AppendArrayElement(std::string& literal, const std::string& value) {
+    // Every element is double quoted so commas, braces and the word NULL are taken literally
+    literal += '"';
+    for (const auto& c : value) {
+        if (c == '"' || c == '\\') {
+            literal += '\\';
+        }
+        literal += c;
+    }
+    literal += '"';
+}
+
+std::string DatabaseClient::QueryParameters::Placeholder(const std::string& type) const {
+    std::string placeholder = "$" + std::to_string(values_.size());
+    if (!type.empty()) {
+        placeholder += "::" + type;
+    }
+    return placeholder;
 }
 
-const std::string DatabaseClient::BuildWhereAnyEqualClause(const std::vector<std::string>& cols, const std::vector<std::string>& vals) {
+const std::string DatabaseClient::BuildWhereAllEqualClause(
+    const std::vector<std::string>& cols,
+    const std::vector<std::string>& vals,
+    QueryParameters& params
+) {
     std::stringstream where_stream;
 
     where_stream << "WHERE (";
     
     auto col = cols.begin();
     auto val = vals.begin();
-    while (col != cols.end() || val != vals.end()) {
-        where_stream << *col << " = '" << *val << "'";
+    while (col != cols.end() && val != vals.end()) {
+        where_stream << *col << " = " << params.Add(*val, "");
         col++;
         val++;
         if (col != cols.end()) {
-            where_stream << " OR ";
+            where_stream << " AND ";
         }
     }
 
@@ -617,20 +1051,53 @@ const std::string DatabaseClient::BuildWhereAnyEqualClause(const std::vector<std
     return where_stream.str();
 }
 
-const std::string DatabaseClient::BuildWhereLikeClause(const std::vector<std::string>& cols, const std::vector<std::string>& vals) {
-    std::stringstream where_stream;
+const std::string DatabaseClient::BuildWhereAnyEqualClause(
+    const std::vector<std::string>& cols,
+    const std::vector<std::string>& vals,
+    QueryParameters& params
+) {
+    return BuildWhereAnyClause(cols, vals, "=", params);
+}
 
-    where_stream << "WHERE (";
-    
+const std::string DatabaseClient::BuildWhereLikeClause(
+    const std::vector<std::string>& cols,
+    const std::vector<std::string>& vals,
+    QueryParameters& params
+) {
+    return BuildWhereAnyClause(cols, vals, "LIKE", params);
+}
+
+const std::string DatabaseClient::BuildWhereAnyClause(
+    const std::vector<std::string>& cols,
+    const std::vector<std::string>& vals,
+    const std::string& comparison,
+    QueryParameters& params
+) {
+    // Group the values by column, keeping the order columns first appear in so equal filters give equal text
+    std::vector<std::string> grouped_cols;
+    std::unordered_map<std::string, std::vector<std::string> > grouped_vals;
     auto col = cols.begin();
     auto val = vals.begin();
-    while (col != cols.end() || val != vals.end()) {
-        where_stream << *col << " LIKE '" << *val << "'";
+    while (col != cols.end() && val != vals.end()) {
+        auto& col_vals = grouped_vals[*col];
+        if (col_vals.empty()) {
+            grouped_cols.push_back(*col);
+        }
+        col_vals.push_back(*val);
         col++;
         val++;
-        if (col != cols.end()) {
+    }
+
+    std::stringstream where_stream;
+
+    where_stream << "WHERE (";
+
+    for (unsigned int i = 0; i < grouped_cols.size(); i++) {
+        if (i != 0) {
             where_stream << " OR ";
         }
+        const auto& col_name = grouped_cols.at(i);
+        where_stream << col_name << " " << comparison << " ANY(" << params.AddArray(grouped_vals.at(col_name)) << ")";
     }
 
     where_stream << ")";
@@ -638,6 +1105,15 @@ const std::string DatabaseClient::BuildWhereLikeClause(const std::vector<std::st
     return where_stream.str();
 }
 
+const std::string DatabaseClient::BuildEventRunFilter(const std::string& table_name, const std::string& run_id_placeholder) {
+    // Rows written before the event tables carried an ExperimentRunID have it NULL, the Node join still scopes those to the run.
+    // Postgres can prune a partitioned table on this form, leaving only the run's own partitions in the plan.
+    std::stringstream filter_stream;
+    filter_stream << "(" << table_name << ".ExperimentRunID = " << run_id_placeholder
+        << " OR " << table_name << ".ExperimentRunID IS NULL)";
+    return filter_stream.str();
+}
+
 const std::string DatabaseClient::BuildColTuple(const std::vector<std::string>& cols) {
     std::stringstream tuple_stream;
 
@@ -662,6 +1138,358 @@ const std::string DatabaseClient::BuildColTuple(const std::vector<std::string>&
     return tuple_stream.str();
 }
 
+const std::string DatabaseClient::BuildMultiRowInsert(const TableRows& table, QueryParameters* params) {
+    std::stringstream insert_stream;
+
+    insert_stream << "INSERT INTO " << table.table_name << " " << BuildColTuple(table.columns) << std::endl;
+    insert_stream << " VALUES ";
+    for (unsigned int i=0; i < table.rows.size(); i++) {
+        const auto& row = table.rows.at(i);
+        if (row.size() != table.columns.size()) {
+            throw std::invalid_argument("Row has " + std::to_string(row.size()) + " values but " + table.table_name
+                + " insert expects " + std::to_string(table.columns.size()));
+        }
+        if (i != 0) {
+            insert_stream << ',' << std::endl;
+        }
+        insert_stream << '(';
+        for (unsigned int j=0; j < row.size(); j++) {
+            if (j != 0) {
+                insert_stream << ',';
+            }
+            insert_stream << (params ? params->AddValue(row.at(j)) : FormatValue(row.at(j)));
+        }
+        insert_stream << ')';
+    }
+    if (!table.on_conflict.empty()) {
+        insert_stream << std::endl << " ON CONFLICT " << table.on_conflict;
+    }
+
+    return insert_stream.str();
+}
+
+/*
+    The rows are bound as one text[] parameter per column and unnested back into rows, json_populate_record then converts
+    each row into the table's own column types so the upsert and the unique column join compare like with like.
+    The INSERT's snapshot can't see the rows it inserts, so IDs come from the RETURNING clause for new rows and from
+    the table itself for rows that already existed.
+
+    WITH input AS (
+        SELECT typed.*, raw.InputOrdinal
+        FROM unnest($1::text[], $2::text[]) WITH ORDINALITY AS raw(Name, ExperimentRunID, InputOrdinal),
+        LATERAL json_populate_record(NULL::Worker, to_json(raw)) AS typed
+    ), inserted AS (
+        INSERT INTO Worker (Name, ExperimentRunID) SELECT Name, ExperimentRunID FROM input ORDER BY InputOrdinal
+        ON CONFLICT (Name, ExperimentRunID) DO NOTHING
+        RETURNING WorkerID, Name, ExperimentRunID
+    )
+    SELECT input.InputOrdinal, inserted.WorkerID FROM input JOIN inserted USING (Name, ExperimentRunID)
+    UNION ALL
+    SELECT input.InputOrdinal, existing.WorkerID FROM input JOIN Worker AS existing USING (Name, ExperimentRunID)
+*/
+const std::string DatabaseClient::BuildMultiRowUpsert(
+    const TableRows& table,
+    const std::vector<std::string>& unique_cols,
+    QueryParameters& params
+) {
+    const std::string id_column = strip_schema(table.table_name) + "ID";
+    const std::string unique_tuple = BuildColTuple(unique_cols);
+
+    std::vector<std::string> ordinal_columns(table.columns);
+    ordinal_columns.push_back("InputOrdinal");
+
+    std::stringstream upsert_stream;
+
+    upsert_stream << "WITH input AS (" << std::endl;
+    upsert_stream << " SELECT typed.*, raw.InputOrdinal" << std::endl;
+    upsert_stream << " FROM unnest(";
+    for (unsigned int j=0; j < table.columns.size(); j++) {
+        if (j != 0) {
+            upsert_stream << ',' << std::endl << "  ";
+        }
+        std::vector<DatabaseValue> column_values;
+        column_values.reserve(table.rows.size());
+        for (const auto& row : table.rows) {
+            if (row.size() != table.columns.size()) {
+                throw std::invalid_argument("Row has " + std::to_string(row.size()) + " values but " + table.table_name
+                    + " insert expects " + std::to_string(table.columns.size()));
+            }
+            column_values.push_back(row.at(j));
+        }
+        upsert_stream << params.AddArray(column_values);
+    }
+    upsert_stream << ") WITH ORDINALITY AS raw" << BuildColTuple(ordinal_columns) << ',' << std::endl;
+    upsert_stream << " LATERAL json_populate_record(NULL::" << table.table_name << ", to_json(raw)) AS typed" << std::endl;
+    upsert_stream << "), inserted AS (" << std::endl;
+    upsert_stream << " INSERT INTO " << table.table_name << " " << BuildColTuple(table.columns) << std::endl;
+    upsert_stream << " SELECT ";
+    for (unsigned int j=0; j < table.columns.size(); j++) {
+        if (j != 0) {
+            upsert_stream << ", ";
+        }
+        upsert_stream << table.columns.at(j);
+    }
+    upsert_stream << " FROM input ORDER BY InputOrdinal" << std::endl;
+    upsert_stream << " ON CONFLICT " << unique_tuple << " DO NOTHING" << std::endl;
+    upsert_stream << " RETURNING " << id_column;
+    for (const auto& unique_col : unique_cols) {
+        upsert_stream << ", " << unique_col;
+    }
+    upsert_stream << std::endl << ")" << std::endl;
+    upsert_stream << "SELECT input.InputOrdinal, inserted." << id_column << " FROM input JOIN inserted USING " << unique_tuple << std::endl;
+    upsert_stream << "UNION ALL" << std::endl;
+    upsert_stream << "SELECT input.InputOrdinal, existing." << id_column << " FROM input JOIN " << table.table_name
+        << " AS existing USING " << unique_tuple;
+
+    return upsert_stream.str();
+}
+
+const std::string DatabaseClient::BuildUpdateLastSampleTime(int experiment_run_id, const std::string& sample_time) {
+    std::stringstream update_stream;
+
+    update_stream
+        << "UPDATE ExperimentRun SET LastUpdated = " << sample_time
+        << " WHERE (ExperimentRunID = " << experiment_run_id
+        << " AND (LastUpdated < " << sample_time << "::timestamp OR LastUpdated IS NULL))";
+
+    return update_stream.str();
+}
+
+const std::string DatabaseClient::FormatValue(const DatabaseValue& value) {
+    switch (value.GetType()) {
+        case DatabaseValue::Type::Null:
+            return "NULL";
+        case DatabaseValue::Type::Integer:
+            return ValueToText(value);
+        case DatabaseValue::Type::Double: {
+            // Postgres only accepts non-finite floats as quoted literals
+            if (!std::isfinite(value.GetDouble())) {
+                return connection_.quote(ValueToText(value));
+            }
+            return ValueToText(value);
+        }
+        case DatabaseValue::Type::Timestamp:
+        case DatabaseValue::Type::Text:
+            return connection_.quote(ValueToText(value));
+    }
+    throw std::invalid_argument("Unhandled DatabaseValue type");
+}
+
+std::string DatabaseClient::ValueToText(const DatabaseValue& value) {
+    switch (value.GetType()) {
+        case DatabaseValue::Type::Null:
+            break;
+        case DatabaseValue::Type::Integer:
+            return std::to_string(value.GetInteger());
+        case DatabaseValue::Type::Double: {
+            const double number = value.GetDouble();
+            if (std::isnan(number)) {
+                return "NaN";
+            }
+            if (std::isinf(number)) {
+                return number > 0 ? "Infinity" : "-Infinity";
+            }
+            std::ostringstream number_stream;
+            number_stream.imbue(std::locale::classic());
+            number_stream.precision(std::numeric_limits<double>::max_digits10);
+            number_stream << number;
+            return number_stream.str();
+        }
+        case DatabaseValue::Type::Timestamp:
+            return google::protobuf::util::TimeUtil::ToString(value.GetTimestamp());
+        case DatabaseValue::Type::Text:
+            return value.GetText();
+    }
+    throw std::invalid_argument("DatabaseValue has no text form");
+}
+
+void DatabaseClient::EnablePipelining(std::size_t max_in_flight) {
+    std::lock_guard<std::mutex> pipeline_lock(pipeline_mutex_);
+    if (!pipeline_connection_) {
+        // Kept off connection_ so ID lookups and upserts can still run while pipelined statements are outstanding
+        pipeline_connection_ = std::unique_ptr<pqxx::connection>(new pqxx::connection(connection_details_));
+    }
+    pipeline_depth_ = max_in_flight;
+}
+
+bool DatabaseClient::IsPipelining() {
+    std::lock_guard<std::mutex> pipeline_lock(pipeline_mutex_);
+    return pipeline_depth_ > 0;
+}
+
+int DatabaseClient::FlushPipeline() {
+    ResolvedWrites resolved;
+    int failed_count = 0;
+    {
+        std::lock_guard<std::mutex> pipeline_lock(pipeline_mutex_);
+        failed_count = FlushPipelineLocked(&resolved);
+    }
+    RunWriteCallbacks(resolved);
+    return failed_count;
+}
+
+void DatabaseClient::EnqueuePipelinedWrite(
+    const std::vector<TableRows>& tables,
+    int experiment_run_id,
+    const DatabaseValue& last_sample_time,
+    const WriteCallback& on_written
+) {
+    auto write = std::make_shared<PipelinedWrite>();
+    write->on_written = on_written;
+
+    ResolvedWrites resolved;
+    {
+        std::lock_guard<std::mutex> pipeline_lock(pipeline_mutex_);
+
+        if (!pipeline_) {
+            pipeline_transaction_ = std::unique_ptr<pqxx::work>(new pqxx::work(*pipeline_connection_, "PipelinedTransaction"));
+            transaction_count_++;
+            pipeline_ = std::unique_ptr<pqxx::pipeline>(new pqxx::pipeline(*pipeline_transaction_, "InsertPipeline"));
+        }
+
+        try {
+            // One statement per insert, so each retrieve lines up with a single result
+            for (const auto& table : tables) {
+                if (table.rows.empty()) {
+                    continue;
+                }
+                const auto& query = BuildMultiRowInsert(table);
+                const std::string label = std::to_string(table.rows.size()) + " rows into " + table.table_name +
+                    ", ExperimentRunID " + std::to_string(experiment_run_id);
+                pipelined_statements_.push_back({pipeline_->insert(query), query, label, write});
+                write->pending_count++;
+            }
+        } catch (const std::exception& e) {
+            // The caller sees the exception, so whatever did make it into the pipeline must not report back later
+            write->on_written = WriteCallback();
+            throw;
+        }
+
+        if (last_sample_time.GetType() != DatabaseValue::Type::Null) {
+            auto& latest = pipelined_last_sample_times_[experiment_run_id];
+            if (latest.GetType() != DatabaseValue::Type::Timestamp || last_sample_time.GetType() != DatabaseValue::Type::Timestamp ||
+                latest.GetTimestamp() < last_sample_time.GetTimestamp()) {
+                latest = last_sample_time;
+            }
+        }
+
+        if (pipelined_statements_.size() >= pipeline_depth_) {
+            // Failures are already logged against their own statement and reported to their own write
+            FlushPipelineLocked(&resolved);
+        }
+    }
+
+    if (write->pending_count == 0 && on_written) {
+        // Nothing to wait on, only LastUpdated which is advanced at the next flush
+        resolved.emplace_back(on_written, true);
+    }
+    RunWriteCallbacks(resolved);
+}
+
+int DatabaseClient::FlushPipelineLocked(ResolvedWrites* resolved) {
+    if (!pipeline_) {
+        return 0;
+    }
+
+    // LastUpdated only moves forward, so one update per run covers every write in the batch
+    try {
+        for (auto it = pipelined_last_sample_times_.begin(); it != pipelined_last_sample_times_.end();) {
+            const auto& query = BuildUpdateLastSampleTime(it->first, FormatValue(it->second));
+            const std::string label = "LastUpdated of ExperimentRunID " + std::to_string(it->first);
+            pipelined_statements_.push_back({pipeline_->insert(query), query, label, nullptr});
+            it = pipelined_last_sample_times_.erase(it);
+        }
+    } catch (const std::exception& e) {
+        // Anything not queued is kept for the next flush
+        std::cerr << "An exception occurred while queueing LastUpdated updates: " << e.what() << std::endl;
+    }
+
+    std::size_t failed_index = pipelined_statements_.size();
+    try {
+        pipeline_->complete();
+    } catch (const std::exception& e) {
+        // Failures are attributed through retrieve below
+    }
+    for (std::size_t i = 0; i < pipelined_statements_.size(); i++) {
+        try {
+            pipeline_->retrieve(pipelined_statements_.at(i).id);
+        } catch (const std::exception& e) {
+            std::cerr << "Pipelined statement failed (" << pipelined_statements_.at(i).label << "): " << e.what() << std::endl;
+            failed_index = i;
+            break;
+        }
+    }
+
+    std::vector<bool> committed(pipelined_statements_.size(), false);
+    int failed_count = 0;
+    if (failed_index == pipelined_statements_.size()) {
+        try {
+            pipeline_.reset();
+            pipeline_transaction_->commit();
+            committed.assign(committed.size(), true);
+        } catch (const std::exception& e) {
+            std::cerr << "An exception occurred while committing " << pipelined_statements_.size() << " pipelined statements: " << e.what() << std::endl;
+            failed_count = pipelined_statements_.size();
+        }
+    } else {
+        // Postgres aborts the whole transaction on the first error, so everything else in the batch has to be sent again
+        pipeline_.reset();
+        pipeline_transaction_->abort();
+        pipeline_transaction_.reset();
+        failed_count = 1 + ReplayPipelinedStatements(failed_index, committed);
+    }
+
+    for (std::size_t i = 0; i < pipelined_statements_.size(); i++) {
+        const auto& write = pipelined_statements_.at(i).write;
+        if (!write) {
+            continue;
+        }
+        if (!committed.at(i)) {
+            write->failed = true;
+        }
+        if (--write->pending_count == 0 && write->on_written && resolved) {
+            resolved->emplace_back(write->on_written, !write->failed);
+        }
+    }
+
+    pipeline_.reset();
+    pipeline_transaction_.reset();
+    pipelined_statements_.clear();
+    return failed_count;
+}
+
+int DatabaseClient::ReplayPipelinedStatements(std::size_t failed_index, std::vector<bool>& committed) {
+    int failed_count = 0;
+    for (std::size_t i = 0; i < pipelined_statements_.size(); i++) {
+        if (i == failed_index) {
+            continue;
+        }
+        const auto& statement = pipelined_statements_.at(i);
+        try {
+            pqxx::work transaction(*pipeline_connection_, "ReplayPipelinedTransaction");
+            transaction_count_++;
+            transaction.exec(statement.query);
+            transaction.commit();
+            committed.at(i) = true;
+        } catch (const std::exception& e) {
+            std::cerr << "Pipelined statement failed on replay (" << statement.label << "): " << e.what() << std::endl;
+            failed_count++;
+        }
+    }
+    return failed_count;
+}
+
+void DatabaseClient::RunWriteCallbacks(const ResolvedWrites& resolved) {
+    for (const auto& write : resolved) {
+        try {
+            write.first(write.second);
+        } catch (const std::exception& e) {
+            // One callback failing shouldn't cost the writes after it their result
+            std::cerr << "An exception occurred while reporting a pipelined write: " << e.what() << std::endl;
+        }
+    }
+}
+
 pqxx::work& DatabaseClient::AquireBatchedTransaction() {
     std::lock_guard<std::mutex> trans_guard(batched_transaction_mutex_);
     static unsigned int total_batched_transactions_ = 0;
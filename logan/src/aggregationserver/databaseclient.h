@@ -1,7 +1,13 @@
 #ifndef LOGAN_DATABASECLIENT_H
 #define LOGAN_DATABASECLIENT_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <mutex>
 
@@ -9,15 +15,62 @@
 
 #include <iostream>
 
-// Hack for backwards compatibility with pqxx 4.0 and earlier where row was named tuple
-#ifndef PQXX_H_ROW
-namespace pqxx{
-    using row = tuple;
-}
+#include "databasevalue.h"
+
+// Parameters are bound through exec_params/exec_prepared with prepare::make_dynamic_params, added in pqxx 6.3
+#if PQXX_VERSION_MAJOR < 6 || (PQXX_VERSION_MAJOR == 6 && PQXX_VERSION_MINOR < 3)
+#error "DatabaseClient requires libpqxx 6.3 or newer"
 #endif
 
 class DatabaseClient {
 public:
+    // Rows destined for a single table, written by one multi-row INSERT
+    struct TableRows {
+        std::string table_name;
+        std::vector<std::string> columns;
+        std::vector<DatabaseRow> rows;
+        // Optional ON CONFLICT target and action, ie. "(ID) DO NOTHING", turning the insert into an upsert
+        std::string on_conflict;
+    };
+
+    // Values for a query's $n placeholders, in order. Each Add returns the placeholder (with a cast, so the query text
+    // carries the type) to write into the query, keeping literals out of the query text so every request with the
+    // same filter shape sends the same SQL.
+    class QueryParameters {
+    public:
+        std::string Add(const std::string& value, const std::string& type = "text");
+        std::string Add(int value);
+        // Untyped, so Postgres takes the type from where the placeholder is used (ie. the column being inserted into).
+        // NULL is written straight into the query rather than bound.
+        std::string AddValue(const DatabaseValue& value);
+        // A single text[] parameter, written as an array literal
+        std::string AddArray(const std::vector<std::string>& values);
+        std::string AddArray(const std::vector<DatabaseValue>& values);
+        const std::vector<std::string>& GetValues() const { return values_; };
+
+    private:
+        std::string Placeholder(const std::string& type) const;
+        static void AppendArrayElement(std::string& literal, const std::string& value);
+        std::vector<std::string> values_;
+    };
+
+    // A SELECT for GetValuesSnapshot, condition may reference placeholders added to params
+    struct SelectQuery {
+        std::string table_name;
+        std::vector<std::string> columns;
+        std::string condition;
+        QueryParameters params;
+    };
+
+    // Receives each chunk of a cursor query's rows in order. It is called with the connection held so must not use the
+    // DatabaseClient itself
+    typedef std::function<void(const pqxx::result&)> ResultChunkCallback;
+
+    // Told whether every statement of an InsertMultipleValues/InsertRow write was committed. A direct write calls it
+    // before returning (a failure throws instead), a pipelined write calls it from whichever later call flushes the
+    // pipeline, once the pipeline lock has been released so it is free to write again.
+    typedef std::function<void(bool committed)> WriteCallback;
+
     DatabaseClient(const std::string& connection_details);
     ~DatabaseClient();
     void Connect(const std::string& connection_string){};
@@ -41,12 +94,62 @@ public:
         const std::vector<std::string>& unique_col
     );
 
+    // Set based InsertValuesUnique, every row is upserted by a single statement and the IDs come back in row order.
+    // Rows that already exist (or repeat an earlier row's unique columns) return the existing ID.
+    std::vector<int> InsertMultipleValuesUnique(
+        const TableRows& table,
+        const std::vector<std::string>& unique_cols
+    );
+
+    // Writes every table's rows with one INSERT per table and advances the run's LastUpdated once,
+    // all inside a single statement with the values bound as parameters. Row IDs are not returned.
+    void InsertMultipleValues(
+        const std::vector<TableRows>& tables,
+        int experiment_run_id,
+        const DatabaseValue& last_sample_time,
+        const WriteCallback& on_written = WriteCallback()
+    );
+
+    // Optional asynchronous write path for InsertMultipleValues/InsertRow.
+    // Each table's INSERT is queued as its own statement on a dedicated connection through a pqxx::pipeline, so up to
+    // max_in_flight statements share one transaction without waiting on a round trip each. LastUpdated is advanced
+    // once per run when the batch is flushed. Nothing is committed until FlushPipeline is called or the pipeline fills up.
+    void EnablePipelining(std::size_t max_in_flight);
+    bool IsPipelining();
+
+    // Waits for every in flight statement and commits them, returns the number of statements that failed.
+    // A failure is reported against the statement that caused it, the rest of the batch is replayed and kept.
+    // Each write's WriteCallback is then told whether all of its statements made it.
+    int FlushPipeline();
+
+    // Single row convenience wrapper around InsertMultipleValues
+    void InsertRow(
+        const std::string& table_name,
+        const std::vector<std::string>& columns,
+        const DatabaseRow& values,
+        int experiment_run_id,
+        const DatabaseValue& last_sample_time,
+        const WriteCallback& on_written = WriteCallback()
+    );
+
     const pqxx::result GetValues(
         const std::string table_name,
         const std::vector<std::string>& columns,
         const std::string& query=""
     );
 
+    // As above with query's placeholders bound from params
+    const pqxx::result GetValues(
+        const std::string& table_name,
+        const std::vector<std::string>& columns,
+        const std::string& query,
+        const QueryParameters& params
+    );
+
+    // Runs the queries in order in one read only REPEATABLE READ transaction so every result comes from the same
+    // snapshot, returning a result per query
+    std::vector<pqxx::result> GetValuesSnapshot(const std::vector<SelectQuery>& queries);
+
     const pqxx::result GetValuesLike(
         const std::string table_name,
         const std::vector<std::string>& columns,
@@ -58,46 +161,80 @@ public:
         const std::string& query
     );
 
+    // As above with query's placeholders bound from params
+    int GetID(
+        const std::string& table_name,
+        const std::string& query,
+        const QueryParameters& params
+    );
+
+    // ID of a row whose columns equal values, with the values bound as parameters. Returns -1 if there is none.
+    int FindID(
+        const std::string& table_name,
+        const std::string& id_column,
+        const std::vector<std::string>& columns,
+        const std::vector<std::string>& values
+    );
+
+    // Runs raw SQL (may contain several statements) in a single transaction, used for schema management
+    const pqxx::result ExecuteQuery(const std::string& query);
+
     std::string EscapeString(const std::string& str);
 
-    const pqxx::result GetPortLifecycleEventInfo(
+    // Every experiment whose name starts with name_prefix joined with its runs, ordered by name then JobNum.
+    // Experiments without runs appear once with a NULL ExperimentRunID.
+    const pqxx::result GetExperimentRunInfo(const std::string& name_prefix = "");
+
+    // The event and utilisation queries below read through a server side cursor, handing cursor_fetch_size rows at a
+    // time to chunk_callback rather than materialising the whole run. They return the number of rows read.
+    std::size_t GetPortLifecycleEventInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback
     );
 
-    const pqxx::result GetWorkloadEventInfo(
+    std::size_t GetWorkloadEventInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback
     );
 
+    // marker_type is the WorkloadEvent.Type number of a marker, written as a literal so IX_WorkloadEvent_Marker's
+    // predicate matches
     const pqxx::result GetMarkerInfo(
         int experiment_run_id,
+        int marker_type,
         std::string start_time = "",
         std::string end_time = "",
         const std::vector<std::string>& condition_columns = {},
         const std::vector<std::string>& condition_values = {}
     );
 
-    const pqxx::result GetCPUUtilInfo(
+    // A resolution_seconds of 0 reads every raw sample, otherwise the Hardware.SystemStatusRollup average at that resolution
+    std::size_t GetCPUUtilInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback,
+        int resolution_seconds = 0
     );
 
-    const pqxx::result GetMemUtilInfo(
+    std::size_t GetMemUtilInfo(
         int experiment_run_id,
         std::string start_time,
         std::string end_time,
         const std::vector<std::string>& condition_columns,
-        const std::vector<std::string>& condition_values
+        const std::vector<std::string>& condition_values,
+        const ResultChunkCallback& chunk_callback,
+        int resolution_seconds = 0
     );
 
     void UpdateShutdownTime(
@@ -110,22 +247,125 @@ public:
         const std::string& sample_time
     );
 
-    static std::string StringToPSQLTimestamp(const std::string& str);
+    // Selects a timestamp column as int8 microseconds since the epoch, read back with TimeUtil::MicrosecondsToTimestamp
+    // rather than formatting a string on the server and parsing it on the client for every row
+    static std::string TimestampToEpochMicroseconds(const std::string& str);
+
+    // Number of transactions opened by this client, a pipelined batch counts once.
+    // Each one costs a BEGIN, its statements and a COMMIT, so this tracks database round trips.
+    uint64_t GetTransactionCount() const;
+
+    static const long cursor_fetch_size = 10000;
+    // Postgres' limit on the parameters of one statement, larger inserts fall back to literals
+    static const std::size_t max_bound_parameters = 65535;
 
 private:
+    // The WHERE builders add their values to params. Values for the same column are folded into one
+    // "= ANY($n::text[])" (or "LIKE ANY") so the query text depends on which columns are filtered, not how many values.
     const std::string BuildWhereAllEqualClause(
         const std::vector<std::string>& cols,
-        const std::vector<std::string>& vals
+        const std::vector<std::string>& vals,
+        QueryParameters& params
     );
     const std::string BuildWhereAnyEqualClause(
         const std::vector<std::string>& cols,
-        const std::vector<std::string>& vals
+        const std::vector<std::string>& vals,
+        QueryParameters& params
     );
     const std::string BuildWhereLikeClause(
         const std::vector<std::string>& cols,
-        const std::vector<std::string>& vals
+        const std::vector<std::string>& vals,
+        QueryParameters& params
+    );
+    const std::string BuildWhereAnyClause(
+        const std::vector<std::string>& cols,
+        const std::vector<std::string>& vals,
+        const std::string& comparison,
+        QueryParameters& params
     );
     const std::string BuildColTuple(const std::vector<std::string>& cols);
+    // InsertMultipleValues with the values bound, or written as literals for batches with more values than can be bound
+    void InsertMultipleValueParameters(
+        const std::vector<TableRows>& tables,
+        int experiment_run_id,
+        const DatabaseValue& last_sample_time
+    );
+    void InsertMultipleValueLiterals(
+        const std::vector<TableRows>& tables,
+        int experiment_run_id,
+        const DatabaseValue& last_sample_time
+    );
+    const std::string BuildEventRunFilter(const std::string& table_name, const std::string& run_id_placeholder);
+    const std::string BuildSystemStatusQuery(
+        const std::string& value_column,
+        const std::string& rollup_value_column,
+        int experiment_run_id,
+        const std::string& start_time,
+        const std::string& end_time,
+        const std::vector<std::string>& condition_columns,
+        const std::vector<std::string>& condition_values,
+        int resolution_seconds,
+        QueryParameters& params
+    );
+    // The cursor is declared with the parameters bound, Postgres plans a DECLARE each time so it isn't prepared
+    std::size_t ExecuteCursorQuery(
+        const std::string& query,
+        const QueryParameters& params,
+        const std::string& cursor_name,
+        const ResultChunkCallback& chunk_callback
+    );
+    // Prepares each distinct query text once on connection_ so later executions can reuse its plan,
+    // call with conn_mutex_ held
+    pqxx::result ExecutePreparedQuery(
+        pqxx::transaction_base& transaction,
+        const std::string& query,
+        const QueryParameters& params
+    );
+    static std::string BuildSelectQuery(
+        const std::string& table_name,
+        const std::vector<std::string>& columns,
+        const std::string& condition
+    );
+    // Values are bound into params when given, otherwise written as literals (a pqxx::pipeline only takes query text)
+    const std::string BuildMultiRowInsert(const TableRows& table, QueryParameters* params = nullptr);
+    const std::string BuildMultiRowUpsert(
+        const TableRows& table,
+        const std::vector<std::string>& unique_cols,
+        QueryParameters& params
+    );
+    // sample_time is either a quoted literal or a placeholder
+    const std::string BuildUpdateLastSampleTime(int experiment_run_id, const std::string& sample_time);
+    // Renders a value as a literal for query text
+    const std::string FormatValue(const DatabaseValue& value);
+    // A value's text form, as bound to a parameter or unquoted in a literal. Not defined for NULL
+    static std::string ValueToText(const DatabaseValue& value);
+
+    // One InsertMultipleValues call, resolved once all of its statements have been committed or have failed
+    struct PipelinedWrite {
+        WriteCallback on_written;
+        std::size_t pending_count = 0;
+        bool failed = false;
+    };
+    struct PipelinedStatement {
+        pqxx::pipeline::query_id id;
+        std::string query;
+        std::string label;
+        // Not set for the LastUpdated updates added at flush
+        std::shared_ptr<PipelinedWrite> write;
+    };
+    // Callbacks of the writes resolved by a flush, run once the pipeline lock is released
+    typedef std::vector<std::pair<WriteCallback, bool> > ResolvedWrites;
+    void EnqueuePipelinedWrite(
+        const std::vector<TableRows>& tables,
+        int experiment_run_id,
+        const DatabaseValue& last_sample_time,
+        const WriteCallback& on_written
+    );
+    // Aquire pipeline lock before flushing, resolved may be null to drop the writes' callbacks
+    int FlushPipelineLocked(ResolvedWrites* resolved);
+    // Sends every statement but the failed one again in its own transaction, marking those that commit
+    int ReplayPipelinedStatements(std::size_t failed_index, std::vector<bool>& committed);
+    static void RunWriteCallbacks(const ResolvedWrites& resolved);
 
     pqxx::work& AquireBatchedTransaction();
     void ReleaseBatchedTransaction();
@@ -140,8 +380,22 @@ private:
     std::unique_ptr<pqxx::work> batched_transaction_;
     unsigned int batched_write_count_; 
 
+    const std::string connection_details_;
+    std::size_t pipeline_depth_ = 0;
+    std::unique_ptr<pqxx::connection> pipeline_connection_;
+    std::unique_ptr<pqxx::work> pipeline_transaction_;
+    std::unique_ptr<pqxx::pipeline> pipeline_;
+    std::vector<PipelinedStatement> pipelined_statements_;
+    // Latest sample time of each run with statements in the pipeline, written to LastUpdated at flush
+    std::map<int, DatabaseValue> pipelined_last_sample_times_;
+
     std::mutex conn_mutex_;
+    // Query text to prepared statement name. There is one entry per filter shape, so this stays small
+    std::unordered_map<std::string, std::string> prepared_statements_;
     std::mutex batched_transaction_mutex_;
+    std::mutex pipeline_mutex_;
+
+    std::atomic<uint64_t> transaction_count_{0};
 };
 
 #endif //LOGAN_DATABASECLIENT_H
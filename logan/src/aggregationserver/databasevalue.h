@@ -0,0 +1,63 @@
+#ifndef LOGAN_DATABASEVALUE_H
+#define LOGAN_DATABASEVALUE_H
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <google/protobuf/timestamp.pb.h>
+
+// A single column value that keeps its native type until DatabaseClient renders it into a statement.
+// Values are normally bound as text parameters, integers and doubles (with full round-trip precision) only become
+// unquoted numeric literals on the pipelined path and for inserts too large for the 65535 parameter limit.
+// Either way samples no longer pass through std::to_string on the way to the database.
+class DatabaseValue {
+public:
+    enum class Type {
+        Null,
+        Integer,
+        Double,
+        Timestamp,
+        Text
+    };
+
+    DatabaseValue() : type_(Type::Null) {};
+
+    template <class T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+    DatabaseValue(T value) : type_(Type::Integer), integer_(static_cast<int64_t>(value)) {};
+
+    template <class T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    DatabaseValue(T value) : type_(Type::Double), double_(static_cast<double>(value)) {};
+
+    DatabaseValue(const google::protobuf::Timestamp& timestamp) :
+        type_(Type::Timestamp), integer_(timestamp.seconds()), nanos_(timestamp.nanos()) {};
+
+    DatabaseValue(const std::string& text) : type_(Type::Text), text_(text) {};
+    DatabaseValue(std::string&& text) : type_(Type::Text), text_(std::move(text)) {};
+    DatabaseValue(const char* text) : type_(Type::Text), text_(text) {};
+
+    Type GetType() const { return type_; };
+
+    int64_t GetInteger() const { return integer_; };
+    double GetDouble() const { return double_; };
+    const std::string& GetText() const { return text_; };
+
+    google::protobuf::Timestamp GetTimestamp() const {
+        google::protobuf::Timestamp timestamp;
+        timestamp.set_seconds(integer_);
+        timestamp.set_nanos(nanos_);
+        return timestamp;
+    };
+
+private:
+    Type type_;
+    int64_t integer_ = 0; // Also holds a timestamp's seconds
+    int32_t nanos_ = 0;
+    double double_ = 0.0;
+    std::string text_;
+};
+
+typedef std::vector<DatabaseValue> DatabaseRow;
+
+#endif //LOGAN_DATABASEVALUE_H
@@ -0,0 +1,129 @@
+#ifndef DEFERREDQUEUE_H
+#define DEFERREDQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace AggServer {
+
+struct DeferredMetrics {
+    uint64_t parked_count = 0;
+    uint64_t released_count = 0;
+    // Items pushed out of a full key, turned away by a full queue or discarded unregistered
+    uint64_t dropped_count = 0;
+    std::size_t pending_count = 0;
+};
+
+// Parks samples that reference an ID which hasn't been registered yet (ie. a StatusEvent that beat its host's InfoEvent),
+// keyed by whatever will register that ID, until it is released by the code doing the registering.
+// Each key holds at most max_per_key items, the oldest is dropped to make room so a key that is never registered
+// can't grow without bound. At most max_keys keys are held, items for any further key are dropped.
+template <class Key, class Item, class Hash = std::hash<Key> >
+class DeferredQueue {
+public:
+    explicit DeferredQueue(std::size_t max_per_key = default_max_per_key, std::size_t max_keys = default_max_keys) :
+        max_per_key_(max_per_key), max_keys_(max_keys) {};
+
+    // Returns false if the key was full and its oldest item was dropped, or if there was no room for a new key
+    bool Park(const Key& key, Item item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.size() >= max_keys_ && !items_.count(key)) {
+            metrics_.dropped_count++;
+            return false;
+        }
+        auto& key_items = items_[key];
+        bool dropped = false;
+        if (key_items.size() >= max_per_key_) {
+            key_items.pop_front();
+            metrics_.dropped_count++;
+            metrics_.pending_count--;
+            dropped = true;
+        }
+        key_items.push_back(std::move(item));
+        metrics_.parked_count++;
+        metrics_.pending_count++;
+        return !dropped;
+    }
+
+    // Removes and returns the key's items in the order they were parked
+    std::vector<Item> Release(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Item> released;
+        auto key_it = items_.find(key);
+        if (key_it == items_.end()) {
+            return released;
+        }
+        released.reserve(key_it->second.size());
+        for (auto& item : key_it->second) {
+            released.push_back(std::move(item));
+        }
+        items_.erase(key_it);
+        metrics_.released_count += released.size();
+        metrics_.pending_count -= released.size();
+        return released;
+    }
+
+    // Puts released items that could not be written back in front of anything parked since
+    void Restore(const Key& key, std::vector<Item> items) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& key_items = items_[key];
+        for (auto item_it = items.rbegin(); item_it != items.rend(); ++item_it) {
+            key_items.push_front(std::move(*item_it));
+        }
+        metrics_.released_count -= items.size();
+        metrics_.pending_count += items.size();
+    }
+
+    // Discards the key's items, counting them as dropped
+    void Drop(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto key_it = items_.find(key);
+        if (key_it == items_.end()) {
+            return;
+        }
+        metrics_.dropped_count += key_it->second.size();
+        metrics_.pending_count -= key_it->second.size();
+        items_.erase(key_it);
+    }
+
+    std::vector<Key> GetKeys() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Key> keys;
+        keys.reserve(items_.size());
+        for (const auto& key_items : items_) {
+            keys.push_back(key_items.first);
+        }
+        return keys;
+    }
+
+    bool Empty() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.empty();
+    }
+
+    DeferredMetrics GetMetrics() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return metrics_;
+    }
+
+    static const std::size_t default_max_per_key = 1000;
+    static const std::size_t default_max_keys = 10000;
+
+private:
+    const std::size_t max_per_key_;
+    const std::size_t max_keys_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<Key, std::deque<Item>, Hash> items_;
+    DeferredMetrics metrics_;
+};
+
+}
+
+#endif //DEFERREDQUEUE_H
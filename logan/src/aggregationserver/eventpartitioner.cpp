@@ -0,0 +1,173 @@
+#include "eventpartitioner.h"
+
+#include <iostream>
+#include <sstream>
+
+#include <google/protobuf/util/time_util.h>
+
+#include "databaseclient.h"
+
+using google::protobuf::util::TimeUtil;
+
+EventPartitioner::EventPartitioner(std::shared_ptr<DatabaseClient> db_client) :
+    database_(db_client)
+{
+
+}
+
+const std::vector<EventPartitioner::EventTable>& EventPartitioner::GetEventTables() {
+    // Partitioned tables need the partition keys in their primary key, so each ID is paired with ExperimentRunID and SampleTime
+    static const std::vector<EventTable> event_tables = {
+        {"PortLifecycleEvent", "PortLifecycleEventID", {
+            "PortID INT NOT NULL REFERENCES Port (PortID)",
+            "Type TEXT NOT NULL"
+        }},
+        {"WorkloadEvent", "WorkloadEventID", {
+            "WorkerInstanceID INT NOT NULL REFERENCES WorkerInstance (WorkerInstanceID)",
+            "WorkloadID INT NOT NULL",
+            "Function TEXT NOT NULL",
+            "Type TEXT NOT NULL",
+            "Arguments TEXT NOT NULL",
+            "LogLevel INT NOT NULL"
+        }},
+        {"PortEvent", "PortEventID", {
+            "PortID INT NOT NULL REFERENCES Port (PortID)",
+            "PortEventSequenceNum INT NOT NULL",
+            "Type TEXT NOT NULL",
+            "Message TEXT"
+        }},
+        {"ComponentLifecycleEvent", "ComponentLifecycleEventID", {
+            "ComponentInstanceID INT NOT NULL REFERENCES ComponentInstance (ComponentInstanceID)",
+            "Type TEXT NOT NULL"
+        }},
+        {"Hardware.SystemStatus", "SystemStatusID", {
+            "SystemID INT NOT NULL REFERENCES Hardware.System (SystemID)",
+            "CPUUtilisation DECIMAL NOT NULL",
+            "PhysMemUtilisation DECIMAL NOT NULL"
+        }},
+        {"Hardware.ProcessStatus", "ProcessStatusID", {
+            "ProcessID INT NOT NULL REFERENCES Hardware.Process (ProcessID)",
+            "CoreID INT NOT NULL",
+            "CPUUtilisation DECIMAL NOT NULL",
+            "CPUTime INTERVAL NOT NULL",
+            "PhysMemUtilisation DECIMAL NOT NULL",
+            "PhysMemUsedKB BIGINT NOT NULL",
+            "ThreadCount INT NOT NULL",
+            "DiskRead BIGINT NOT NULL",
+            "DiskWritten BIGINT NOT NULL",
+            "DiskTotal BIGINT NOT NULL",
+            "State TEXT NOT NULL"
+        }},
+        {"Hardware.InterfaceStatus", "InterfaceStatusID", {
+            "InterfaceID INT NOT NULL REFERENCES Hardware.Interface (InterfaceID)",
+            "PacketsReceived BIGINT NOT NULL",
+            "BytesReceived BIGINT NOT NULL",
+            "PacketsTransmitted BIGINT NOT NULL",
+            "BytesTransmitted BIGINT NOT NULL"
+        }},
+        {"Hardware.FilesystemStatus", "FilesystemStatusID", {
+            "FilesystemID INT NOT NULL REFERENCES Hardware.Filesystem (FilesystemID)",
+            "Utilisation DECIMAL NOT NULL"
+        }}
+    };
+    return event_tables;
+}
+
+void EventPartitioner::BootstrapEventTables() {
+    for (const auto& table : GetEventTables()) {
+        const auto state = GetTableState(table.name);
+
+        if (state == TableState::Missing) {
+            database_->ExecuteQuery(BuildCreateTable(table));
+        } else if (state == TableState::Unpartitioned) {
+            if (IsTableEmpty(table.name)) {
+                std::cout << "Recreating empty table " << table.name << " as a partitioned table" << std::endl;
+                database_->ExecuteQuery("DROP TABLE " + table.name + ";\n" + BuildCreateTable(table));
+            } else {
+                database_->ExecuteQuery(
+                    "ALTER TABLE " + table.name + " ADD COLUMN IF NOT EXISTS ExperimentRunID INT REFERENCES ExperimentRun (ExperimentRunID);"
+                );
+            }
+        }
+    }
+}
+
+void EventPartitioner::LoadPartitionedTables() {
+    partitioned_tables_.clear();
+    for (const auto& table : GetEventTables()) {
+        if (GetTableState(table.name) == TableState::Partitioned) {
+            partitioned_tables_.insert(table.name);
+        } else {
+            std::cerr << "Table " << table.name << " is not partitioned, "
+                << "events for new runs will be written to it unpartitioned" << std::endl;
+        }
+    }
+}
+
+void EventPartitioner::CreateRunPartitions(int experiment_run_id, const google::protobuf::Timestamp& start_time) {
+    const std::string run_suffix = "_Run" + std::to_string(experiment_run_id);
+
+    // Align the daily partitions to UTC midnight of the day the run started
+    const int64_t seconds_per_day = 24 * 60 * 60;
+    const int64_t first_day = (start_time.seconds() / seconds_per_day) * seconds_per_day;
+
+    std::stringstream query_stream;
+    for (const auto& table_name : partitioned_tables_) {
+        const std::string run_partition = table_name + run_suffix;
+
+        query_stream << "CREATE TABLE IF NOT EXISTS " << run_partition << " PARTITION OF " << table_name
+            << " FOR VALUES IN (" << experiment_run_id << ") PARTITION BY RANGE (SampleTime);" << std::endl;
+
+        for (int day = 0; day < days_per_run; day++) {
+            google::protobuf::Timestamp day_start, day_end;
+            day_start.set_seconds(first_day + day * seconds_per_day);
+            day_end.set_seconds(first_day + (day + 1) * seconds_per_day);
+
+            query_stream << "CREATE TABLE IF NOT EXISTS " << run_partition << "_Day" << day << " PARTITION OF " << run_partition
+                << " FOR VALUES FROM ('" << TimeUtil::ToString(day_start) << "') TO ('" << TimeUtil::ToString(day_end) << "');" << std::endl;
+        }
+
+        query_stream << "CREATE TABLE IF NOT EXISTS " << run_partition << "_Default PARTITION OF " << run_partition << " DEFAULT;" << std::endl;
+    }
+
+    const auto& query = query_stream.str();
+    if (!query.empty()) {
+        database_->ExecuteQuery(query);
+    }
+}
+
+EventPartitioner::TableState EventPartitioner::GetTableState(const std::string& table_name) {
+    const auto& results = database_->ExecuteQuery(
+        "SELECT relkind FROM pg_class WHERE oid = to_regclass(" + database_->EscapeString(table_name) + ");"
+    );
+    for (const auto& row : results) {
+        return row.at(0).as<std::string>() == "p" ? TableState::Partitioned : TableState::Unpartitioned;
+    }
+    return TableState::Missing;
+}
+
+bool EventPartitioner::IsTableEmpty(const std::string& table_name) {
+    const auto& results = database_->ExecuteQuery("SELECT NOT EXISTS (SELECT 1 FROM " + table_name + ");");
+    for (const auto& row : results) {
+        return row.at(0).as<bool>();
+    }
+    return false;
+}
+
+std::string EventPartitioner::BuildCreateTable(const EventTable& table) const {
+    std::stringstream create_stream;
+
+    create_stream << "CREATE TABLE " << table.name << std::endl;
+    create_stream << "(" << std::endl;
+    create_stream << "  " << table.id_column << " SERIAL," << std::endl;
+    create_stream << "  ExperimentRunID INT NOT NULL REFERENCES ExperimentRun (ExperimentRunID)," << std::endl;
+    for (const auto& column : table.column_definitions) {
+        create_stream << "  " << column << "," << std::endl;
+    }
+    create_stream << "  SampleTime TIMESTAMP NOT NULL," << std::endl;
+    create_stream << std::endl;
+    create_stream << "  PRIMARY KEY (" << table.id_column << ", ExperimentRunID, SampleTime)" << std::endl;
+    create_stream << ") PARTITION BY LIST (ExperimentRunID);" << std::endl;
+
+    return create_stream.str();
+}
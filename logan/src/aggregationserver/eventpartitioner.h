@@ -0,0 +1,57 @@
+#ifndef EVENTPARTITIONER_H
+#define EVENTPARTITIONER_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/timestamp.pb.h>
+
+class DatabaseClient;
+
+// Owns the DDL for the high volume event and Hardware.*Status tables.
+// Each table is declared as LIST partitioned on ExperimentRunID, and each run's partition is in turn
+// RANGE partitioned on SampleTime by day, so reads filtered on a run and time range only touch a single run's partitions.
+// Old runs can be removed with ALTER TABLE ... DETACH PARTITION / DROP TABLE on <Table>_Run<ExperimentRunID>.
+class EventPartitioner {
+public:
+    EventPartitioner(std::shared_ptr<DatabaseClient> db_client);
+
+    // Creates any missing event tables as partitioned tables.
+    // Existing non-empty unpartitioned tables are left in place and only gain an ExperimentRunID column.
+    void BootstrapEventTables();
+
+    // Finds which event tables are partitioned, must be called before CreateRunPartitions
+    void LoadPartitionedTables();
+
+    // Creates the run's partition of every partitioned event table, along with daily sub-partitions covering
+    // the first days_per_run days from start_time and a default sub-partition for everything outside that range
+    void CreateRunPartitions(int experiment_run_id, const google::protobuf::Timestamp& start_time);
+
+    static const int days_per_run = 7;
+
+private:
+    struct EventTable {
+        std::string name;
+        std::string id_column;
+        std::vector<std::string> column_definitions;
+    };
+
+    enum class TableState {
+        Missing,
+        Partitioned,
+        Unpartitioned
+    };
+
+    TableState GetTableState(const std::string& table_name);
+    bool IsTableEmpty(const std::string& table_name);
+    std::string BuildCreateTable(const EventTable& table) const;
+
+    static const std::vector<EventTable>& GetEventTables();
+
+    std::shared_ptr<DatabaseClient> database_;
+    std::set<std::string> partitioned_tables_;
+};
+
+#endif //EVENTPARTITIONER_H
@@ -0,0 +1,257 @@
+#include "eventspool.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Creates path and any missing parent directories
+    void MakeDirectory(const std::string& path) {
+        for (auto separator = path.find('/', 1); ; separator = path.find('/', separator + 1)) {
+            const std::string sub_path = path.substr(0, separator);
+#ifdef _WIN32
+            const int result = _mkdir(sub_path.c_str());
+#else
+            const int result = mkdir(sub_path.c_str(), 0755);
+#endif
+            if (result != 0 && errno != EEXIST) {
+                throw std::runtime_error("Unable to create spool directory: " + sub_path);
+            }
+            if (separator == std::string::npos) {
+                break;
+            }
+        }
+    }
+
+    bool FileExists(const std::string& path) {
+        return std::ifstream(path).good();
+    }
+
+    bool TruncateFile(const std::string& path, std::streamoff length) {
+#ifdef _WIN32
+        const int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+        if (fd < 0) {
+            return false;
+        }
+        const bool truncated = _chsize_s(fd, length) == 0;
+        _close(fd);
+        return truncated;
+#else
+        return truncate(path.c_str(), length) == 0;
+#endif
+    }
+
+    void WriteLength(std::ofstream& stream, uint32_t length) {
+        const char bytes[4] = {
+            static_cast<char>(length & 0xFF),
+            static_cast<char>((length >> 8) & 0xFF),
+            static_cast<char>((length >> 16) & 0xFF),
+            static_cast<char>((length >> 24) & 0xFF)
+        };
+        stream.write(bytes, 4);
+    }
+
+    bool ReadLength(std::ifstream& stream, uint32_t& length) {
+        unsigned char bytes[4];
+        if (!stream.read(reinterpret_cast<char*>(bytes), 4)) {
+            return false;
+        }
+        length = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+        return true;
+    }
+}
+
+EventSpool::EventSpool(const std::string& directory, std::size_t segment_size) :
+    directory_(directory),
+    segment_size_(segment_size)
+{
+    MakeDirectory(directory_);
+
+    std::ifstream head_stream(GetHeadPath());
+    if (!(head_stream >> read_segment_)) {
+        read_segment_ = 0;
+    }
+    if (!(head_stream >> read_offset_)) {
+        read_offset_ = 0;
+    }
+
+    // Segments left behind by a previous process are kept for replay, new frames go into a fresh segment after them
+    write_segment_ = read_segment_;
+    while (FileExists(GetSegmentPath(write_segment_))) {
+        write_segment_++;
+    }
+    if (write_segment_ == read_segment_) {
+        // Nothing left to replay, the offset belonged to a segment that no longer exists
+        read_offset_ = 0;
+    } else {
+        std::cout << "Found " << (write_segment_ - read_segment_) << " spool segments to replay in " << directory_ << std::endl;
+    }
+    OpenWriteSegment();
+    SaveHead();
+}
+
+EventSpool::~EventSpool() {
+    // Record the frames consumed since the last save, so a clean shutdown doesn't replay them
+    SaveHead();
+}
+
+void EventSpool::Append(const std::string& type_name, const std::string& payload) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const std::streamoff frame_size = 8 + type_name.size() + payload.size();
+    if (write_offset_ > 0 && write_offset_ + frame_size > static_cast<std::streamoff>(segment_size_)) {
+        writer_.close();
+        write_segment_++;
+        OpenWriteSegment();
+    }
+
+    WriteLength(writer_, static_cast<uint32_t>(type_name.size()));
+    writer_.write(type_name.data(), type_name.size());
+    WriteLength(writer_, static_cast<uint32_t>(payload.size()));
+    writer_.write(payload.data(), payload.size());
+    // Flushed every frame so the reader, and a restarted process, can see it
+    writer_.flush();
+    if (!writer_) {
+        // A short write (e.g. a full disk) would leave a partial frame that every later frame is read after
+        RewindWriteSegment();
+        throw std::runtime_error("Failed to write to spool segment: " + GetSegmentPath(write_segment_));
+    }
+    write_offset_ += frame_size;
+}
+
+bool EventSpool::Peek(Frame& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    while (!EmptyLocked()) {
+        std::streamoff next_offset;
+        if (ReadFrameAt(read_offset_, frame, next_offset)) {
+            peeked_offset_ = next_offset;
+            return true;
+        }
+        if (read_segment_ == write_segment_) {
+            // The writer is part way through a frame
+            return false;
+        }
+
+        // Finished with this segment, a truncated tail frame can only be left by a crash and is skipped
+        reader_.close();
+        std::remove(GetSegmentPath(read_segment_).c_str());
+        read_segment_++;
+        read_offset_ = 0;
+        SaveHead();
+    }
+    return false;
+}
+
+void EventSpool::Pop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (peeked_offset_ >= 0) {
+        read_offset_ = peeked_offset_;
+        peeked_offset_ = -1;
+        if (++unsaved_pops_ >= head_save_interval) {
+            SaveHead();
+        }
+    }
+}
+
+bool EventSpool::Empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return EmptyLocked();
+}
+
+bool EventSpool::EmptyLocked() const {
+    return read_segment_ == write_segment_ && read_offset_ >= write_offset_;
+}
+
+std::string EventSpool::GetSegmentPath(uint64_t segment) const {
+    return directory_ + "/segment_" + std::to_string(segment) + ".spool";
+}
+
+std::string EventSpool::GetHeadPath() const {
+    return directory_ + "/head";
+}
+
+void EventSpool::OpenWriteSegment() {
+    writer_.open(GetSegmentPath(write_segment_), std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!writer_) {
+        throw std::runtime_error("Unable to open spool segment: " + GetSegmentPath(write_segment_));
+    }
+    write_offset_ = 0;
+}
+
+void EventSpool::RewindWriteSegment() {
+    writer_.close();
+    if (!TruncateFile(GetSegmentPath(write_segment_), write_offset_)) {
+        std::cerr << "Unable to truncate spool segment: " << GetSegmentPath(write_segment_) << std::endl;
+    }
+    // Reopened in append mode, new frames carry on from the end of the last complete one
+    writer_.clear();
+    writer_.open(GetSegmentPath(write_segment_), std::ios::binary | std::ios::out | std::ios::app);
+}
+
+void EventSpool::SaveHead() {
+    // Written to a temporary file and renamed over the head, a crash part way through leaves the previous head intact
+    // rather than an empty one that reads as segment 0
+    const std::string temp_path = GetHeadPath() + ".tmp";
+    {
+        std::ofstream head_stream(temp_path, std::ios::out | std::ios::trunc);
+        head_stream << read_segment_ << " " << read_offset_;
+        head_stream.flush();
+        if (!head_stream) {
+            std::cerr << "Unable to write spool head: " << temp_path << std::endl;
+            return;
+        }
+    }
+#ifdef _WIN32
+    // rename() won't replace an existing file on Windows
+    std::remove(GetHeadPath().c_str());
+#endif
+    if (std::rename(temp_path.c_str(), GetHeadPath().c_str()) != 0) {
+        std::cerr << "Unable to replace spool head: " << GetHeadPath() << std::endl;
+        return;
+    }
+    unsaved_pops_ = 0;
+}
+
+bool EventSpool::ReadFrameAt(std::streamoff offset, Frame& frame, std::streamoff& next_offset) {
+    if (!reader_.is_open() || reader_segment_ != read_segment_) {
+        reader_.close();
+        reader_.open(GetSegmentPath(read_segment_), std::ios::binary | std::ios::in);
+        reader_segment_ = read_segment_;
+    }
+    // Clear any EOF left by a previous read, the writer may have appended since
+    reader_.clear();
+    reader_.seekg(0, std::ios::end);
+    const std::streamoff file_size = reader_.tellg();
+    reader_.seekg(offset);
+
+    // Lengths are checked against what is left of the file before allocating, a corrupt length is read as a truncated tail
+    uint32_t type_length, payload_length;
+    if (!ReadLength(reader_, type_length) || offset + 8 + static_cast<std::streamoff>(type_length) > file_size) {
+        return false;
+    }
+    frame.type_name.resize(type_length);
+    if (!reader_.read(&frame.type_name[0], type_length) || !ReadLength(reader_, payload_length)) {
+        return false;
+    }
+    if (offset + 8 + static_cast<std::streamoff>(type_length) + static_cast<std::streamoff>(payload_length) > file_size) {
+        return false;
+    }
+    frame.payload.resize(payload_length);
+    if (payload_length > 0 && !reader_.read(&frame.payload[0], payload_length)) {
+        return false;
+    }
+
+    next_offset = offset + 8 + type_length + payload_length;
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef EVENTSPOOL_H
+#define EVENTSPOOL_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// Disk backed FIFO of serialized protobuf messages, owned by a single experiment run.
+// Frames are appended to numbered segment files inside directory; a segment is deleted once it has been fully read
+// and the writer has moved on to a newer one. The oldest unread segment and the offset of its first unacknowledged
+// frame are kept in a head file, so only what a previous aggregation server process left unreplayed is replayed after a restart.
+// The head file is rewritten every head_save_interval frames and whenever the read segment changes, so a crash replays at
+// most that many frames a second time.
+class EventSpool {
+public:
+    struct Frame {
+        std::string type_name;
+        std::string payload;
+    };
+
+    EventSpool(const std::string& directory, std::size_t segment_size = default_segment_size);
+    ~EventSpool();
+
+    // Throws if the frame can't be written, a partially written frame is truncated so the segment stays readable
+    void Append(const std::string& type_name, const std::string& payload);
+
+    // Reads the oldest frame without consuming it, returns false if the spool is empty
+    bool Peek(Frame& frame);
+    // Consumes the frame returned by the last successful Peek, and records it in the head file
+    void Pop();
+
+    bool Empty();
+
+    static const std::size_t default_segment_size = 64 * 1024 * 1024;
+    static const std::size_t head_save_interval = 256;
+
+private:
+    std::string GetSegmentPath(uint64_t segment) const;
+    std::string GetHeadPath() const;
+    void OpenWriteSegment();
+    void RewindWriteSegment();
+    void SaveHead();
+    bool ReadFrameAt(std::streamoff offset, Frame& frame, std::streamoff& next_offset);
+    bool EmptyLocked() const;
+
+    const std::string directory_;
+    const std::size_t segment_size_;
+
+    uint64_t read_segment_ = 0;
+    std::streamoff read_offset_ = 0;
+    std::streamoff peeked_offset_ = -1;
+    std::size_t unsaved_pops_ = 0;
+    std::ifstream reader_;
+    uint64_t reader_segment_ = 0;
+
+    uint64_t write_segment_ = 0;
+    std::streamoff write_offset_ = 0;
+    std::ofstream writer_;
+
+    std::mutex mutex_;
+};
+
+#endif //EVENTSPOOL_H
@@ -16,10 +16,35 @@ using std::chrono::milliseconds;
 using std::chrono::duration_cast;
 using std::chrono::time_point;
 
-ExperimentTracker::ExperimentTracker(std::shared_ptr<DatabaseClient> db_client) :
-    database_(db_client) {
-    
+ExperimentTracker::ExperimentTracker(
+    std::shared_ptr<DatabaseClient> db_client,
+    const std::string& connection_string,
+    std::size_t pipeline_depth,
+    const std::string& spool_directory,
+    std::chrono::milliseconds port_event_rollup_interval
+) :
+    database_(db_client),
+    connection_string_(connection_string),
+    pipeline_depth_(pipeline_depth),
+    spool_directory_(spool_directory),
+    port_event_rollup_interval_(port_event_rollup_interval),
+    event_partitioner_(db_client),
+    schema_migrator_(db_client, event_partitioner_)
+{
+    schema_migrator_.Migrate();
+    event_partitioner_.LoadPartitionedTables();
+}
+
+ExperimentTracker::~ExperimentTracker() {
+    // Runs are taken out of the map first, a drained task retiring its run while they are torn down finds nothing to do
+    std::map<int, ExperimentRunInfo> runs;
+    {
+        std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
+        runs.swap(experiment_run_map_);
     }
+    runs.clear();
+    ReapRetiredRuns();
+}
 
 int ExperimentTracker::RegisterExperimentRun(
     const std::string& experiment_name,
@@ -32,6 +57,7 @@ int ExperimentTracker::RegisterExperimentRun(
     
     std::cout << "Registering experiment with name " << experiment_name << " @ time " << timestamp << std::endl;
 
+    ReapRetiredRuns();
     std::lock_guard<std::mutex> access_lock(access_mutex_);
 
     int experiment_id;
@@ -62,23 +88,67 @@ int ExperimentTracker::RegisterExperimentRun(
         //new_run.job_num = 0;
         new_run.running = true;
 
-        new_run.experiment_run_id = database_->InsertValues(
-            "ExperimentRun", 
-            {"ExperimentID", "JobNum", "StartTime"},
-            {std::to_string(experiment_id), std::to_string(new_run.job_num), start_time}
-        );
+        // A run with a matching start time means the aggregation server was restarted part way through the experiment
+        new_run.experiment_run_id = GetExistingExperimentRunID(experiment_id, start_time);
+        const bool resumed = (new_run.experiment_run_id != -1);
+        if (!resumed) {
+            new_run.experiment_run_id = database_->InsertValues(
+                "ExperimentRun", 
+                {"ExperimentID", "JobNum", "StartTime"},
+                {std::to_string(experiment_id), std::to_string(new_run.job_num), start_time}
+            );
+        }
 
+        // Partitions must exist before the run's first event arrives, IF NOT EXISTS makes this safe when resuming
+        event_partitioner_.CreateRunPartitions(new_run.experiment_run_id, timestamp);
+
+        new_run.database = std::make_shared<DatabaseClient>(connection_string_);
+        // Spools are kept per run so a resumed run picks up whatever its previous process left behind
+        const std::string run_spool_directory = spool_directory_.empty() ? "" : spool_directory_ + "/run_" + std::to_string(new_run.experiment_run_id);
+        new_run.ingest_worker = std::unique_ptr<IngestWorker>(
+            new IngestWorker(new_run.experiment_run_id, IngestWorker::default_queue_capacity, run_spool_directory)
+        );
+        if (pipeline_depth_ > 0) {
+            new_run.database->EnablePipelining(pipeline_depth_);
+            // Commit whatever is in flight as soon as the run goes quiet, so pipelining never holds events back indefinitely.
+            // Events whose writes failed are handed back to the ingest worker through their write callbacks.
+            auto run_database = new_run.database;
+            const int experiment_run_id = new_run.experiment_run_id;
+            new_run.ingest_worker->SetIdleCallback([run_database, experiment_run_id]() {
+                const int failed_count = run_database->FlushPipeline();
+                if (failed_count > 0) {
+                    std::cerr << failed_count << " pipelined statements failed for ExperimentRunID " << experiment_run_id << std::endl;
+                }
+            });
+        }
         new_run.receiver = std::unique_ptr<zmq::ProtoReceiver>(new zmq::ProtoReceiver());
-        new_run.system_handler = std::unique_ptr<SystemEventProtoHandler>(new SystemEventProtoHandler(database_, *this, new_run.experiment_run_id));
-        new_run.model_handler = std::unique_ptr<ModelEventProtoHandler>(new ModelEventProtoHandler(database_, *this, new_run.experiment_run_id));
+        new_run.system_handler = std::unique_ptr<SystemEventProtoHandler>(
+            new SystemEventProtoHandler(new_run.database, *this, new_run.experiment_run_id, *new_run.ingest_worker)
+        );
+        new_run.model_handler = std::unique_ptr<ModelEventProtoHandler>(
+            new ModelEventProtoHandler(new_run.database, *this, new_run.experiment_run_id, *new_run.ingest_worker)
+        );
+        if (port_event_rollup_interval_.count() > 0) {
+            new_run.model_handler->EnablePortEventRollup(port_event_rollup_interval_);
+        }
         new_run.system_handler->BindCallbacks(*new_run.receiver);
         new_run.model_handler->BindCallbacks(*new_run.receiver);
         new_run.receiver->Filter("");
 
-        experiment_run_map_.emplace(new_run.experiment_run_id, std::move(new_run));
-        active_experiment_ids_.emplace(std::make_pair(experiment_id, new_run.experiment_run_id));
+        if (resumed) {
+            std::cout << "Resuming ExperimentRunID " << new_run.experiment_run_id << ", reloading ID caches" << std::endl;
+            LoadNodeIDCache(new_run);
+            new_run.model_handler->LoadIDCaches();
+        }
+
+        const int experiment_run_id = new_run.experiment_run_id;
+        {
+            std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
+            experiment_run_map_.emplace(experiment_run_id, std::move(new_run));
+        }
+        active_experiment_ids_.emplace(std::make_pair(experiment_id, experiment_run_id));
 
-        return new_run.experiment_run_id;
+        return experiment_run_id;
     }
 }
 
@@ -87,16 +157,98 @@ void ExperimentTracker::ShutdownExperimentRun(
     const google::protobuf::Timestamp& timestamp
 ) {
     std::cout << "Shuting down experiment with name " << experiment_name << std::endl;
+    ReapRetiredRuns();
     int experiment_id = GetExperimentID(experiment_name);
     int experiment_run_id = GetCurrentRunID(experiment_id);
 
     using google::protobuf::util::TimeUtil;
     std::string end_time  = TimeUtil::ToString(timestamp);
-    database_->UpdateShutdownTime(experiment_run_id, end_time);
 
     active_experiment_ids_.erase(experiment_id);
     auto& run = GetExperimentRunInfo(experiment_run_id);
     run.running = false;
+    // Samples still waiting on IDs get a last lookup, before the rollups so anything written is included
+    run.system_handler->FlushDeferredStatus();
+    // Rollup intervals still open at shutdown are written now, anything arriving later is merged into them
+    run.model_handler->FlushPortEventRollup();
+    run.system_handler->FlushStatusRollup();
+
+    // EndTime marks the run's data as final (the broker caches responses for finished runs), so it is only written once
+    // every event queued or spooled so far has been written. The handlers outlive the worker, so the pointers stay valid.
+    // The run is then retired, releasing its connections and threads rather than holding them for the server's lifetime.
+    auto database = database_;
+    auto ingest_worker = run.ingest_worker.get();
+    auto system_handler = run.system_handler.get();
+    auto model_handler = run.model_handler.get();
+    run.ingest_worker->EnqueueWhenDrained([this, database, ingest_worker, system_handler, model_handler, experiment_run_id, end_time]() {
+        database->UpdateShutdownTime(experiment_run_id, end_time);
+        PrintRunMetrics(experiment_run_id, ingest_worker->GetMetrics(), *system_handler, *model_handler);
+        RetireExperimentRun(experiment_run_id);
+    });
+}
+
+void ExperimentTracker::RetireExperimentRun(int experiment_run_id) {
+    std::unique_ptr<zmq::ProtoReceiver> receiver;
+    {
+        std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
+        auto run_it = experiment_run_map_.find(experiment_run_id);
+        if (run_it == experiment_run_map_.end()) {
+            return;
+        }
+        receiver = std::move(run_it->second.receiver);
+        retired_runs_.push_back(std::move(run_it->second));
+        experiment_run_map_.erase(run_it);
+    }
+    // Outside the lock, the receiver's callbacks may be waiting on it to look up the run
+    receiver.reset();
+    std::cout << "Retired ExperimentRunID " << experiment_run_id << std::endl;
+}
+
+void ExperimentTracker::ReapRetiredRuns() {
+    std::vector<ExperimentRunInfo> retired_runs;
+    {
+        std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
+        retired_runs.swap(retired_runs_);
+    }
+    // Destroying a run joins its writer thread, which has finished with it once it was retired
+    retired_runs.clear();
+}
+
+void ExperimentTracker::PrintRunMetrics(
+    int experiment_run_id,
+    const IngestWorker::Metrics& metrics,
+    const SystemEventProtoHandler& system_handler,
+    const ModelEventProtoHandler& model_handler
+) {
+    std::cout << "Ingest metrics for ExperimentRunID " << experiment_run_id << ": "
+        << metrics.processed_count << " written, "
+        << metrics.failed_count << " failed, "
+        << metrics.dropped_count << " dropped, "
+        << metrics.spooled_count << " spooled, "
+        << metrics.replayed_count << " replayed from spool, "
+        << metrics.parked_count << " parked awaiting IDs, "
+        << metrics.queue_depth << " queued (peak " << metrics.peak_queue_depth << "), "
+        << "publish to commit lag mean/max " << metrics.mean_lag.count() << "/" << metrics.max_lag.count() << "us" << std::endl;
+
+    PrintSequenceMetrics(experiment_run_id, "StatusEvent", system_handler.GetSequenceMetrics());
+    PrintSequenceMetrics(experiment_run_id, "UtilizationEvent", model_handler.GetSequenceMetrics());
+
+    const auto& deferred_metrics = system_handler.GetDeferredMetrics();
+    std::cout << "Deferred hardware samples for ExperimentRunID " << experiment_run_id << ": "
+        << deferred_metrics.parked_count << " parked awaiting IDs, "
+        << deferred_metrics.released_count << " written once registered, "
+        << deferred_metrics.dropped_count << " dropped, "
+        << deferred_metrics.pending_count << " still waiting" << std::endl;
+}
+
+void ExperimentTracker::PrintSequenceMetrics(int experiment_run_id, const std::string& event_name, const SequenceTracker::Metrics& metrics) {
+    std::cout << event_name << " sequence metrics for ExperimentRunID " << experiment_run_id << ": "
+        << metrics.accepted_count << " accepted from " << metrics.producer_count << " producers, "
+        << metrics.duplicate_count << " duplicates dropped, "
+        << metrics.missing_count << " missing, "
+        << metrics.reordered_count << " reordered, "
+        << metrics.behind_window_count << " behind the window, "
+        << metrics.reset_count << " producer resets" << std::endl;
 }
 
 void ExperimentTracker::RegisterSystemEventProducer(int experiment_run_id, const std::string& endpoint) {
@@ -117,24 +269,53 @@ int ExperimentTracker::GetCurrentRunID(int experiment_id){
 }
 
 void ExperimentTracker::AddNodeIDWithHostname(int experiment_run_id, const std::string& hostname, int node_id) {
-    GetExperimentRunInfo(experiment_run_id).hostname_node_id_cache.emplace(std::make_pair(hostname, node_id));
+    auto& exp_info = GetExperimentRunInfo(experiment_run_id);
+    std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
+    exp_info.hostname_node_id_cache.emplace(std::make_pair(hostname, node_id));
 }
 
 int ExperimentTracker::GetNodeIDFromHostname(int experiment_run_id, const std::string& hostname) {
     auto& exp_info = GetExperimentRunInfo(experiment_run_id);
     try {
+        std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
         return exp_info.hostname_node_id_cache.at(hostname);
     } catch (const std::out_of_range& oor_exception) {
         // If we can't find anything then go back to the database
-        std::stringstream condition_stream;
-        condition_stream << "Hostname = " << database_->EscapeString(hostname) << " AND ExperimentRunID = " << experiment_run_id;
-        const auto& node_id = database_->GetID("Node", condition_stream.str());
+        DatabaseClient::QueryParameters params;
+        const std::string condition = "Hostname = " + params.Add(hostname) + " AND ExperimentRunID = " + params.Add(experiment_run_id);
+        const auto& node_id = exp_info.database->GetID("Node", condition, params);
         AddNodeIDWithHostname(experiment_run_id, hostname, node_id);
         return node_id;
     }
 }
 
+void ExperimentTracker::AddComponentIDWithName(int experiment_run_id, const std::string& name, int component_id) {
+    GetExperimentRunInfo(experiment_run_id).model_handler->AddComponentID(name, component_id);
+}
+
+void ExperimentTracker::AddComponentInstanceIDWithGraphmlID(int experiment_run_id, const std::string& graphml_id, int component_instance_id) {
+    GetExperimentRunInfo(experiment_run_id).model_handler->AddComponentInstanceID(graphml_id, component_instance_id);
+}
+
+void ExperimentTracker::AddPortIDWithGraphmlID(int experiment_run_id, const std::string& graphml_id, int port_id) {
+    GetExperimentRunInfo(experiment_run_id).model_handler->AddPortID(graphml_id, port_id);
+}
+
+void ExperimentTracker::AddWorkerInstanceIDWithGraphmlID(int experiment_run_id, const std::string& graphml_id, int worker_instance_id) {
+    GetExperimentRunInfo(experiment_run_id).model_handler->AddWorkerInstanceID(graphml_id, worker_instance_id);
+}
+
+IngestWorker::Metrics ExperimentTracker::GetIngestMetrics(int experiment_run_id) {
+    return GetExperimentRunInfo(experiment_run_id).ingest_worker->GetMetrics();
+}
+
+uint64_t ExperimentTracker::GetDatabaseTransactionCount(int experiment_run_id) {
+    return GetExperimentRunInfo(experiment_run_id).database->GetTransactionCount();
+}
+
 ExperimentRunInfo& ExperimentTracker::GetExperimentRunInfo(int experiment_run_id) {
+    // Guards against runs being registered while a run's writer thread is looking up its own info
+    std::lock_guard<std::mutex> run_map_lock(run_map_mutex_);
     try {
         return experiment_run_map_.at(experiment_run_id);
     } catch (const std::exception&) {
@@ -142,3 +323,29 @@ ExperimentRunInfo& ExperimentTracker::GetExperimentRunInfo(int experiment_run_id
     }
 }
 
+int ExperimentTracker::GetExistingExperimentRunID(int experiment_id, const std::string& start_time) {
+    DatabaseClient::QueryParameters params;
+    const auto& results = database_->GetValues(
+        "ExperimentRun",
+        {"ExperimentRunID"},
+        "ExperimentID = " + params.Add(experiment_id) + " AND StartTime = " + params.Add(start_time, "timestamp"),
+        params
+    );
+    for (const auto& row : results) {
+        return row.at("ExperimentRunID").as<int>();
+    }
+    return -1;
+}
+
+void ExperimentTracker::LoadNodeIDCache(ExperimentRunInfo& run_info) {
+    DatabaseClient::QueryParameters params;
+    const auto& results = database_->GetValues(
+        "Node",
+        {"Hostname", "NodeID"},
+        "ExperimentRunID = " + params.Add(run_info.experiment_run_id),
+        params
+    );
+    for (const auto& row : results) {
+        run_info.hostname_node_id_cache.emplace(std::make_pair(row.at("Hostname").as<std::string>(), row.at("NodeID").as<int>()));
+    }
+}
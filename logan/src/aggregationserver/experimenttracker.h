@@ -1,6 +1,7 @@
 #ifndef EXPERIMENTTRACKER_H
 #define EXPERIMENTTRACKER_H
 
+#include <chrono>
 #include <string>
 #include <exception>
 #include <memory>
@@ -8,6 +9,7 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include <google/protobuf/timestamp.pb.h>
 
@@ -15,6 +17,9 @@
 
 #include "systemeventprotohandler.h"
 #include "modeleventprotohandler.h"
+#include "ingestworker.h"
+#include "eventpartitioner.h"
+#include "schemamigrator.h"
 
 class DatabaseClient;
 
@@ -27,16 +32,30 @@ struct ExperimentRunInfo {
     int job_num;
     bool running;
     int experiment_run_id;
-    std::unique_ptr<zmq::ProtoReceiver> receiver;
+    // Each run writes over its own connection so a heavy run can't stall the inserts of another
+    std::shared_ptr<DatabaseClient> database;
     std::unique_ptr<SystemEventProtoHandler> system_handler;
     std::unique_ptr<ModelEventProtoHandler> model_handler;
+    std::unique_ptr<IngestWorker> ingest_worker;
+    // Declared last so it is destroyed first, stopping new events before the worker and handlers are torn down
+    std::unique_ptr<zmq::ProtoReceiver> receiver;
 
     std::map<std::string, int> hostname_node_id_cache;
 };
 
 class ExperimentTracker {
 public:
-    ExperimentTracker(std::shared_ptr<DatabaseClient> db_client);
+    // A pipeline_depth of 0 writes every event synchronously, otherwise up to pipeline_depth statements are kept in flight per run
+    // An empty spool_directory disables spooling events to disk when the database can't keep up
+    // A port_event_rollup_interval of 0 writes raw PortEvents only, otherwise PortEventRollup rows are kept at that interval
+    ExperimentTracker(
+        std::shared_ptr<DatabaseClient> db_client,
+        const std::string& connection_string,
+        std::size_t pipeline_depth = 0,
+        const std::string& spool_directory = "",
+        std::chrono::milliseconds port_event_rollup_interval = std::chrono::milliseconds(0)
+    );
+    ~ExperimentTracker();
     int RegisterExperimentRun(
         const std::string& experiment_name,
         const google::protobuf::Timestamp& timestamp
@@ -55,17 +74,50 @@ public:
     void AddNodeIDWithHostname(int experiment_run_id, const std::string& hostname, int node_id);
     int GetNodeIDFromHostname(int experiment_run_id, const std::string& hostname);
 
+    // Hand IDs inserted during CONFIGURE straight to the run's ModelEvent caches
+    void AddComponentIDWithName(int experiment_run_id, const std::string& name, int component_id);
+    void AddComponentInstanceIDWithGraphmlID(int experiment_run_id, const std::string& graphml_id, int component_instance_id);
+    void AddPortIDWithGraphmlID(int experiment_run_id, const std::string& graphml_id, int port_id);
+    void AddWorkerInstanceIDWithGraphmlID(int experiment_run_id, const std::string& graphml_id, int worker_instance_id);
+
+    IngestWorker::Metrics GetIngestMetrics(int experiment_run_id);
+    // Transactions opened on the run's own connection, ie. excluding CONFIGURE topology inserts
+    uint64_t GetDatabaseTransactionCount(int experiment_run_id);
+
 private:
     ExperimentRunInfo& GetExperimentRunInfo(int experiment_run_id);
+    // Called from the run's own writer thread once EndTime is written. Stops its receiver and moves it out of the
+    // run map, the worker can't join itself so the rest is torn down by the next ReapRetiredRuns
+    void RetireExperimentRun(int experiment_run_id);
+    // Joins the writer threads of retired runs and closes their connections
+    void ReapRetiredRuns();
+    int GetExistingExperimentRunID(int experiment_id, const std::string& start_time);
+    void LoadNodeIDCache(ExperimentRunInfo& run_info);
+    // Static so the drained task printing them doesn't depend on the tracker
+    static void PrintRunMetrics(
+        int experiment_run_id,
+        const IngestWorker::Metrics& metrics,
+        const SystemEventProtoHandler& system_handler,
+        const ModelEventProtoHandler& model_handler
+    );
+    static void PrintSequenceMetrics(int experiment_run_id, const std::string& event_name, const SequenceTracker::Metrics& metrics);
     
 
     std::shared_ptr<DatabaseClient> database_;
+    const std::string connection_string_;
+    const std::size_t pipeline_depth_;
+    const std::string spool_directory_;
+    const std::chrono::milliseconds port_event_rollup_interval_;
+    EventPartitioner event_partitioner_;
+    SchemaMigrator schema_migrator_;
     std::map<int, ExperimentRunInfo> experiment_run_map_;
+    std::vector<ExperimentRunInfo> retired_runs_;
     std::map<int, int> active_experiment_ids_;  // Maps ExperimentID -> current ExperimentRunID
 
     std::map<std::string, int> experiment_name_cache_; // Maps Experiment.Name to ExperimentID
 
     std::mutex access_mutex_;
+    std::mutex run_map_mutex_;
 };
 
 #endif
\ No newline at end of file
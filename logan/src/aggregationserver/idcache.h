@@ -0,0 +1,152 @@
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace AggServer {
+
+inline std::size_t HashCombine(std::size_t seed, std::size_t value) {
+    return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// Flat open addressing map from a key to a database row ID.
+// Each slot stores the key's precomputed hash so probing only compares keys on a full hash match.
+// Lookups never throw or allocate, a miss is reported as invalid_id.
+template <class Key, class Hash = std::hash<Key> >
+class IDCache {
+public:
+    static const int invalid_id = -1;
+
+    explicit IDCache(std::size_t initial_capacity = 64) {
+        std::size_t capacity = 8;
+        while (capacity < initial_capacity) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+    }
+
+    int Get(const Key& key) const {
+        const std::size_t hash = hasher_(key);
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t index = hash & mask; ; index = (index + 1) & mask) {
+            const Slot& slot = slots_[index];
+            if (slot.id == invalid_id) {
+                return invalid_id;
+            }
+            if (slot.hash == hash && slot.key == key) {
+                return slot.id;
+            }
+        }
+    }
+
+    bool Contains(const Key& key) const {
+        return Get(key) != invalid_id;
+    }
+
+    // Inserts or overwrites the ID associated with key, invalid IDs are ignored
+    void Insert(const Key& key, int id) {
+        if (id == invalid_id) {
+            return;
+        }
+        // Keep the load factor under 0.5 so probe sequences stay short
+        if ((size_ + 1) * 2 > slots_.size()) {
+            Grow();
+        }
+        InsertHashed(key, hasher_(key), id);
+    }
+
+    std::size_t Size() const {
+        return size_;
+    }
+
+    void Clear() {
+        for (auto& slot : slots_) {
+            slot = Slot();
+        }
+        size_ = 0;
+    }
+
+private:
+    struct Slot {
+        std::size_t hash = 0;
+        int id = invalid_id; // invalid_id marks an empty slot
+        Key key = Key();
+    };
+
+    void InsertHashed(const Key& key, std::size_t hash, int id) {
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t index = hash & mask; ; index = (index + 1) & mask) {
+            Slot& slot = slots_[index];
+            if (slot.id == invalid_id) {
+                slot.hash = hash;
+                slot.id = id;
+                slot.key = key;
+                size_++;
+                return;
+            }
+            if (slot.hash == hash && slot.key == key) {
+                slot.id = id;
+                return;
+            }
+        }
+    }
+
+    void Grow() {
+        std::vector<Slot> old_slots(slots_.size() * 2);
+        old_slots.swap(slots_);
+        size_ = 0;
+        for (const auto& slot : old_slots) {
+            if (slot.id != invalid_id) {
+                InsertHashed(slot.key, slot.hash, slot.id);
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::size_t size_ = 0;
+    Hash hasher_;
+};
+
+// Assigns small dense handles to strings, so composite keys can be built from integers instead of concatenated strings
+class StringInterner {
+public:
+    // Returns the existing handle for str, or assigns it the next free handle
+    int Intern(const std::string& str) {
+        int handle = handles_.Get(str);
+        if (handle == IDCache<std::string>::invalid_id) {
+            handle = next_handle_++;
+            strings_.push_back(str);
+            handles_.Insert(str, handle);
+        }
+        return handle;
+    }
+
+    // Returns IDCache::invalid_id if str has never been interned
+    int Find(const std::string& str) const {
+        return handles_.Get(str);
+    }
+
+    // The string a handle was assigned to, handle must have come from Intern
+    std::string Lookup(int handle) const {
+        return strings_.at(handle);
+    }
+
+private:
+    IDCache<std::string> handles_;
+    // Indexed by handle
+    std::vector<std::string> strings_;
+    int next_handle_ = 0;
+};
+
+// Packs two interned handles (ie. hostname and interface name) into a single integer key
+inline uint64_t MakeHandlePairKey(int first_handle, int second_handle) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(first_handle)) << 32) | static_cast<uint32_t>(second_handle);
+}
+
+}
+
+#endif //IDCACHE_H
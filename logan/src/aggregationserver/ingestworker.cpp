@@ -0,0 +1,344 @@
+#include "ingestworker.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <pqxx/pqxx>
+
+#include <google/protobuf/util/time_util.h>
+
+namespace {
+    // How long to wait before retrying the spool after the database connection drops
+    const std::chrono::seconds replay_retry_interval(1);
+}
+
+IngestWorker::IngestWorker(int experiment_run_id, std::size_t queue_capacity, const std::string& spool_directory) :
+    experiment_run_id_(experiment_run_id),
+    queue_capacity_(queue_capacity)
+{
+    if (!spool_directory.empty()) {
+        spool_ = std::unique_ptr<EventSpool>(new EventSpool(spool_directory));
+    }
+    writer_thread_ = std::thread(&IngestWorker::WriterLoop, this);
+}
+
+IngestWorker::~IngestWorker() {
+    Terminate();
+}
+
+bool IngestWorker::Enqueue(std::function<void()> task) {
+    return EnqueueMessage(std::move(task), nullptr, 0);
+}
+
+bool IngestWorker::EnqueueMessage(std::function<void()> task, std::shared_ptr<const google::protobuf::Message> message, int64_t publish_time_us) {
+    bool overflow = false;
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        if (terminate_) {
+            return false;
+        }
+        if (queue_.size() < queue_capacity_) {
+            dropping_ = false;
+            queue_.emplace_back(Task{std::move(task), message, publish_time_us});
+            if (queue_.size() > metrics_.peak_queue_depth) {
+                metrics_.peak_queue_depth = queue_.size();
+            }
+        } else if (spool_ && message) {
+            overflow = true;
+        } else {
+            // Only warn on the first drop of each burst, the total is tracked in the metrics
+            metrics_.dropped_count++;
+            if (!dropping_) {
+                dropping_ = true;
+                std::cerr << "Ingest queue for ExperimentRunID " << experiment_run_id_ << " is full ("
+                    << queue_capacity_ << " events), dropping events" << std::endl;
+            }
+            return false;
+        }
+    }
+
+    // The queue is full, push the overflow to disk outside of the queue lock and let the writer replay it once caught up
+    if (overflow && !Spool(*message)) {
+        return false;
+    }
+    queue_condition_.notify_one();
+    return true;
+}
+
+void IngestWorker::RegisterReplayCallback(const std::string& type_name, std::function<void(const std::string&)> callback) {
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    replay_callbacks_[type_name] = callback;
+}
+
+bool IngestWorker::Spool(const google::protobuf::Message& message) {
+    try {
+        spool_->Append(message.GetTypeName(), message.SerializeAsString());
+    } catch (const std::exception& ex) {
+        // Like a full queue, only warn on the first failure of each burst, the total is tracked in the metrics
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        metrics_.dropped_count++;
+        if (!spool_failing_) {
+            spool_failing_ = true;
+            std::cerr << "Failed to spool " << message.GetTypeName() << " for ExperimentRunID " << experiment_run_id_
+                << ", dropping events: " << ex.what() << std::endl;
+        }
+        return false;
+    }
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    spool_failing_ = false;
+    metrics_.spooled_count++;
+    return true;
+}
+
+std::function<void(bool)> IngestWorker::DeferCompletion() {
+    current_deferred_ = true;
+    auto message = current_message_;
+    const bool replayed = current_replayed_;
+    const int64_t publish_time_us = current_publish_time_us_;
+    return [this, message, replayed, publish_time_us](bool committed) {
+        CompleteDeferred(message, replayed, publish_time_us, committed);
+    };
+}
+
+void IngestWorker::MarkParked() {
+    current_parked_ = true;
+}
+
+void IngestWorker::CompleteDeferred(std::shared_ptr<const google::protobuf::Message> message, bool replayed, int64_t publish_time_us, bool committed) {
+    if (!committed && spool_ && message && Spool(*message)) {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        replay_after_ = std::chrono::steady_clock::now() + replay_retry_interval;
+        return;
+    }
+
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    if (!committed) {
+        metrics_.failed_count++;
+    } else if (replayed) {
+        metrics_.replayed_count++;
+    } else {
+        metrics_.processed_count++;
+        RecordLag(publish_time_us);
+    }
+}
+
+int64_t IngestWorker::ToMicroseconds(const google::protobuf::Timestamp& timestamp) {
+    return google::protobuf::util::TimeUtil::TimestampToMicroseconds(timestamp);
+}
+
+void IngestWorker::RecordLag(int64_t publish_time_us) {
+    if (publish_time_us <= 0) {
+        return;
+    }
+    const int64_t now_us = ToMicroseconds(google::protobuf::util::TimeUtil::GetCurrentTime());
+    // Publishers' clocks can run ahead of ours
+    const std::chrono::microseconds lag(std::max<int64_t>(0, now_us - publish_time_us));
+    metrics_.last_lag = lag;
+    if (lag > metrics_.max_lag) {
+        metrics_.max_lag = lag;
+    }
+    total_lag_ += lag;
+    lag_count_++;
+    metrics_.mean_lag = std::chrono::microseconds(total_lag_.count() / lag_count_);
+}
+
+void IngestWorker::SetIdleCallback(std::function<void()> idle_callback) {
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    idle_callback_ = idle_callback;
+}
+
+void IngestWorker::EnqueueWhenDrained(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        drained_tasks_.push_back(std::move(task));
+    }
+    queue_condition_.notify_one();
+}
+
+IngestWorker::Metrics IngestWorker::GetMetrics() const {
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    Metrics metrics = metrics_;
+    metrics.queue_depth = queue_.size();
+    return metrics;
+}
+
+void IngestWorker::Terminate() {
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        terminate_ = true;
+    }
+    queue_condition_.notify_all();
+    if (writer_thread_.joinable()) {
+        writer_thread_.join();
+    }
+}
+
+bool IngestWorker::IsSpoolReady() const {
+    return spool_ && std::chrono::steady_clock::now() >= replay_after_ && !spool_->Empty();
+}
+
+bool IngestWorker::IsDrained() const {
+    return queue_.empty() && (!spool_ || spool_->Empty());
+}
+
+void IngestWorker::RunIdleCallback() {
+    std::function<void()> idle_callback;
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        if (queue_.empty()) {
+            idle_callback = idle_callback_;
+        }
+    }
+
+    if (idle_callback) {
+        try {
+            idle_callback();
+        } catch (const std::exception& ex) {
+            std::cerr << "An exception occurred in the idle callback for ExperimentRunID " << experiment_run_id_ << ": " << ex.what() << std::endl;
+        }
+    }
+}
+
+void IngestWorker::ReplaySpooledEvent() {
+    EventSpool::Frame frame;
+    if (!spool_->Peek(frame)) {
+        return;
+    }
+
+    std::function<void(const std::string&)> replay_callback;
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        const auto& callback_it = replay_callbacks_.find(frame.type_name);
+        if (callback_it != replay_callbacks_.end()) {
+            replay_callback = callback_it->second;
+        }
+    }
+
+    bool success = false;
+    current_replayed_ = true;
+    current_publish_time_us_ = 0;
+    current_deferred_ = false;
+    current_parked_ = false;
+    try {
+        if (!replay_callback) {
+            throw std::runtime_error("No handler registered for spooled " + frame.type_name);
+        }
+        replay_callback(frame.payload);
+        success = true;
+    } catch (const pqxx::broken_connection& ex) {
+        // Leave the frame in the spool and try again later
+        current_message_.reset();
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        replay_after_ = std::chrono::steady_clock::now() + replay_retry_interval;
+        return;
+    } catch (const std::exception& ex) {
+        std::cerr << "An exception occurred while replaying a spooled event for ExperimentRunID " << experiment_run_id_ << ": " << ex.what() << std::endl;
+    }
+    current_message_.reset();
+
+    // A deferred write holds its own copy of the event and counts it once resolved
+    spool_->Pop();
+    if (success && current_deferred_) {
+        return;
+    }
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    if (success && current_parked_) {
+        metrics_.parked_count++;
+    } else if (success) {
+        metrics_.replayed_count++;
+    } else {
+        metrics_.failed_count++;
+    }
+}
+
+void IngestWorker::WriterLoop() {
+    while (true) {
+        Task task;
+        bool replay = false;
+        std::vector<std::function<void()> > drained_tasks;
+        {
+            std::unique_lock<std::mutex> queue_lock(queue_mutex_);
+            while (!terminate_ && queue_.empty() && !IsSpoolReady() && !(IsDrained() && !drained_tasks_.empty())) {
+                if (spool_ && !spool_->Empty()) {
+                    queue_condition_.wait_until(queue_lock, replay_after_);
+                } else {
+                    queue_condition_.wait(queue_lock);
+                }
+            }
+            if (IsDrained() && !drained_tasks_.empty()) {
+                drained_tasks.swap(drained_tasks_);
+            } else if (queue_.empty()) {
+                if (terminate_) {
+                    // Anything enqueued beforehand has been drained, spooled events are left on disk for the next process
+                    return;
+                }
+                // Live events always go first, the spool is only drained while the queue is empty
+                replay = true;
+            } else {
+                task = std::move(queue_.front());
+                queue_.pop_front();
+            }
+        }
+
+        if (!drained_tasks.empty()) {
+            // Anything still batched is committed first, a write failing there spools its event so these wait again
+            RunIdleCallback();
+            if (spool_ && !spool_->Empty()) {
+                std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+                drained_tasks_.insert(drained_tasks_.begin(), drained_tasks.begin(), drained_tasks.end());
+                continue;
+            }
+            for (const auto& drained_task : drained_tasks) {
+                try {
+                    drained_task();
+                } catch (const std::exception& ex) {
+                    std::cerr << "An exception occurred while running a drained task for ExperimentRunID " << experiment_run_id_ << ": " << ex.what() << std::endl;
+                }
+            }
+            continue;
+        }
+
+        if (replay) {
+            ReplaySpooledEvent();
+        } else {
+            bool success = true;
+            bool spooled = false;
+            current_message_ = task.message;
+            current_replayed_ = false;
+            current_publish_time_us_ = task.publish_time_us;
+            current_deferred_ = false;
+            current_parked_ = false;
+            try {
+                task.function();
+            } catch (const pqxx::broken_connection& ex) {
+                if (spool_ && task.message) {
+                    spooled = Spool(*task.message);
+                    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+                    replay_after_ = std::chrono::steady_clock::now() + replay_retry_interval;
+                }
+                if (!spooled) {
+                    success = false;
+                    std::cerr << "Lost database connection while writing an event for ExperimentRunID " << experiment_run_id_ << ": " << ex.what() << std::endl;
+                }
+            } catch (const std::exception& ex) {
+                success = false;
+                std::cerr << "An exception occurred while writing an event for ExperimentRunID " << experiment_run_id_ << ": " << ex.what() << std::endl;
+            }
+
+            current_message_.reset();
+
+            std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+            // A deferred event is counted by CompleteDeferred once its writes are resolved
+            if (success && !spooled && current_parked_) {
+                metrics_.parked_count++;
+            } else if (success && !spooled && !current_deferred_) {
+                metrics_.processed_count++;
+                RecordLag(task.publish_time_us);
+            } else if (!success) {
+                metrics_.failed_count++;
+            }
+        }
+
+        RunIdleCallback();
+    }
+}
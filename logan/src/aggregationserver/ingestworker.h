@@ -0,0 +1,155 @@
+#ifndef INGESTWORKER_H
+#define INGESTWORKER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/message.h>
+#include <google/protobuf/timestamp.pb.h>
+
+#include "eventspool.h"
+
+// Bounded queue + writer thread owned by a single experiment run.
+// ZMQ receive threads only copy messages into the queue; all database work happens on the writer thread.
+// With a spool directory, events that overflow the queue or fail because the database connection is down are appended
+// to an on disk EventSpool instead of being lost, and replayed by the writer thread whenever the live queue is empty.
+class IngestWorker {
+public:
+    struct Metrics {
+        std::size_t queue_depth = 0;
+        std::size_t peak_queue_depth = 0;
+        uint64_t processed_count = 0;
+        uint64_t failed_count = 0;
+        uint64_t dropped_count = 0;
+        uint64_t spooled_count = 0;
+        uint64_t replayed_count = 0;
+        // Set aside by their handler rather than written, ie. a StatusEvent waiting on its host's InfoEvent. Whether they
+        // are later written or dropped is counted by that handler
+        uint64_t parked_count = 0;
+        // Time from an event being published (its own timestamp) to its write committing, live events only
+        std::chrono::microseconds last_lag{0};
+        std::chrono::microseconds max_lag{0};
+        std::chrono::microseconds mean_lag{0};
+    };
+
+    // An empty spool_directory disables spooling, overflowing events are then dropped
+    IngestWorker(int experiment_run_id, std::size_t queue_capacity = default_queue_capacity, const std::string& spool_directory = "");
+    ~IngestWorker();
+
+    // Returns false if the queue is full and the task was dropped, never blocks on the writer
+    bool Enqueue(std::function<void()> task);
+
+    // Wraps a proto callback so that the message is copied on the receive thread and processed on the writer thread.
+    // publish_time reads the time the message was published, which the lag metrics are measured from.
+    template <class ProtoType>
+    std::function<void (const ProtoType&)> Wrap(
+        std::function<void (const ProtoType&)> callback,
+        std::function<google::protobuf::Timestamp (const ProtoType&)> publish_time = nullptr
+    ) {
+        RegisterReplayCallback(ProtoType::default_instance().GetTypeName(), [this, callback](const std::string& payload) {
+            auto message = std::make_shared<ProtoType>();
+            if (!message->ParseFromString(payload)) {
+                throw std::runtime_error("Failed to parse spooled " + ProtoType::default_instance().GetTypeName());
+            }
+            // Kept so a deferred write of the replayed event can spool it again
+            current_message_ = message;
+            callback(*message);
+        });
+
+        return [this, callback, publish_time](const ProtoType& message) {
+            auto message_copy = std::make_shared<ProtoType>(message);
+            EnqueueMessage([callback, message_copy]() {
+                callback(*message_copy);
+            }, message_copy, publish_time ? ToMicroseconds(publish_time(message)) : 0);
+        };
+    }
+
+    // For events whose writes commit after the task returns, ie. through a pipelined DatabaseClient. Called from within
+    // the task, the result is handed to the write as its callback: the event is only counted once the write has
+    // committed, and a failed write sends the event back through the spool (or counts it as failed without one).
+    std::function<void(bool)> DeferCompletion();
+
+    // For events the task sets aside rather than writes. Called from within the task, the event is counted as parked
+    // instead of written and is neither spooled nor retried by the worker.
+    void MarkParked();
+
+    // Called on the writer thread whenever the queue runs dry, ie. to flush writes that were batched while busy
+    void SetIdleCallback(std::function<void()> idle_callback);
+
+    // Runs task on the writer thread once everything queued before it has been written: the queue and spool are empty
+    // and the idle callback has committed anything batched. Discarded if the worker terminates with events still spooled.
+    void EnqueueWhenDrained(std::function<void()> task);
+
+    Metrics GetMetrics() const;
+
+    // Drains any queued events then stops the writer thread, anything still spooled stays on disk
+    void Terminate();
+
+    static const std::size_t default_queue_capacity = 100000;
+
+private:
+    struct Task {
+        std::function<void()> function;
+        // Only set for proto messages, which are the only tasks that can be spooled
+        std::shared_ptr<const google::protobuf::Message> message;
+        // Microseconds since the epoch, 0 if unknown
+        int64_t publish_time_us;
+    };
+
+    bool EnqueueMessage(std::function<void()> task, std::shared_ptr<const google::protobuf::Message> message, int64_t publish_time_us);
+    static int64_t ToMicroseconds(const google::protobuf::Timestamp& timestamp);
+    // Call with queue_mutex_ held, once a live event's write has committed
+    void RecordLag(int64_t publish_time_us);
+    void RegisterReplayCallback(const std::string& type_name, std::function<void(const std::string&)> callback);
+    bool Spool(const google::protobuf::Message& message);
+    void CompleteDeferred(std::shared_ptr<const google::protobuf::Message> message, bool replayed, int64_t publish_time_us, bool committed);
+    void ReplaySpooledEvent();
+    // Call with queue_mutex_ held
+    bool IsSpoolReady() const;
+    bool IsDrained() const;
+    void RunIdleCallback();
+    void WriterLoop();
+
+    const int experiment_run_id_;
+    const std::size_t queue_capacity_;
+
+    mutable std::mutex queue_mutex_;
+    std::condition_variable queue_condition_;
+    std::deque<Task> queue_;
+    bool terminate_ = false;
+    bool dropping_ = false;
+    bool spool_failing_ = false;
+
+    std::unique_ptr<EventSpool> spool_;
+    std::map<std::string, std::function<void(const std::string&)> > replay_callbacks_;
+    // Spool replay is paused until this time after the database connection fails
+    std::chrono::steady_clock::time_point replay_after_;
+
+    std::function<void()> idle_callback_;
+    std::vector<std::function<void()> > drained_tasks_;
+
+    // The event being written, only touched by the writer thread
+    std::shared_ptr<const google::protobuf::Message> current_message_;
+    bool current_replayed_ = false;
+    int64_t current_publish_time_us_ = 0;
+    bool current_deferred_ = false;
+    bool current_parked_ = false;
+
+    Metrics metrics_;
+    std::chrono::microseconds total_lag_{0};
+    uint64_t lag_count_ = 0;
+
+    std::thread writer_thread_;
+};
+
+#endif //INGESTWORKER_H
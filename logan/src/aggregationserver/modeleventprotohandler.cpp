@@ -16,10 +16,21 @@
 
 using google::protobuf::util::TimeUtil;
 
-void ModelEventProtoHandler::BindCallbacks(zmq::ProtoReceiver& receiver) {    
-    receiver.RegisterProtoCallback<ModelEvent::LifecycleEvent>(std::bind(&ModelEventProtoHandler::ProcessLifecycleEvent, this, std::placeholders::_1));
-    receiver.RegisterProtoCallback<ModelEvent::WorkloadEvent>(std::bind(&ModelEventProtoHandler::ProcessWorkloadEvent, this, std::placeholders::_1));
-    receiver.RegisterProtoCallback<ModelEvent::UtilizationEvent>(std::bind(&ModelEventProtoHandler::ProcessUtilizationEvent, this, std::placeholders::_1));
+void ModelEventProtoHandler::BindCallbacks(zmq::ProtoReceiver& receiver) {
+    // Events are handed off to the run's writer thread so the receiver never waits on the database,
+    // their info timestamp is when they were published
+    receiver.RegisterProtoCallback<ModelEvent::LifecycleEvent>(ingest_worker_.Wrap<ModelEvent::LifecycleEvent>(
+        std::bind(&ModelEventProtoHandler::ProcessLifecycleEvent, this, std::placeholders::_1),
+        [](const ModelEvent::LifecycleEvent& message) { return message.info().timestamp(); }
+    ));
+    receiver.RegisterProtoCallback<ModelEvent::WorkloadEvent>(ingest_worker_.Wrap<ModelEvent::WorkloadEvent>(
+        std::bind(&ModelEventProtoHandler::ProcessWorkloadEvent, this, std::placeholders::_1),
+        [](const ModelEvent::WorkloadEvent& message) { return message.info().timestamp(); }
+    ));
+    receiver.RegisterProtoCallback<ModelEvent::UtilizationEvent>(ingest_worker_.Wrap<ModelEvent::UtilizationEvent>(
+        std::bind(&ModelEventProtoHandler::ProcessUtilizationEvent, this, std::placeholders::_1),
+        [](const ModelEvent::UtilizationEvent& message) { return message.info().timestamp(); }
+    ));
 }
 
 void ModelEventProtoHandler::ProcessLifecycleEvent(const ModelEvent::LifecycleEvent& message){
@@ -29,6 +40,8 @@ void ModelEventProtoHandler::ProcessLifecycleEvent(const ModelEvent::LifecycleEv
                 InsertPortLifecycleEvent(message.info(), message.type(), message.component(), message.port());
             } catch (const std::exception& e) {
                 std::cerr << "An exception occured while trying to insert a PortLifecycleEvent: " << e.what() << std::endl;
+                // Rethrown so the ingest worker can count it, or spool it if the database went away
+                throw;
             }
         } else {
             InsertComponentLifecycleEvent(message.info(), message.type(), message.component());
@@ -40,40 +53,66 @@ void ModelEventProtoHandler::ProcessLifecycleEvent(const ModelEvent::LifecycleEv
 void ModelEventProtoHandler::ProcessWorkloadEvent(const ModelEvent::WorkloadEvent& message) {
     //std::cerr << "ProcessWorkloadEvent" << std::endl;
 
-    std::string worker_instance_id = std::to_string(GetWorkerInstanceID(message.component(), message.worker()));
-    std::string function = message.function_name();
-    std::string workload_id = std::to_string(message.workload_id());
-    std::string type = ModelEvent::WorkloadEvent::Type_Name(message.event_type());
-    std::string args = message.args();
-    std::string log_level = std::to_string(message.log_level());
-    std::string sample_time = TimeUtil::ToString(message.info().timestamp());
+    int worker_instance_id = GetWorkerInstanceID(message.component(), message.worker());
+    const DatabaseValue sample_time(message.info().timestamp());
 
-    database_->InsertValues(
+    database_->InsertRow(
         "WorkloadEvent",
-        {"WorkerInstanceID", "WorkloadID", "Function", "Type", "Arguments", "LogLevel", "SampleTime"},
-        {worker_instance_id, workload_id, function, type, args, log_level, sample_time}
+        {"ExperimentRunID", "WorkerInstanceID", "WorkloadID", "Function", "Type", "Arguments", "LogLevel", "SampleTime"},
+        {experiment_run_id_, worker_instance_id, message.workload_id(), message.function_name(), static_cast<int>(message.event_type()), message.args(), message.log_level(), sample_time},
+        experiment_run_id_,
+        sample_time,
+        ingest_worker_.DeferCompletion()
     );
-    database_->UpdateLastSampleTime(experiment_run_id_, sample_time);
 }
 
 void ModelEventProtoHandler::ProcessUtilizationEvent(const ModelEvent::UtilizationEvent& message) {
-    auto start = std::chrono::steady_clock::now();
-
-    std::string port_id = std::to_string(GetPortID(message.port(), message.component()));
+    // port_event_id is numbered per port, replays after a reconnect are dropped here rather than written twice
+    if (!port_event_sequences_.Observe(message.port().id(), message.port_event_id())) {
+        return;
+    }
 
-    auto port_id_aquired_time = std::chrono::steady_clock::now();
+    auto start = std::chrono::steady_clock::now();
+    auto port_id_aquired_time = start;
 
-    std::string seq_num = std::to_string(message.port_event_id());
-    std::string type = ModelEvent::UtilizationEvent::Type_Name(message.type());
-    std::string msg = message.message();
-    std::string sample_time = TimeUtil::ToString(message.info().timestamp());
+    int port_id = -1;
+    const std::string& type = ModelEvent::UtilizationEvent::Type_Name(message.type());
+    const DatabaseValue sample_time(message.info().timestamp());
 
-    database_->InsertValues(
-        "PortEvent",
-        {"PortID", "PortEventSequenceNum", "Type", "Message", "SampleTime"},
-        {port_id, seq_num, type, msg, sample_time}
-    );
-    database_->UpdateLastSampleTime(experiment_run_id_, sample_time);
+    try {
+        port_id = GetPortID(message.port(), message.component());
+
+        port_id_aquired_time = std::chrono::steady_clock::now();
+
+        const auto complete = ingest_worker_.DeferCompletion();
+        const std::string port_graphml_id = message.port().id();
+        const int64_t port_event_id = message.port_event_id();
+        const google::protobuf::Timestamp timestamp = message.info().timestamp();
+        database_->InsertRow(
+            "PortEvent",
+            {"ExperimentRunID", "PortID", "PortEventSequenceNum", "Type", "Message", "SampleTime"},
+            {experiment_run_id_, port_id, message.port_event_id(), type, message.message(), sample_time},
+            experiment_run_id_,
+            sample_time,
+            [this, complete, port_graphml_id, port_id, type, port_event_id, timestamp](bool committed) {
+                if (!committed) {
+                    // Handed back to the ingest worker, so its replay has to be let through
+                    port_event_sequences_.Forget(port_graphml_id, port_event_id);
+                } else if (port_event_rollup_) {
+                    // Only rolled up once committed, so a spooled retry of this event isn't counted twice
+                    port_event_rollup_->Add(port_id, type, port_event_id, timestamp);
+                    if (port_event_rollup_->HasCompletedIntervals()) {
+                        WritePortEventRollup(false);
+                    }
+                }
+                complete(committed);
+            }
+        );
+    } catch (const std::exception& e) {
+        // Not written, so a spooled replay of this event has to be let through
+        port_event_sequences_.Forget(message.port().id(), message.port_event_id());
+        throw;
+    }
 
     auto finish = std::chrono::steady_clock::now();
     auto id_delay = std::chrono::duration_cast<std::chrono::microseconds>(port_id_aquired_time - start);
@@ -87,16 +126,17 @@ void ModelEventProtoHandler::InsertComponentLifecycleEvent(const ModelEvent::Inf
                 const ModelEvent::Component& component) {
                 
 
-    std::string component_instance_id = std::to_string(GetComponentInstanceID(component));
-    std::string sample_time = TimeUtil::ToString(info.timestamp());
-    std::string type_string = std::to_string(type);
+    int component_instance_id = GetComponentInstanceID(component);
+    const DatabaseValue sample_time(info.timestamp());
 
-    database_->InsertValues(
+    database_->InsertRow(
         "ComponentLifecycleEvent",
-        {"ComponentInstanceID", "SampleTime", "Type"},
-        {component_instance_id, sample_time, type_string}
+        {"ExperimentRunID", "ComponentInstanceID", "SampleTime", "Type"},
+        {experiment_run_id_, component_instance_id, sample_time, static_cast<int>(type)},
+        experiment_run_id_,
+        sample_time,
+        ingest_worker_.DeferCompletion()
     );
-    database_->UpdateLastSampleTime(experiment_run_id_, sample_time);
 }
 
 void ModelEventProtoHandler::InsertPortLifecycleEvent(const ModelEvent::Info& info,
@@ -105,88 +145,191 @@ void ModelEventProtoHandler::InsertPortLifecycleEvent(const ModelEvent::Info& in
                 const ModelEvent::Port& port) {
 
 
-    std::string port_id = std::to_string(GetPortID(port, component));
-    std::string sample_time = TimeUtil::ToString(info.timestamp());
-    std::string type_string = std::to_string(type);
+    int port_id = GetPortID(port, component);
+    const DatabaseValue sample_time(info.timestamp());
 
-    database_->InsertValues(
+    database_->InsertRow(
         "PortLifecycleEvent",
-        {"PortID", "SampleTime", "Type"},
-        {port_id, sample_time, type_string}
+        {"ExperimentRunID", "PortID", "SampleTime", "Type"},
+        {experiment_run_id_, port_id, sample_time, static_cast<int>(type)},
+        experiment_run_id_,
+        sample_time,
+        ingest_worker_.DeferCompletion()
     );
-    database_->UpdateLastSampleTime(experiment_run_id_, sample_time);
 }
 
 
 
-int ModelEventProtoHandler::GetComponentInstanceID(const ModelEvent::Component& component_instance) {
+void ModelEventProtoHandler::EnablePortEventRollup(std::chrono::microseconds interval) {
+    port_event_rollup_ = std::unique_ptr<PortEventRollup>(new PortEventRollup(experiment_run_id_, interval));
+}
+
+void ModelEventProtoHandler::FlushPortEventRollup() {
+    if (port_event_rollup_) {
+        ingest_worker_.Enqueue([this]() {
+            WritePortEventRollup(true);
+        });
+    }
+}
+
+void ModelEventProtoHandler::WritePortEventRollup(bool include_open) {
+    const auto& rollup_rows = port_event_rollup_->GetRows(include_open);
+    if (rollup_rows.rows.empty()) {
+        return;
+    }
     try {
-        return component_inst_id_cache_.at(component_instance.id());
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "ComponentInstance ID cache miss\n";
-        int component_id = GetComponentID(component_instance.type());
+        database_->InsertMultipleValues({rollup_rows}, experiment_run_id_, DatabaseValue());
+        port_event_rollup_->DiscardRows(include_open);
+    } catch (const std::exception& e) {
+        // Intervals are kept and retried with the next completed interval, the raw PortEvents are already written
+        std::cerr << "An exception occured while trying to write " << rollup_rows.rows.size() << " PortEventRollup rows: " << e.what() << std::endl;
+    }
+}
+
+SequenceTracker::Metrics ModelEventProtoHandler::GetSequenceMetrics() const {
+    return port_event_sequences_.GetMetrics();
+}
+
+void ModelEventProtoHandler::AddComponentID(const std::string& name, int component_id) {
+    std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+    component_id_cache_.Insert(name, component_id);
+}
+
+void ModelEventProtoHandler::AddComponentInstanceID(const std::string& graphml_id, int component_instance_id) {
+    std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+    component_inst_id_cache_.Insert(graphml_id, component_instance_id);
+}
+
+void ModelEventProtoHandler::AddPortID(const std::string& graphml_id, int port_id) {
+    std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+    port_id_cache_.Insert(graphml_id, port_id);
+}
+
+void ModelEventProtoHandler::AddWorkerInstanceID(const std::string& graphml_id, int worker_instance_id) {
+    std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+    worker_inst_id_cache_.Insert(graphml_id, worker_instance_id);
+}
 
-        std::string&& comp_id = database_->EscapeString(std::to_string(component_id));
-        std::string&& graphml_id = database_->EscapeString(component_instance.id()); // Graphml ID, not database row ID
+void ModelEventProtoHandler::LoadIDCaches() {
+    // Every query filters on the run alone, so they share the one parameter
+    DatabaseClient::QueryParameters params;
+    const std::string run_id = params.Add(experiment_run_id_);
 
-        std::stringstream condition_stream;
-        condition_stream << "ComponentID = " << comp_id << " AND GraphmlID = " << graphml_id;
+    const auto& component_results = database_->GetValues(
+        "Component",
+        {"Name", "ComponentID"},
+        "ExperimentRunID = " + run_id,
+        params
+    );
+    const auto& component_inst_results = database_->GetValues(
+        "ComponentInstance INNER JOIN Component ON ComponentInstance.ComponentID = Component.ComponentID",
+        {"ComponentInstance.GraphmlID", "ComponentInstance.ComponentInstanceID"},
+        "Component.ExperimentRunID = " + run_id,
+        params
+    );
+    const auto& port_results = database_->GetValues(
+        "Port INNER JOIN ComponentInstance ON Port.ComponentInstanceID = ComponentInstance.ComponentInstanceID"
+        " INNER JOIN Component ON ComponentInstance.ComponentID = Component.ComponentID",
+        {"Port.GraphmlID", "Port.PortID"},
+        "Component.ExperimentRunID = " + run_id,
+        params
+    );
+    const auto& worker_inst_results = database_->GetValues(
+        "WorkerInstance INNER JOIN Worker ON WorkerInstance.WorkerID = Worker.WorkerID",
+        {"WorkerInstance.GraphmlID", "WorkerInstance.WorkerInstanceID"},
+        "Worker.ExperimentRunID = " + run_id,
+        params
+    );
 
-        int component_inst_id = database_->GetID("ComponentInstance", condition_stream.str());
-        component_inst_id_cache_.emplace(std::make_pair(component_instance.id(), component_inst_id));
-        return component_inst_id;
+    // Columns are selected as (key, id) pairs
+    std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+    for (const auto& row : component_results) {
+        component_id_cache_.Insert(row[0].as<std::string>(), row[1].as<int>());
+    }
+    for (const auto& row : component_inst_results) {
+        component_inst_id_cache_.Insert(row[0].as<std::string>(), row[1].as<int>());
+    }
+    for (const auto& row : port_results) {
+        port_id_cache_.Insert(row[0].as<std::string>(), row[1].as<int>());
+    }
+    for (const auto& row : worker_inst_results) {
+        worker_inst_id_cache_.Insert(row[0].as<std::string>(), row[1].as<int>());
     }
 }
 
+int ModelEventProtoHandler::GetComponentInstanceID(const ModelEvent::Component& component_instance) {
+    {
+        std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+        const int cached_id = component_inst_id_cache_.Get(component_instance.id());
+        if (cached_id != AggServer::IDCache<std::string>::invalid_id) {
+            return cached_id;
+        }
+    }
+
+    // Caches are filled during CONFIGURE, a miss here is only expected for late or unregistered entities
+    int component_id = GetComponentID(component_instance.type());
+
+    // Graphml ID, not database row ID
+    DatabaseClient::QueryParameters params;
+    const std::string condition = "ComponentID = " + params.Add(component_id) + " AND GraphmlID = " + params.Add(component_instance.id());
+
+    int component_inst_id = database_->GetID("ComponentInstance", condition, params);
+    AddComponentInstanceID(component_instance.id(), component_inst_id);
+    return component_inst_id;
+}
+
 
 int ModelEventProtoHandler::GetPortID(const ModelEvent::Port& port, const ModelEvent::Component& component) {
-    try {
-        return port_id_cache_.at(port.id());
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "Port ID cache miss\n";
-        int component_instance_id = GetComponentInstanceID(component);
-        
-        std::string&& comp_inst_id = database_->EscapeString(std::to_string(component_instance_id));
-        std::string&& name = database_->EscapeString(port.name());
-
-        std::stringstream condition_stream;
-        condition_stream << "ComponentInstanceID = " << comp_inst_id << " AND Name = " << name;
-
-        int port_id = database_->GetID("Port", condition_stream.str());
-        port_id_cache_.emplace(std::make_pair(port.id(), port_id));
-        return port_id;
+    {
+        std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+        const int cached_id = port_id_cache_.Get(port.id());
+        if (cached_id != AggServer::IDCache<std::string>::invalid_id) {
+            return cached_id;
+        }
     }
+
+    int component_instance_id = GetComponentInstanceID(component);
+    
+    DatabaseClient::QueryParameters params;
+    const std::string condition = "ComponentInstanceID = " + params.Add(component_instance_id) + " AND Name = " + params.Add(port.name());
+
+    int port_id = database_->GetID("Port", condition, params);
+    AddPortID(port.id(), port_id);
+    return port_id;
 }
 
 int ModelEventProtoHandler::GetWorkerInstanceID(const ModelEvent::Component& component, const ModelEvent::Worker& worker_instance) {
-    try {
-        return worker_inst_id_cache_.at(worker_instance.id());
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "WrokerInstance ID cache miss\n";
-        int component_instance_id = GetComponentInstanceID(component);
+    {
+        std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+        const int cached_id = worker_inst_id_cache_.Get(worker_instance.id());
+        if (cached_id != AggServer::IDCache<std::string>::invalid_id) {
+            return cached_id;
+        }
+    }
 
-        std::string&& comp_inst_id = database_->EscapeString(std::to_string(component_instance_id));
-        std::string&& name = database_->EscapeString(worker_instance.name());
+    int component_instance_id = GetComponentInstanceID(component);
 
-        std::stringstream condition_stream;
-        condition_stream << "ComponentInstanceID = " << comp_inst_id << " AND Name = " << name;
+    DatabaseClient::QueryParameters params;
+    const std::string condition = "ComponentInstanceID = " + params.Add(component_instance_id) + " AND Name = " + params.Add(worker_instance.name());
 
-        int worker_inst_id = database_->GetID("WorkerInstance", condition_stream.str());
-        worker_inst_id_cache_.emplace(std::make_pair(worker_instance.id(), worker_inst_id));
-        return worker_inst_id;
-    }
+    int worker_inst_id = database_->GetID("WorkerInstance", condition, params);
+    AddWorkerInstanceID(worker_instance.id(), worker_inst_id);
+    return worker_inst_id;
 }
 
 int ModelEventProtoHandler::GetComponentID(const std::string& name) {
-    try {
-        return component_id_cache_.at(name);
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "Component ID cache miss\n";
-        std::stringstream condition_stream;
-        condition_stream << "Name = " << database_->EscapeString(name) << " AND ExperimentRunID = " << experiment_run_id_;
-
-        int component_id = database_->GetID("Component", condition_stream.str());
-        component_id_cache_.emplace(std::make_pair(name, component_id));
-        return component_id;
+    {
+        std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+        const int cached_id = component_id_cache_.Get(name);
+        if (cached_id != AggServer::IDCache<std::string>::invalid_id) {
+            return cached_id;
+        }
     }
+
+    DatabaseClient::QueryParameters params;
+    const std::string condition = "Name = " + params.Add(name) + " AND ExperimentRunID = " + params.Add(experiment_run_id_);
+
+    int component_id = database_->GetID("Component", condition, params);
+    AddComponentID(name, component_id);
+    return component_id;
 }
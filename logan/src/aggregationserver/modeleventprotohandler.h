@@ -2,18 +2,39 @@
 #define MODELEVENTPROTOHANDLER_H
 
 #include "aggregationprotohandler.h"
+#include "ingestworker.h"
+#include "idcache.h"
+#include "sequencetracker.h"
+#include "porteventrollup.h"
 
 #include <proto/modelevent/modelevent.pb.h>
 
-#include <map>
+#include <mutex>
 
 class ModelEventProtoHandler : public AggregationProtoHandler {
 public:
-    ModelEventProtoHandler(std::shared_ptr<DatabaseClient> db_client, ExperimentTracker& exp_tracker, int experiment_run_id)
-        : AggregationProtoHandler(db_client, exp_tracker), experiment_run_id_(experiment_run_id) {};
+    ModelEventProtoHandler(std::shared_ptr<DatabaseClient> db_client, ExperimentTracker& exp_tracker, int experiment_run_id, IngestWorker& ingest_worker)
+        : AggregationProtoHandler(db_client, exp_tracker), experiment_run_id_(experiment_run_id), ingest_worker_(ingest_worker) {};
 
     void BindCallbacks(zmq::ProtoReceiver& ProtoReceiver);
 
+    // ID cache population, safe to call from outside of the run's writer thread
+    void AddComponentID(const std::string& name, int component_id);
+    void AddComponentInstanceID(const std::string& graphml_id, int component_instance_id);
+    void AddPortID(const std::string& graphml_id, int port_id);
+    void AddWorkerInstanceID(const std::string& graphml_id, int worker_instance_id);
+
+    // Reloads every ID cache with a single query per table, used when resuming an existing experiment run
+    void LoadIDCaches();
+
+    // Duplicate and gap counts for UtilizationEvents, tracked per port
+    SequenceTracker::Metrics GetSequenceMetrics() const;
+
+    // Keeps per port PortEventRollup rows alongside the raw PortEvent rows, must be called before BindCallbacks
+    void EnablePortEventRollup(std::chrono::microseconds interval);
+    // Queues a write of every rollup interval on the writer thread, including those still open
+    void FlushPortEventRollup();
+
 private:
     // Model callbacks
     //void ProcessUserEvent(const ModelEvent::UserEvent& message);
@@ -31,6 +52,8 @@ private:
             const ModelEvent::Component& component,
             const ModelEvent::Port& port);
 
+    void WritePortEventRollup(bool include_open);
+
     // ID retrieval helpers
     int GetComponentID(const std::string& name);
     int GetComponentInstanceID(const ModelEvent::Component& component_instance);
@@ -39,11 +62,16 @@ private:
 
 
     int experiment_run_id_;
+    IngestWorker& ingest_worker_;
+
+    SequenceTracker port_event_sequences_;
+    std::unique_ptr<PortEventRollup> port_event_rollup_;
 
-    std::map<std::string, int> component_id_cache_;
-    std::map<std::string, int> component_inst_id_cache_;
-    std::map<std::string, int> port_id_cache_;
-    std::map<std::string, int> worker_inst_id_cache_;
+    std::mutex cache_mutex_;
+    AggServer::IDCache<std::string> component_id_cache_;
+    AggServer::IDCache<std::string> component_inst_id_cache_;
+    AggServer::IDCache<std::string> port_id_cache_;
+    AggServer::IDCache<std::string> worker_inst_id_cache_;
 };
 
 #endif
\ No newline at end of file
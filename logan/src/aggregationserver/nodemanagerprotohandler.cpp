@@ -46,8 +46,13 @@ void NodeManagerProtoHandler::ProcessConfigureControlMessage(const NodeManager::
         case NodeManager::ControlMessage::CONFIGURE: {
             int experiment_run_id = experiment_tracker_.RegisterExperimentRun(message.experiment_id(), message.timestamp());
             
-            for (const auto& node : message.nodes()) {
-                ProcessNode(node, experiment_run_id);
+            const auto& containers = ProcessNodes(message, experiment_run_id);
+            std::vector<const NodeManager::Logger*> loggers;
+            ProcessComponents(ProcessContainers(containers, loggers), experiment_run_id);
+
+            // Every component, port and worker is now written and cached, so events from the loggers can be resolved
+            for (const auto& logger : loggers) {
+                ProcessLogger(*logger, experiment_run_id);
             }
             break;
         }
@@ -70,43 +75,58 @@ void NodeManagerProtoHandler::ProcessShutdownControlMessage(const NodeManager::C
     }
 }
 
-void NodeManagerProtoHandler::ProcessNode(const NodeManager::Node& message, int experiment_run_id) {
-    std::string hostname = message.info().name();
-    std::string ip = message.ip_address();
-    std::string graphml_id = message.info().id();
+std::vector<NodeManagerProtoHandler::TopologyEntry<NodeManager::Container> >
+NodeManagerProtoHandler::ProcessNodes(const NodeManager::ControlMessage& message, int experiment_run_id) {
+    DatabaseClient::TableRows node_rows{"Node", {"ExperimentRunID", "IP", "Hostname", "GraphmlID"}, {}};
+    for (const auto& node : message.nodes()) {
+        node_rows.rows.push_back({experiment_run_id, node.ip_address(), node.info().name(), node.info().id()});
+    }
+
+    const auto& node_ids = database_->InsertMultipleValuesUnique(node_rows, {"IP", "ExperimentRunID"});
 
-    int node_id = database_->InsertValuesUnique(
-        "Node",
-        {"ExperimentRunID", "IP", "Hostname", "GraphmlID"},
-        {std::to_string(experiment_run_id), ip, hostname, graphml_id},
-        {"IP", "ExperimentRunID"}
-    );
+    std::vector<TopologyEntry<NodeManager::Container> > containers;
+    for (int i = 0; i < message.nodes_size(); i++) {
+        const auto& node = message.nodes(i);
+        experiment_tracker_.AddNodeIDWithHostname(experiment_run_id, node.info().name(), node_ids.at(i));
 
-    for (const auto& container : message.containers()) {
-        ProcessContainer(container, experiment_run_id, node_id);
+        for (const auto& container : node.containers()) {
+            containers.push_back({&container, node_ids.at(i), ""});
+        }
     }
+    return containers;
 }
 
-void NodeManagerProtoHandler::ProcessContainer(const NodeManager::Container& message, int experiment_run_id, int node_id) {
-    
-    std::string name = message.info().name();
-    std::string graphml_id = message.info().id();
-    std::string type = NodeManager::Container::ContainerType_Name(message.type());
-    
-    int container_id = database_->InsertValuesUnique(
-        "Container",
-        {"NodeID", "Name", "GraphmlID", "Type"},
-        {std::to_string(node_id), name, graphml_id, type},
-        {"NodeID", "GraphmlID"}
-    );
-
-    for (const auto& component : message.components()) {
-        ProcessComponent(component, experiment_run_id, container_id);
+std::vector<NodeManagerProtoHandler::TopologyEntry<NodeManager::Component> >
+NodeManagerProtoHandler::ProcessContainers(
+    const std::vector<TopologyEntry<NodeManager::Container> >& containers,
+    std::vector<const NodeManager::Logger*>& loggers
+) {
+    DatabaseClient::TableRows container_rows{"Container", {"NodeID", "Name", "GraphmlID", "Type"}, {}};
+    for (const auto& container : containers) {
+        const auto& message = *container.message;
+        container_rows.rows.push_back({
+            container.parent_id,
+            message.info().name(),
+            message.info().id(),
+            NodeManager::Container::ContainerType_Name(message.type())
+        });
     }
 
-    for (const auto& logger : message.loggers()) {
-        ProcessLogger(logger, experiment_run_id);
+    const auto& container_ids = database_->InsertMultipleValuesUnique(container_rows, {"NodeID", "GraphmlID"});
+
+    std::vector<TopologyEntry<NodeManager::Component> > components;
+    for (std::size_t i = 0; i < containers.size(); i++) {
+        const auto& message = *containers[i].message;
+
+        for (const auto& component : message.components()) {
+            components.push_back({&component, container_ids.at(i), ""});
+        }
+
+        for (const auto& logger : message.loggers()) {
+            loggers.push_back(&logger);
+        }
     }
+    return components;
 }
 
 void NodeManagerProtoHandler::ProcessLogger(const NodeManager::Logger& message, int experiment_run_id) {
@@ -126,71 +146,101 @@ void NodeManagerProtoHandler::ProcessLogger(const NodeManager::Logger& message,
     }
 }
 
-void NodeManagerProtoHandler::ProcessComponent(const NodeManager::Component& message, int experiment_run_id, int container_id) {
-    if (message.location_size() != message.replicate_indices_size()) {
-            // NOTE: sizes dont match
-            throw std::runtime_error(std::string("Mismatch in size of replication and location vectors for component ").append(message.info().name()));
-    }
+void NodeManagerProtoHandler::ProcessComponents(const std::vector<TopologyEntry<NodeManager::Component> >& components, int experiment_run_id) {
+    DatabaseClient::TableRows component_rows{"Component", {"Name", "ExperimentRunID", "GraphmlID"}, {}};
+    std::vector<std::string> full_locations;
 
-    int component_id = database_->InsertValuesUnique(
-        "Component",
-        {"Name", "ExperimentRunID", "GraphmlID"},
-        {message.info().type(), std::to_string(experiment_run_id), message.info().id()},
-        {"Name", "ExperimentRunID"}
-    );
+    for (const auto& component : components) {
+        const auto& message = *component.message;
+        if (message.location_size() != message.replicate_indices_size()) {
+                // NOTE: sizes dont match
+                throw std::runtime_error(std::string("Mismatch in size of replication and location vectors for component ").append(message.info().name()));
+        }
 
-    std::string full_location;
-    auto&& location_vec = std::vector<std::string>(message.location().begin(), message.location().end());
-    auto&& replication_vec = std::vector<int>(message.replicate_indices().begin(), message.replicate_indices().end());
-    full_location = AggServer::GetFullLocation(location_vec, replication_vec, message.info().name());
+        // Replicated instances share a Component row, the repeats resolve to the same ID
+        component_rows.rows.push_back({message.info().type(), experiment_run_id, message.info().id()});
 
-    int component_instance_id = database_->InsertValuesUnique(
-        "ComponentInstance",
-        {"ComponentID", "Path", "Name", "ContainerID", "GraphmlID"},
-        {std::to_string(component_id), full_location, message.info().name(), std::to_string(container_id), message.info().id()},
-        {"Path", "ComponentID"} // Unique path per componentID -> Unique path per ExperimentRunID
-    );
+        auto&& location_vec = std::vector<std::string>(message.location().begin(), message.location().end());
+        auto&& replication_vec = std::vector<int>(message.replicate_indices().begin(), message.replicate_indices().end());
+        full_locations.push_back(AggServer::GetFullLocation(location_vec, replication_vec, message.info().name()));
+    }
+
+    const auto& component_ids = database_->InsertMultipleValuesUnique(component_rows, {"Name", "ExperimentRunID"});
 
-    for(const auto& port : message.ports()) {
-        ProcessPort(port, component_instance_id, full_location);
+    DatabaseClient::TableRows instance_rows{"ComponentInstance", {"ComponentID", "Path", "Name", "ContainerID", "GraphmlID"}, {}};
+    for (std::size_t i = 0; i < components.size(); i++) {
+        const auto& message = *components[i].message;
+        experiment_tracker_.AddComponentIDWithName(experiment_run_id, message.info().type(), component_ids.at(i));
+        instance_rows.rows.push_back({component_ids.at(i), full_locations.at(i), message.info().name(), components[i].parent_id, message.info().id()});
     }
-    
-    for(const auto& worker : message.workers()) {
-        ProcessWorker(worker, experiment_run_id, component_instance_id, full_location);
+
+    // Unique path per componentID -> Unique path per ExperimentRunID
+    const auto& component_instance_ids = database_->InsertMultipleValuesUnique(instance_rows, {"Path", "ComponentID"});
+
+    std::vector<TopologyEntry<NodeManager::Port> > ports;
+    std::vector<TopologyEntry<NodeManager::Worker> > workers;
+    for (std::size_t i = 0; i < components.size(); i++) {
+        const auto& message = *components[i].message;
+        experiment_tracker_.AddComponentInstanceIDWithGraphmlID(experiment_run_id, message.info().id(), component_instance_ids.at(i));
+
+        for (const auto& port : message.ports()) {
+            ports.push_back({&port, component_instance_ids.at(i), full_locations.at(i)});
+        }
+        for (const auto& worker : message.workers()) {
+            workers.push_back({&worker, component_instance_ids.at(i), full_locations.at(i)});
+        }
     }
+
+    ProcessPorts(ports, experiment_run_id);
+    ProcessWorkers(workers, experiment_run_id);
 }
 
-void NodeManagerProtoHandler::ProcessPort(const NodeManager::Port& message, int component_instance_id, const std::string& component_instance_location) {
+void NodeManagerProtoHandler::ProcessPorts(const std::vector<TopologyEntry<NodeManager::Port> >& ports, int experiment_run_id) {
+    DatabaseClient::TableRows port_rows{"Port", {"Name", "ComponentInstanceID", "Path", "Kind", "Type", "Middleware", "GraphmlID"}, {}};
+    for (const auto& port : ports) {
+        const auto& message = *port.message;
+        port_rows.rows.push_back({
+            message.info().name(),
+            port.parent_id,
+            port.parent_location + "/" + message.info().name(),
+            static_cast<int>(message.kind()),
+            message.info().type(),
+            NodeManager::Middleware_Name(message.middleware()),
+            message.info().id()
+        });
+    }
 
-    //const std::string&& location = GetFullLocation(message.location(), message.replication_indices());
-    const std::string port_path = component_instance_location + "/" + message.info().name();
-    const std::string& port_kind = NodeManager::Port_Kind_Name(message.kind());
-    const std::string& port_type = message.info().type();
-    const std::string& middleware = NodeManager::Middleware_Name(message.middleware());
+    const auto& port_ids = database_->InsertMultipleValuesUnique(port_rows, {"Name", "ComponentInstanceID"});
 
-    int port_id = database_->InsertValuesUnique(
-        "Port",
-        {"Name", "ComponentInstanceID", "Path", "Kind", "Type", "Middleware", "GraphmlID"},
-        {message.info().name(), std::to_string(component_instance_id), port_path, port_kind, port_type, middleware, message.info().id()},
-        {"Name", "ComponentInstanceID"}
-    );
+    for (std::size_t i = 0; i < ports.size(); i++) {
+        experiment_tracker_.AddPortIDWithGraphmlID(experiment_run_id, ports[i].message->info().id(), port_ids.at(i));
+    }
 }
 
-void NodeManagerProtoHandler::ProcessWorker(const NodeManager::Worker& message, int experiment_run_id, int component_id, const std::string& component_path) {
+void NodeManagerProtoHandler::ProcessWorkers(const std::vector<TopologyEntry<NodeManager::Worker> >& workers, int experiment_run_id) {
+    DatabaseClient::TableRows worker_rows{"Worker", {"Name", "ExperimentRunID", "GraphmlID"}, {}};
+    for (const auto& worker : workers) {
+        const auto& message = *worker.message;
+        worker_rows.rows.push_back({message.info().type(), experiment_run_id, message.info().id()});
+    }
 
-    int worker_id = database_->InsertValuesUnique(
-        "Worker",
-        {"Name", "ExperimentRunID", "GraphmlID"},
-        {message.info().type(), std::to_string(experiment_run_id), message.info().id()},
-        {"Name", "ExperimentRunID"}
-    );
+    const auto& worker_ids = database_->InsertMultipleValuesUnique(worker_rows, {"Name", "ExperimentRunID"});
+
+    DatabaseClient::TableRows instance_rows{"WorkerInstance", {"Name", "WorkerID", "ComponentInstanceID", "Path", "GraphmlID"}, {}};
+    for (std::size_t i = 0; i < workers.size(); i++) {
+        const auto& message = *workers[i].message;
+        instance_rows.rows.push_back({
+            message.info().name(),
+            worker_ids.at(i),
+            workers[i].parent_id,
+            workers[i].parent_location + "/" + message.info().name(),
+            message.info().id()
+        });
+    }
 
-    std::string worker_path = component_path + "/" + message.info().name();
+    const auto& worker_instance_ids = database_->InsertMultipleValuesUnique(instance_rows, {"Name", "ComponentInstanceID"});
 
-    int worker_instance_id = database_->InsertValuesUnique(
-        "WorkerInstance",
-        {"Name", "WorkerID", "ComponentInstanceID", "Path", "GraphmlID"},
-        {message.info().name(), std::to_string(worker_id), std::to_string(component_id), worker_path, message.info().id()},
-        {"Name", "ComponentInstanceID"}
-    );
+    for (std::size_t i = 0; i < workers.size(); i++) {
+        experiment_tracker_.AddWorkerInstanceIDWithGraphmlID(experiment_run_id, workers[i].message->info().id(), worker_instance_ids.at(i));
+    }
 }
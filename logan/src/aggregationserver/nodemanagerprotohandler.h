@@ -5,6 +5,9 @@
 
 #include <proto/controlmessage/controlmessage.pb.h>
 
+#include <string>
+#include <vector>
+
 class NodeManagerProtoHandler : public AggregationProtoHandler {
 public:
     NodeManagerProtoHandler(std::shared_ptr<DatabaseClient> db_client, ExperimentTracker& exp_tracker)
@@ -18,11 +21,23 @@ private:
     void ProcessGetInfoControlMessage(const NodeManager::ControlMessage& message);
     void ProcessConfigureControlMessage(const NodeManager::ControlMessage& message);
     void ProcessShutdownControlMessage(const NodeManager::ControlMessage& message);
-    void ProcessNode(const NodeManager::Node& message, int experiment_run_id);
-    void ProcessContainer(const NodeManager::Container& message, int experiment_run_id, int node_id);
-    void ProcessComponent(const NodeManager::Component& message, int experiment_run_id, int container_id);
-    void ProcessPort(const NodeManager::Port& message, int component_instance_id, const std::string& component_instance_location);
-    void ProcessWorker(const NodeManager::Worker& message, int experiment_run_id, int component_instance_id, const std::string& worker_path);
+    // CONFIGURE registers the topology one level at a time, each table gets a single set based upsert
+    // covering every entity at that level rather than a round trip per entity
+    template <class Message>
+    struct TopologyEntry {
+        const Message* message;
+        int parent_id;
+        std::string parent_location;
+    };
+    std::vector<TopologyEntry<NodeManager::Container> > ProcessNodes(const NodeManager::ControlMessage& message, int experiment_run_id);
+    // The containers' loggers are collected rather than connected, so no event arrives before the topology it references
+    std::vector<TopologyEntry<NodeManager::Component> > ProcessContainers(
+        const std::vector<TopologyEntry<NodeManager::Container> >& containers,
+        std::vector<const NodeManager::Logger*>& loggers
+    );
+    void ProcessComponents(const std::vector<TopologyEntry<NodeManager::Component> >& components, int experiment_run_id);
+    void ProcessPorts(const std::vector<TopologyEntry<NodeManager::Port> >& ports, int experiment_run_id);
+    void ProcessWorkers(const std::vector<TopologyEntry<NodeManager::Worker> >& workers, int experiment_run_id);
     void ProcessLogger(const NodeManager::Logger& message, int experiment_run_id);
 };
 
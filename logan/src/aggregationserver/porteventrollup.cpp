@@ -0,0 +1,149 @@
+#include "porteventrollup.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <google/protobuf/util/time_util.h>
+
+using google::protobuf::util::TimeUtil;
+
+PortEventRollup::PortEventRollup(int experiment_run_id, std::chrono::microseconds interval) :
+    experiment_run_id_(experiment_run_id),
+    interval_us_(interval.count())
+{
+    if (interval_us_ <= 0) {
+        throw std::invalid_argument("PortEvent rollup interval must be positive");
+    }
+}
+
+void PortEventRollup::Add(int port_id, const std::string& type, int64_t sequence_num, const google::protobuf::Timestamp& sample_time) {
+    const int64_t sample_us = TimeUtil::TimestampToMicroseconds(sample_time);
+    // Floor towards negative infinity so pre-epoch times still land in the right interval
+    int64_t interval_start = (sample_us / interval_us_) * interval_us_;
+    if (interval_start > sample_us) {
+        interval_start -= interval_us_;
+    }
+
+    auto& interval = intervals_[IntervalKey(interval_start, port_id, type)];
+    if (interval.event_count == 0) {
+        interval.first_sequence_num = sequence_num;
+        interval.last_sequence_num = sequence_num;
+    } else {
+        interval.first_sequence_num = std::min(interval.first_sequence_num, sequence_num);
+        interval.last_sequence_num = std::max(interval.last_sequence_num, sequence_num);
+    }
+    interval.event_count++;
+
+    auto last_it = last_sample_times_.find(std::make_pair(port_id, type));
+    if (last_it == last_sample_times_.end()) {
+        last_sample_times_.emplace(std::make_pair(port_id, type), sample_us);
+    } else if (sample_us >= last_it->second) {
+        // Events that arrive out of SampleTime order are counted, but don't contribute a gap
+        const int64_t gap = sample_us - last_it->second;
+        if (interval.inter_arrival_count == 0) {
+            interval.min_inter_arrival = gap;
+            interval.max_inter_arrival = gap;
+        } else {
+            interval.min_inter_arrival = std::min(interval.min_inter_arrival, gap);
+            interval.max_inter_arrival = std::max(interval.max_inter_arrival, gap);
+        }
+        interval.total_inter_arrival += gap;
+        interval.inter_arrival_count++;
+        last_it->second = sample_us;
+    }
+
+    watermark_us_ = std::max(watermark_us_, sample_us);
+}
+
+bool PortEventRollup::IsComplete(const IntervalKey& key) const {
+    return std::get<0>(key) + interval_us_ <= watermark_us_;
+}
+
+bool PortEventRollup::HasCompletedIntervals() const {
+    return !intervals_.empty() && IsComplete(intervals_.begin()->first);
+}
+
+DatabaseClient::TableRows PortEventRollup::GetRows(bool include_open) const {
+    DatabaseClient::TableRows table{
+        "PortEventRollup",
+        {"ExperimentRunID", "PortID", "Type", "IntervalStart", "IntervalEnd", "EventCount", "FirstSequenceNum", "LastSequenceNum",
+            "InterArrivalCount", "MinInterArrivalUS", "MaxInterArrivalUS", "MeanInterArrivalUS"},
+        {}
+    };
+    // Rows written twice for the same interval are merged, LEAST/GREATEST skip the NULLs of an interval without gaps
+    table.on_conflict =
+        "(ExperimentRunID, PortID, Type, IntervalStart) DO UPDATE SET"
+        " EventCount = PortEventRollup.EventCount + EXCLUDED.EventCount,"
+        " FirstSequenceNum = LEAST(PortEventRollup.FirstSequenceNum, EXCLUDED.FirstSequenceNum),"
+        " LastSequenceNum = GREATEST(PortEventRollup.LastSequenceNum, EXCLUDED.LastSequenceNum),"
+        " InterArrivalCount = PortEventRollup.InterArrivalCount + EXCLUDED.InterArrivalCount,"
+        " MinInterArrivalUS = LEAST(PortEventRollup.MinInterArrivalUS, EXCLUDED.MinInterArrivalUS),"
+        " MaxInterArrivalUS = GREATEST(PortEventRollup.MaxInterArrivalUS, EXCLUDED.MaxInterArrivalUS),"
+        " MeanInterArrivalUS = (COALESCE(PortEventRollup.MeanInterArrivalUS * PortEventRollup.InterArrivalCount, 0)"
+        " + COALESCE(EXCLUDED.MeanInterArrivalUS * EXCLUDED.InterArrivalCount, 0))"
+        " / NULLIF(PortEventRollup.InterArrivalCount + EXCLUDED.InterArrivalCount, 0)";
+
+    for (const auto& interval_pair : intervals_) {
+        const auto& key = interval_pair.first;
+        if (!include_open && !IsComplete(key)) {
+            break;
+        }
+        const auto& interval = interval_pair.second;
+        const int64_t interval_start = std::get<0>(key);
+
+        DatabaseValue min_gap, max_gap, mean_gap;
+        if (interval.inter_arrival_count > 0) {
+            min_gap = DatabaseValue(interval.min_inter_arrival);
+            max_gap = DatabaseValue(interval.max_inter_arrival);
+            mean_gap = DatabaseValue(static_cast<double>(interval.total_inter_arrival) / interval.inter_arrival_count);
+        }
+
+        table.rows.push_back({
+            experiment_run_id_,
+            std::get<1>(key),
+            std::get<2>(key),
+            TimeUtil::MicrosecondsToTimestamp(interval_start),
+            TimeUtil::MicrosecondsToTimestamp(interval_start + interval_us_),
+            interval.event_count,
+            interval.first_sequence_num,
+            interval.last_sequence_num,
+            interval.inter_arrival_count,
+            min_gap,
+            max_gap,
+            mean_gap
+        });
+    }
+    return table;
+}
+
+void PortEventRollup::DiscardRows(bool include_open) {
+    auto interval_it = intervals_.begin();
+    while (interval_it != intervals_.end() && (include_open || IsComplete(interval_it->first))) {
+        interval_it = intervals_.erase(interval_it);
+    }
+}
+
+const std::string& PortEventRollup::GetCreateTableQuery() {
+    static const std::string query =
+        "CREATE TABLE IF NOT EXISTS PortEventRollup\n"
+        "(\n"
+        "  ExperimentRunID      INT NOT NULL ,\n"
+        "  PortID               INT NOT NULL ,\n"
+        "  Type                 TEXT NOT NULL ,\n"
+        "  IntervalStart        TIMESTAMP NOT NULL ,\n"
+        "  IntervalEnd          TIMESTAMP NOT NULL ,\n"
+        "  EventCount           BIGINT NOT NULL ,\n"
+        "  FirstSequenceNum     BIGINT NOT NULL ,\n"
+        "  LastSequenceNum      BIGINT NOT NULL ,\n"
+        "  InterArrivalCount    BIGINT NOT NULL ,\n"
+        "  MinInterArrivalUS    BIGINT ,\n"
+        "  MaxInterArrivalUS    BIGINT ,\n"
+        "  MeanInterArrivalUS   DOUBLE PRECISION ,\n"
+        "\n"
+        "  PRIMARY KEY (ExperimentRunID, PortID, Type, IntervalStart),\n"
+        "  CONSTRAINT FK_PortEventRollup_ExperimentRunID_ExperimentRun_ExperimentRunID FOREIGN KEY (ExperimentRunID) REFERENCES ExperimentRun (ExperimentRunID),\n"
+        "  CONSTRAINT FK_PortEventRollup_PortID_Port_PortID FOREIGN KEY (PortID) REFERENCES Port (PortID)\n"
+        ");\n"
+        "CREATE INDEX IF NOT EXISTS IX_PortEventRollup_PortID_IntervalStart ON PortEventRollup (PortID, IntervalStart);\n";
+    return query;
+}
@@ -0,0 +1,62 @@
+#ifndef PORTEVENTROLLUP_H
+#define PORTEVENTROLLUP_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <google/protobuf/timestamp.pb.h>
+
+#include "databaseclient.h"
+
+// Write-combines a run's PortEvent stream into one PortEventRollup row per port, event type and fixed interval of
+// SampleTime, holding the event count, first/last sequence number and min/max/mean inter-arrival time.
+// An interval is complete once the run has seen an event at or past its end; completed intervals are handed back as
+// rows which upsert into PortEventRollup, so an interval written early (ie. at shutdown) is merged with any stragglers.
+// Not thread safe, only used from the run's writer thread.
+class PortEventRollup {
+public:
+    PortEventRollup(int experiment_run_id, std::chrono::microseconds interval);
+
+    void Add(int port_id, const std::string& type, int64_t sequence_num, const google::protobuf::Timestamp& sample_time);
+
+    bool HasCompletedIntervals() const;
+
+    // Rows for every completed interval, or for every interval when include_open is set.
+    // The intervals are kept until DiscardRows is called, so nothing is lost if the insert fails.
+    DatabaseClient::TableRows GetRows(bool include_open) const;
+    void DiscardRows(bool include_open);
+
+    // Run once by the SchemaMigrator
+    static const std::string& GetCreateTableQuery();
+
+private:
+    // Ordered by interval start first so the completed intervals are always at the front
+    typedef std::tuple<int64_t, int, std::string> IntervalKey;
+
+    struct Interval {
+        uint64_t event_count = 0;
+        int64_t first_sequence_num = 0;
+        int64_t last_sequence_num = 0;
+        uint64_t inter_arrival_count = 0;
+        int64_t min_inter_arrival = 0;
+        int64_t max_inter_arrival = 0;
+        int64_t total_inter_arrival = 0;
+    };
+
+    bool IsComplete(const IntervalKey& key) const;
+
+    const int experiment_run_id_;
+    const int64_t interval_us_;
+
+    std::map<IntervalKey, Interval> intervals_;
+    // Last SampleTime seen per (PortID, Type), kept across intervals so the first gap of an interval is still measured
+    std::map<std::pair<int, std::string>, int64_t> last_sample_times_;
+    // Latest SampleTime seen across the whole run
+    int64_t watermark_us_ = INT64_MIN;
+};
+
+#endif //PORTEVENTROLLUP_H
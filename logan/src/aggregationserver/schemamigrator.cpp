@@ -0,0 +1,437 @@
+#include "schemamigrator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "databaseclient.h"
+#include "eventpartitioner.h"
+#include "porteventrollup.h"
+#include "systemstatusrollup.h"
+
+#include <proto/controlmessage/controlmessage.pb.h>
+#include <proto/modelevent/modelevent.pb.h>
+
+SchemaMigrator::SchemaMigrator(std::shared_ptr<DatabaseClient> db_client, EventPartitioner& event_partitioner) :
+    database_(db_client),
+    event_partitioner_(event_partitioner)
+{
+    // Append new migrations to the end of this list, never edit or reorder an applied one
+    migrations_ = {
+        {1, "Experiment, model and hardware topology tables", [this]() {
+            database_->ExecuteQuery(GetCoreTablesQuery());
+        }},
+        {2, "Partitioned event and hardware status tables", [this]() {
+            event_partitioner_.BootstrapEventTables();
+        }},
+        {3, "Indexes for the aggregation broker's event queries", [this]() {
+            CreateIndexes(GetEventQueryIndexes());
+        }},
+        {4, "PortEvent rollup table", [this]() {
+            database_->ExecuteQuery(PortEventRollup::GetCreateTableQuery());
+        }},
+        {5, "Multi-resolution Hardware.SystemStatus rollup table", [this]() {
+            database_->ExecuteQuery(SystemStatusRollup::GetCreateTableQuery());
+        }},
+        {6, "Indexes for the aggregation broker's experiment listing", [this]() {
+            CreateIndexes(GetExperimentListingIndexes());
+        }},
+        {7, "Port.Kind and WorkloadEvent.Type stored as enum numbers", [this]() {
+            // The marker index's predicate compares Type to a name, so it is rebuilt around the converted column
+            std::stringstream query_stream;
+            query_stream << "DROP INDEX IF EXISTS IX_WorkloadEvent_Marker;" << std::endl;
+            query_stream << BuildEnumColumnToInt("Port", "Kind", *NodeManager::Port_Kind_descriptor(), {}) << std::endl;
+            // Older Windows builds named ERROR_EVENT "ERROR" (LOG-94)
+            query_stream << BuildEnumColumnToInt(
+                "WorkloadEvent",
+                "Type",
+                *ModelEvent::WorkloadEvent_Type_descriptor(),
+                {{"ERROR", ModelEvent::WorkloadEvent::ERROR_EVENT}}
+            ) << std::endl;
+            database_->ExecuteQuery(query_stream.str());
+            CreateIndexes(GetEnumColumnIndexes());
+        }}
+    };
+}
+
+void SchemaMigrator::Migrate() {
+    database_->ExecuteQuery(
+        "CREATE TABLE IF NOT EXISTS SchemaVersion\n"
+        "(\n"
+        "  Version     INT NOT NULL ,\n"
+        "  Description TEXT NOT NULL ,\n"
+        "  AppliedAt   TIMESTAMP NOT NULL DEFAULT now() ,\n"
+        "\n"
+        "  PRIMARY KEY (Version)\n"
+        ");"
+    );
+
+    const int current_version = GetCurrentVersion();
+    for (const auto& migration : migrations_) {
+        if (migration.version > current_version) {
+            ApplyMigration(migration);
+        }
+    }
+
+    VerifyIndexes();
+}
+
+int SchemaMigrator::GetCurrentVersion() {
+    const auto& results = database_->ExecuteQuery("SELECT COALESCE(MAX(Version), 0) FROM SchemaVersion;");
+    for (const auto& row : results) {
+        return row.at(0).as<int>();
+    }
+    return 0;
+}
+
+void SchemaMigrator::ApplyMigration(const Migration& migration) {
+    std::cout << "Applying schema migration " << migration.version << ": " << migration.description << std::endl;
+    try {
+        migration.apply();
+        database_->ExecuteQuery(
+            "INSERT INTO SchemaVersion (Version, Description) VALUES (" + std::to_string(migration.version) + ", "
+            + database_->EscapeString(migration.description) + ");"
+        );
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to apply schema migration " << migration.version << ": " << e.what() << std::endl;
+        throw;
+    }
+}
+
+void SchemaMigrator::VerifyIndexes() {
+    // Indexes can be dropped by hand after their migration was applied, recreate them rather than silently running slow
+    for (const auto& index : GetIndexes()) {
+        const auto& results = database_->ExecuteQuery(
+            "SELECT to_regclass(" + database_->EscapeString(index.name) + ") IS NOT NULL;"
+        );
+        bool exists = false;
+        for (const auto& row : results) {
+            exists = row.at(0).as<bool>();
+        }
+        if (!exists) {
+            std::cerr << "Index " << index.name << " on " << index.table << " is missing, recreating it" << std::endl;
+            database_->ExecuteQuery(BuildCreateIndex(index));
+        }
+    }
+}
+
+void SchemaMigrator::CreateIndexes(const std::vector<Index>& indexes) {
+    std::stringstream query_stream;
+    for (const auto& index : indexes) {
+        query_stream << BuildCreateIndex(index) << std::endl;
+    }
+    database_->ExecuteQuery(query_stream.str());
+}
+
+std::string SchemaMigrator::BuildEnumColumnToInt(
+    const std::string& table,
+    const std::string& column,
+    const google::protobuf::EnumDescriptor& descriptor,
+    const std::vector<std::pair<std::string, int> >& aliases
+) const {
+    // Names are mapped through the enum they were written with, a column that already holds numbers falls through
+    // to the ELSE and an unknown name fails the cast rather than being lost
+    std::stringstream case_stream;
+    case_stream << "CASE " << column << "::text";
+    for (int i = 0; i < descriptor.value_count(); i++) {
+        const auto& value = *descriptor.value(i);
+        case_stream << " WHEN " << database_->EscapeString(value.name()) << " THEN " << value.number();
+    }
+    for (const auto& alias : aliases) {
+        case_stream << " WHEN " << database_->EscapeString(alias.first) << " THEN " << alias.second;
+    }
+    case_stream << " ELSE " << column << "::text::int END";
+
+    return "ALTER TABLE " + table + " ALTER COLUMN " + column + " TYPE INT USING (" + case_stream.str() + ");";
+}
+
+std::string SchemaMigrator::BuildCreateIndex(const Index& index) const {
+    // CREATE INDEX takes an unqualified name, the index is placed in its table's schema
+    std::string index_name = index.name;
+    const auto& dot_pos = index_name.find('.');
+    if (dot_pos != std::string::npos) {
+        index_name = index_name.substr(dot_pos + 1);
+    }
+
+    std::stringstream index_stream;
+    index_stream << "CREATE INDEX IF NOT EXISTS " << index_name << " ON " << index.table << " (" << index.columns << ")";
+    if (!index.predicate.empty()) {
+        index_stream << " WHERE " << index.predicate;
+    }
+    index_stream << ";";
+    return index_stream.str();
+}
+
+const std::vector<SchemaMigrator::Index>& SchemaMigrator::GetEventQueryIndexes() {
+    // Event indexes lead with the column each Get*Info query joins on and end with SampleTime,
+    // so range filters and ORDER BY SampleTime are served straight from the index
+    static const std::vector<Index> indexes = {
+        // Topology join path: Node -> Container -> ComponentInstance -> Port/WorkerInstance
+        {"IX_Node_ExperimentRunID", "Node", "ExperimentRunID, Hostname", ""},
+        {"IX_Component_ExperimentRunID", "Component", "ExperimentRunID", ""},
+        {"IX_Worker_ExperimentRunID", "Worker", "ExperimentRunID", ""},
+        {"IX_ComponentInstance_ContainerID", "ComponentInstance", "ContainerID", ""},
+        {"IX_WorkerInstance_ComponentInstanceID", "WorkerInstance", "ComponentInstanceID", ""},
+        {"IX_WorkerInstance_WorkerID", "WorkerInstance", "WorkerID", ""},
+
+        {"IX_PortLifecycleEvent_PortID_SampleTime", "PortLifecycleEvent", "PortID, SampleTime", ""},
+        {"IX_PortLifecycleEvent_ExperimentRunID_SampleTime", "PortLifecycleEvent", "ExperimentRunID, SampleTime", ""},
+        {"IX_WorkloadEvent_WorkerInstanceID_SampleTime", "WorkloadEvent", "WorkerInstanceID, SampleTime", ""},
+        {"IX_WorkloadEvent_ExperimentRunID_SampleTime", "WorkloadEvent", "ExperimentRunID, SampleTime", ""},
+        {"IX_WorkloadEvent_Marker", "WorkloadEvent", "WorkerInstanceID, WorkloadID, SampleTime", "Type = 'MARKER'"},
+        {"IX_PortEvent_PortID_SampleTime", "PortEvent", "PortID, SampleTime", ""},
+        {"IX_ComponentLifecycleEvent_ComponentInstanceID_SampleTime", "ComponentLifecycleEvent", "ComponentInstanceID, SampleTime", ""},
+
+        {"Hardware.IX_SystemStatus_SystemID_SampleTime", "Hardware.SystemStatus", "SystemID, SampleTime", ""},
+        {"Hardware.IX_ProcessStatus_ProcessID_SampleTime", "Hardware.ProcessStatus", "ProcessID, SampleTime", ""},
+        {"Hardware.IX_InterfaceStatus_InterfaceID_SampleTime", "Hardware.InterfaceStatus", "InterfaceID, SampleTime", ""},
+        {"Hardware.IX_FilesystemStatus_FilesystemID_SampleTime", "Hardware.FilesystemStatus", "FilesystemID, SampleTime", ""}
+    };
+    return indexes;
+}
+
+const std::vector<SchemaMigrator::Index>& SchemaMigrator::GetExperimentListingIndexes() {
+    // Name prefix match then each experiment's runs
+    static const std::vector<Index> indexes = {
+        {"IX_Experiment_Name_Pattern", "Experiment", "Name text_pattern_ops", ""},
+        {"IX_ExperimentRun_ExperimentID", "ExperimentRun", "ExperimentID, JobNum", ""}
+    };
+    return indexes;
+}
+
+const std::vector<SchemaMigrator::Index>& SchemaMigrator::GetEnumColumnIndexes() {
+    static const std::vector<Index> indexes = {
+        {
+            "IX_WorkloadEvent_Marker",
+            "WorkloadEvent",
+            "WorkerInstanceID, WorkloadID, SampleTime",
+            "Type = " + std::to_string(ModelEvent::WorkloadEvent::MARKER)
+        }
+    };
+    return indexes;
+}
+
+const std::vector<SchemaMigrator::Index>& SchemaMigrator::GetIndexes() {
+    static const std::vector<Index> indexes = []() {
+        std::vector<Index> merged;
+        for (const auto& migration_indexes : {GetEventQueryIndexes(), GetExperimentListingIndexes(), GetEnumColumnIndexes()}) {
+            for (const auto& index : migration_indexes) {
+                auto existing = std::find_if(merged.begin(), merged.end(), [&index](const Index& merged_index) {
+                    return merged_index.name == index.name;
+                });
+                if (existing != merged.end()) {
+                    *existing = index;
+                } else {
+                    merged.push_back(index);
+                }
+            }
+        }
+        return merged;
+    }();
+    return indexes;
+}
+
+const std::string& SchemaMigrator::GetCoreTablesQuery() {
+    static const std::string query =
+        "CREATE SCHEMA IF NOT EXISTS Hardware;\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Experiment\n"
+        "(\n"
+        "  Name         TEXT NOT NULL ,\n"
+        "  ExperimentID SERIAL ,\n"
+        "  ModelName    TEXT NOT NULL ,\n"
+        "  Metadata     JSON ,\n"
+        "\n"
+        "  PRIMARY KEY (ExperimentID),\n"
+        "  CONSTRAINT UniqueExperimentName UNIQUE (Name)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS ExperimentRun\n"
+        "(\n"
+        "  ExperimentID    INT NOT NULL ,\n"
+        "  ExperimentRunID SERIAL ,\n"
+        "  JobNum          INT NOT NULL ,\n"
+        "  StartTime       TIMESTAMP NOT NULL ,\n"
+        "  EndTime         TIMESTAMP ,\n"
+        "  LastUpdated     TIMESTAMP ,\n"
+        "  Metadata        JSON ,\n"
+        "\n"
+        "  PRIMARY KEY (ExperimentRunID),\n"
+        "  CONSTRAINT UniqueStartTimePerExperiment UNIQUE (ExperimentID, StartTime),\n"
+        "  CONSTRAINT FK_Job_ExperimentID_Experiment_ExperimentID FOREIGN KEY (ExperimentID) REFERENCES Experiment (ExperimentID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Worker\n"
+        "(\n"
+        "  WorkerID        SERIAL ,\n"
+        "  Name            TEXT NOT NULL ,\n"
+        "  ExperimentRunID INT NOT NULL ,\n"
+        "  GraphmlID       TEXT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (WorkerID),\n"
+        "  CONSTRAINT UniqueWorkerNamePerRun UNIQUE (ExperimentRunID, Name),\n"
+        "  CONSTRAINT FK_420 FOREIGN KEY (ExperimentRunID) REFERENCES ExperimentRun (ExperimentRunID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Component\n"
+        "(\n"
+        "  ComponentID     SERIAL ,\n"
+        "  Name            TEXT NOT NULL ,\n"
+        "  ExperimentRunID INT NOT NULL ,\n"
+        "  GraphmlID       TEXT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (ComponentID),\n"
+        "  CONSTRAINT UniqueComponentNamePerRun UNIQUE (Name, ExperimentRunID),\n"
+        "  CONSTRAINT FK_403 FOREIGN KEY (ExperimentRunID) REFERENCES ExperimentRun (ExperimentRunID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Node\n"
+        "(\n"
+        "  NodeID          SERIAL ,\n"
+        "  Hostname        TEXT NOT NULL ,\n"
+        "  IP              INET NOT NULL ,\n"
+        "  ExperimentRunID INT NOT NULL ,\n"
+        "  GraphmlID       TEXT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (NodeID),\n"
+        "  CONSTRAINT UniqueIP UNIQUE (IP, ExperimentRunID),\n"
+        "  CONSTRAINT FK_360 FOREIGN KEY (ExperimentRunID) REFERENCES ExperimentRun (ExperimentRunID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Container\n"
+        "(\n"
+        "  ContainerID       SERIAL ,\n"
+        "  NodeID          INT NOT NULL ,\n"
+        "  Name            TEXT NOT NULL ,\n"
+        "  GraphmlID       TEXT NOT NULL,\n"
+        "  Type            TEXT NOT NULL,\n"
+        "\n"
+        "  PRIMARY KEY (ContainerID),\n"
+        "  CONSTRAINT UniqueGraphmlIDPerRun UNIQUE (NodeID, GraphmlID),\n"
+        "  CONSTRAINT FK_356 FOREIGN KEY (NodeID) REFERENCES Node (NodeID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Hardware.System\n"
+        "(\n"
+        "  SystemID     SERIAL ,\n"
+        "  OSName         TEXT NOT NULL ,\n"
+        "  OSArch         TEXT NOT NULL ,\n"
+        "  OSDescription  TEXT NOT NULL ,\n"
+        "  OSVersion      TEXT NOT NULL ,\n"
+        "  OSVendor       TEXT NOT NULL ,\n"
+        "  OSVendorName   TEXT NOT NULL ,\n"
+        "  CPUModel       TEXT NOT NULL ,\n"
+        "  CPUVendor      TEXT NOT NULL ,\n"
+        "  CPUFrequencyHz   INT NOT NULL ,\n"
+        "  PhysicalMemoryKB BIGINT NOT NULL ,\n"
+        "  NodeID      INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (SystemID),\n"
+        "  CONSTRAINT UniqueSystemPerNode UNIQUE (NodeID),\n"
+        "  CONSTRAINT FK_373 FOREIGN KEY (NodeID) REFERENCES Node (NodeID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Hardware.CPUStatus\n"
+        "(\n"
+        "  CPUStatusID   SERIAL ,\n"
+        "  SampleTime      TIMESTAMP NOT NULL ,\n"
+        "  CoreID          INT NOT NULL ,\n"
+        "  CoreUtilisation DECIMAL NOT NULL ,\n"
+        "  NodeID       INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (CPUStatusID),\n"
+        "  CONSTRAINT FK_385 FOREIGN KEY (NodeID) REFERENCES Node (NodeID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Hardware.Process\n"
+        "(\n"
+        "  ProcessID    SERIAL ,\n"
+        "  pID            SMALLINT NOT NULL ,\n"
+        "  WorkingDirectory TEXT NOT NULL ,\n"
+        "  ProcessName    TEXT NOT NULL ,\n"
+        "  Args           TEXT NOT NULL ,\n"
+        "  StartTime      TIMESTAMP NOT NULL ,\n"
+        "  NodeID      INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (ProcessID),\n"
+        "  CONSTRAINT UniqueProcessAndStartPerNode UNIQUE (NodeID, pID, StartTime),\n"
+        "  CONSTRAINT FK_390 FOREIGN KEY (NodeID) REFERENCES Node (NodeID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Hardware.Interface\n"
+        "(\n"
+        "  InterfaceID SERIAL ,\n"
+        "  Name          TEXT NOT NULL ,\n"
+        "  Type          TEXT NOT NULL ,\n"
+        "  Description   TEXT NOT NULL ,\n"
+        "  IPv4          INET NOT NULL ,\n"
+        "  IPv6          INET NOT NULL ,\n"
+        "  MAC           MACADDR NOT NULL ,\n"
+        "  Speed         BIGINT NOT NULL ,\n"
+        "  NodeID     INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (InterfaceID),\n"
+        "  CONSTRAINT UniqueInterfacePerNode UNIQUE (NodeID, Name),\n"
+        "  CONSTRAINT FK_381 FOREIGN KEY (NodeID) REFERENCES Node (NodeID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Hardware.Filesystem\n"
+        "(\n"
+        "  FilesystemID SERIAL ,\n"
+        "  Name           TEXT NOT NULL ,\n"
+        "  Type           TEXT NOT NULL ,\n"
+        "  Size           BIGINT NOT NULL ,\n"
+        "  NodeID      INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (FilesystemID),\n"
+        "  CONSTRAINT UniqueFilesystemPerNode UNIQUE (NodeID, Name),\n"
+        "  CONSTRAINT FK_377 FOREIGN KEY (NodeID) REFERENCES Node (NodeID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS ComponentInstance\n"
+        "(\n"
+        "  ComponentInstanceID SERIAL ,\n"
+        "  Path                TEXT NOT NULL ,\n"
+        "  Name                TEXT NOT NULL ,\n"
+        "  GraphmlID           TEXT NOT NULL,\n"
+        "  ContainerID         INT NOT NULL ,\n"
+        "  ComponentID         INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (ComponentInstanceID),\n"
+        "  CONSTRAINT UniquePathPerRun UNIQUE (ComponentID, Path),\n"
+        "  CONSTRAINT FK_394 FOREIGN KEY (ContainerID) REFERENCES Container (ContainerID),\n"
+        "  CONSTRAINT FK_407 FOREIGN KEY (ComponentID) REFERENCES Component (ComponentID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS WorkerInstance\n"
+        "(\n"
+        "  WorkerInstanceID    SERIAL ,\n"
+        "  Path                TEXT NOT NULL ,\n"
+        "  Name                TEXT NOT NULL ,\n"
+        "  GraphmlID           TEXT NOT NULL,\n"
+        "  ComponentInstanceID INT NOT NULL ,\n"
+        "  WorkerID            INT NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (WorkerInstanceID),\n"
+        "  CONSTRAINT UniqueWorkerNamePerComponent UNIQUE (Name, ComponentInstanceID),\n"
+        "  CONSTRAINT FK_Worker_ComponentID_Component_ComponentID FOREIGN KEY (ComponentInstanceID) REFERENCES ComponentInstance (ComponentInstanceID),\n"
+        "  CONSTRAINT FK_416 FOREIGN KEY (WorkerID) REFERENCES Worker (WorkerID)\n"
+        ");\n"
+        "\n"
+        "CREATE TABLE IF NOT EXISTS Port\n"
+        "(\n"
+        "  PortID              SERIAL ,\n"
+        "  Name                TEXT NOT NULL ,\n"
+        "  Path                TEXT NOT NULL ,\n"
+        "  GraphmlID           TEXT NOT NULL,\n"
+        "  ComponentInstanceID INT NOT NULL ,\n"
+        "  Kind                TEXT NOT NULL ,\n"
+        "  Type                TEXT ,\n"
+        "  Middleware          TEXT ,\n"
+        "\n"
+        "  PRIMARY KEY (PortID),\n"
+        "  CONSTRAINT UniquePortNamePerComponent UNIQUE (ComponentInstanceID, Name),\n"
+        "  CONSTRAINT FK_Port_ComponentID_Component_ComponentID FOREIGN KEY (ComponentInstanceID) REFERENCES ComponentInstance (ComponentInstanceID)\n"
+        ");\n";
+    return query;
+}
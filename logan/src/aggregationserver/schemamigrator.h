@@ -0,0 +1,66 @@
+#ifndef SCHEMAMIGRATOR_H
+#define SCHEMAMIGRATOR_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace google { namespace protobuf { class EnumDescriptor; } }
+
+class DatabaseClient;
+class EventPartitioner;
+
+// Brings the aggregation database up to the schema version this server expects.
+// Applied versions are recorded in the SchemaVersion table, each migration is applied at most once and in order.
+// Every statement is written to be idempotent so databases built by hand from the old SQL scripts are adopted in place.
+class SchemaMigrator {
+public:
+    SchemaMigrator(std::shared_ptr<DatabaseClient> db_client, EventPartitioner& event_partitioner);
+
+    // Applies any pending migrations then checks that every expected index is present
+    void Migrate();
+
+    int GetCurrentVersion();
+
+private:
+    struct Migration {
+        int version;
+        std::string description;
+        std::function<void()> apply;
+    };
+
+    struct Index {
+        std::string name; // Schema qualified, indexes live in the same schema as their table
+        std::string table;
+        std::string columns;
+        std::string predicate;
+    };
+
+    void ApplyMigration(const Migration& migration);
+    void VerifyIndexes();
+    void CreateIndexes(const std::vector<Index>& indexes);
+    std::string BuildCreateIndex(const Index& index) const;
+    // Converts a column holding an enum's value names to their numbers, aliases covers names the enum no longer has
+    std::string BuildEnumColumnToInt(
+        const std::string& table,
+        const std::string& column,
+        const google::protobuf::EnumDescriptor& descriptor,
+        const std::vector<std::pair<std::string, int> >& aliases
+    ) const;
+
+    static const std::string& GetCoreTablesQuery();
+    // The indexes each migration creates, frozen once that migration has been released
+    static const std::vector<Index>& GetEventQueryIndexes();
+    static const std::vector<Index>& GetExperimentListingIndexes();
+    static const std::vector<Index>& GetEnumColumnIndexes();
+    // Every index the current schema expects, a later migration's index replaces an earlier one of the same name
+    static const std::vector<Index>& GetIndexes();
+
+    std::shared_ptr<DatabaseClient> database_;
+    EventPartitioner& event_partitioner_;
+    std::vector<Migration> migrations_;
+};
+
+#endif //SCHEMAMIGRATOR_H
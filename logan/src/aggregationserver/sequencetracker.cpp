@@ -0,0 +1,145 @@
+#include "sequencetracker.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+SequenceTracker::SequenceTracker(std::size_t window_size) :
+    window_size_(window_size)
+{
+    if (window_size_ == 0) {
+        throw std::invalid_argument("SequenceTracker window size must be greater than 0");
+    }
+}
+
+bool SequenceTracker::Observe(const std::string& producer, int64_t sequence_number) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto producer_it = producers_.find(producer);
+    if (producer_it == producers_.end()) {
+        // The first message seen from a producer sets its baseline, anything sent before we connected isn't counted as missing
+        ProducerState state;
+        state.highest = sequence_number;
+        state.seen.assign(window_size_, false);
+        state.seen[GetSlot(sequence_number)] = true;
+        producers_.emplace(producer, std::move(state));
+        metrics_.producer_count = producers_.size();
+        metrics_.accepted_count++;
+        return true;
+    }
+
+    auto& state = producer_it->second;
+    const int64_t offset = state.highest - sequence_number;
+    const bool in_window = offset >= 0 && offset < static_cast<int64_t>(window_size_);
+
+    // Checked before the restart below, so a re-delivered first message is dropped rather than resetting the window
+    if (IsSeen(state, offset)) {
+        metrics_.duplicate_count++;
+        return false;
+    }
+
+    if (sequence_number <= first_sequence_number && state.highest > first_sequence_number && !state.first_forgotten) {
+        // The first number is no longer marked, so rather than a late arrival the producer has restarted its numbering
+        state.highest = sequence_number;
+        state.seen.assign(window_size_, false);
+        state.seen[GetSlot(sequence_number)] = true;
+        metrics_.reset_count++;
+        metrics_.accepted_count++;
+        return true;
+    }
+
+    if (sequence_number > state.highest) {
+        const int64_t advance = sequence_number - state.highest;
+        metrics_.missing_count += advance - 1;
+        // Clear the slots the window slides over, they now belong to the numbers jumped past
+        if (advance >= static_cast<int64_t>(window_size_)) {
+            state.seen.assign(window_size_, false);
+        } else {
+            for (int64_t skipped = state.highest + 1; skipped < sequence_number; skipped++) {
+                state.seen[GetSlot(skipped)] = false;
+            }
+        }
+        state.seen[GetSlot(sequence_number)] = true;
+        state.highest = sequence_number;
+        metrics_.accepted_count++;
+        return true;
+    }
+
+    if (sequence_number <= first_sequence_number) {
+        // The retry of a forgotten first message
+        state.first_forgotten = false;
+    }
+
+    if (!in_window) {
+        // Behind the window there's no record of what was seen, ie. a spooled event retried much later. It may be a
+        // duplicate as easily as a gap being filled, so it is let through without touching the missing count
+        metrics_.behind_window_count++;
+        metrics_.accepted_count++;
+        return true;
+    }
+
+    state.seen[GetSlot(sequence_number)] = true;
+    if (metrics_.missing_count > 0) {
+        metrics_.missing_count--;
+    }
+    metrics_.reordered_count++;
+    metrics_.accepted_count++;
+    return true;
+}
+
+void SequenceTracker::Forget(const std::string& producer, int64_t sequence_number) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto producer_it = producers_.find(producer);
+    if (producer_it == producers_.end()) {
+        return;
+    }
+    auto& state = producer_it->second;
+    const int64_t offset = state.highest - sequence_number;
+    if (!IsSeen(state, offset)) {
+        return;
+    }
+    state.seen[GetSlot(sequence_number)] = false;
+    metrics_.accepted_count--;
+    if (sequence_number <= first_sequence_number) {
+        state.first_forgotten = true;
+    }
+
+    if (offset > 0) {
+        // Now a gap behind highest, its retry fills it like any other late arrival
+        metrics_.missing_count++;
+        return;
+    }
+
+    // highest itself was forgotten, step back to the highest number still marked so its retry advances again
+    int64_t step = 1;
+    while (step < static_cast<int64_t>(window_size_) && !IsSeen(state, step)) {
+        step++;
+    }
+    if (step == static_cast<int64_t>(window_size_)) {
+        // Nothing else is known, the retry sets a new baseline like the producer's first message
+        producers_.erase(producer_it);
+        metrics_.producer_count = producers_.size();
+        return;
+    }
+    state.highest -= step;
+    // The numbers skipped over to reach the forgotten one are no longer behind highest
+    const uint64_t skipped = step - 1;
+    metrics_.missing_count -= std::min<uint64_t>(metrics_.missing_count, skipped);
+}
+
+SequenceTracker::Metrics SequenceTracker::GetMetrics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return metrics_;
+}
+
+std::size_t SequenceTracker::GetSlot(int64_t sequence_number) const {
+    const int64_t window_size = static_cast<int64_t>(window_size_);
+    return static_cast<std::size_t>(((sequence_number % window_size) + window_size) % window_size);
+}
+
+bool SequenceTracker::IsSeen(const ProducerState& state, int64_t offset) const {
+    if (offset < 0 || offset >= static_cast<int64_t>(window_size_)) {
+        return false;
+    }
+    return state.seen[GetSlot(state.highest - offset)];
+}
@@ -0,0 +1,66 @@
+#ifndef SEQUENCETRACKER_H
+#define SEQUENCETRACKER_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Tracks the sequence numbers seen from each producer (ie. a hostname or a port's graphml id) of a run.
+// A sliding window of recently seen numbers behind each producer's highest number suppresses replayed or
+// duplicated messages, while jumps past the highest number are counted as missing until they arrive late.
+// Nothing is known about numbers that have fallen behind the window, they are let through and counted on their own.
+// Producers number their messages from first_sequence_number, seeing it again when it isn't a duplicate inside the window
+// means the producer restarted, so its numbering starts over rather than being discarded.
+class SequenceTracker {
+public:
+    struct Metrics {
+        uint64_t accepted_count = 0;
+        uint64_t duplicate_count = 0;
+        // Messages skipped over by a jump in sequence number that have not (yet) arrived
+        uint64_t missing_count = 0;
+        // Messages that arrived behind their producer's highest sequence number, filling a gap
+        uint64_t reordered_count = 0;
+        // Messages that arrived more than a window behind their producer's highest sequence number, these can't be
+        // told apart from duplicates so they are accepted without filling a gap
+        uint64_t behind_window_count = 0;
+        // Producers that restarted their numbering from first_sequence_number
+        uint64_t reset_count = 0;
+        std::size_t producer_count = 0;
+    };
+
+    static const std::size_t default_window_size = 1024;
+    static const int64_t first_sequence_number = 1;
+
+    explicit SequenceTracker(std::size_t window_size = default_window_size);
+
+    // Returns false if the message has already been seen and should be discarded
+    bool Observe(const std::string& producer, int64_t sequence_number);
+    // Un-marks a number accepted by Observe whose message then failed to be written, so a spooled retry isn't discarded.
+    // Forgetting the highest number steps the producer back to the highest number still seen.
+    void Forget(const std::string& producer, int64_t sequence_number);
+
+    Metrics GetMetrics() const;
+
+private:
+    struct ProducerState {
+        int64_t highest = 0;
+        // Ring of window_size_ flags indexed by sequence number, only those within the window behind highest are meaningful
+        std::vector<bool> seen;
+        // Set while a forgotten first message is waiting on its retry, which must not look like a restart
+        bool first_forgotten = false;
+    };
+
+    std::size_t GetSlot(int64_t sequence_number) const;
+    // Returns whether highest - offset has been seen, offsets outside of the window are never seen
+    bool IsSeen(const ProducerState& state, int64_t offset) const;
+
+    const std::size_t window_size_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, ProducerState> producers_;
+    Metrics metrics_;
+};
+
+#endif //SEQUENCETRACKER_H
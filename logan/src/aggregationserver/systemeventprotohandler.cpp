@@ -14,132 +14,296 @@
 using google::protobuf::util::TimeUtil;
 
 void SystemEventProtoHandler::BindCallbacks(zmq::ProtoReceiver& receiver) {
-    receiver.RegisterProtoCallback<SystemEvent::StatusEvent>(std::bind(&SystemEventProtoHandler::ProcessStatusEvent, this, std::placeholders::_1));
-    receiver.RegisterProtoCallback<SystemEvent::InfoEvent>(std::bind(&SystemEventProtoHandler::ProcessInfoEvent, this, std::placeholders::_1));
+    // Events are handed off to the run's writer thread so the receiver never waits on the database
+    receiver.RegisterProtoCallback<SystemEvent::StatusEvent>(ingest_worker_.Wrap<SystemEvent::StatusEvent>(
+        std::bind(&SystemEventProtoHandler::ProcessStatusEvent, this, std::placeholders::_1),
+        [](const SystemEvent::StatusEvent& event) { return event.timestamp(); }
+    ));
+    receiver.RegisterProtoCallback<SystemEvent::InfoEvent>(ingest_worker_.Wrap<SystemEvent::InfoEvent>(
+        std::bind(&SystemEventProtoHandler::ProcessInfoEvent, this, std::placeholders::_1),
+        [](const SystemEvent::InfoEvent& event) { return event.timestamp(); }
+    ));
+}
+
+SequenceTracker::Metrics SystemEventProtoHandler::GetSequenceMetrics() const {
+    return status_sequences_.GetMetrics();
 }
 
 void SystemEventProtoHandler::ProcessStatusEvent(const SystemEvent::StatusEvent& event) {
     const std::string& hostname = event.hostname();
-    const std::string& time_str = TimeUtil::ToString(event.timestamp());
-    const auto& cpu_util = std::to_string(event.cpu_utilization());
-    const auto& phys_mem = std::to_string(event.phys_mem_utilization());
+    // message_id is numbered per host, replays after a reconnect are dropped here rather than written twice
+    if (!status_sequences_.Observe(hostname, event.message_id())) {
+        return;
+    }
+
+    if (system_id_cache_.Get(hostname) == AggServer::IDCache<std::string>::invalid_id) {
+        // Hosts often start publishing status before their InfoEvent lands, the whole event is written once it does.
+        // Until then it is counted as parked, its write (or drop) shows up in the deferred metrics
+        deferred_status_events_.Park(hostname, event);
+        ingest_worker_.MarkParked();
+        return;
+    }
 
-    std::string system_id = "-1";
+    const auto complete = ingest_worker_.DeferCompletion();
+    const int64_t message_id = event.message_id();
     try {
-        system_id = std::to_string(system_id_cache_.at(hostname));
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "Failed to insert StatusEvent for hostname '" << hostname << "', " << oor_ex.what() << "\n";
+        InsertStatusEvent(event, [this, complete, hostname, message_id](bool committed) {
+            if (!committed) {
+                // Handed back to the ingest worker, so its replay has to be let through
+                status_sequences_.Forget(hostname, message_id);
+            }
+            complete(committed);
+        });
+    } catch (const std::exception& e) {
+        // Not written, so a spooled replay of this event has to be let through
+        status_sequences_.Forget(hostname, event.message_id());
         throw;
     }
+}
 
-    database_->InsertValues(
-        "Hardware.SystemStatus",
-        {"SystemID", "SampleTime", "CPUUtilisation", "PhysMemUtilisation"},
-        {system_id, time_str, cpu_util, phys_mem}
-    );
+void SystemEventProtoHandler::InsertStatusEvent(const SystemEvent::StatusEvent& event, const DatabaseClient::WriteCallback& on_written) {
+    const std::string& hostname = event.hostname();
+    const DatabaseValue sample_time(event.timestamp());
+
+    const int system_id = system_id_cache_.Get(hostname);
+    if (system_id == AggServer::IDCache<std::string>::invalid_id) {
+        // Only reached when releasing parked events, ProcessStatusEvent parks before deferring its completion
+        deferred_status_events_.Park(hostname, event);
+        if (on_written) {
+            on_written(true);
+        }
+        return;
+    }
+    const int host_handle = hostname_handles_.Intern(hostname);
 
-    for (const auto& iface : event.interfaces()) {
-        ProcessInterfaceStatus(iface, hostname, time_str);
+    // New processes need their ProcessIDs before the status rows referencing them can be built
+    for (const auto& p_info : event.process_info()) {
+        ProcessProcessInfo(p_info, hostname);
     }
 
-    for (const auto& fs : event.file_systems()) {
-        ProcessFileSystemStatus(fs, hostname, time_str);
+    DatabaseClient::TableRows system_rows{
+        "Hardware.SystemStatus",
+        {"ExperimentRunID", "SystemID", "SampleTime", "CPUUtilisation", "PhysMemUtilisation"},
+        {{experiment_run_id_, system_id, sample_time, event.cpu_utilization(), event.phys_mem_utilization()}}
+    };
+    auto interface_rows = MakeInterfaceStatusRows();
+    auto filesystem_rows = MakeFileSystemStatusRows();
+    auto process_rows = MakeProcessStatusRows();
+
+    interface_rows.rows.reserve(event.interfaces_size());
+    for (const auto& iface : event.interfaces()) {
+        AppendInterfaceStatus(iface, host_handle, sample_time, interface_rows.rows);
     }
 
-    for (const auto& p_info : event.process_info()) {
-        ProcessProcessInfo(p_info, hostname);
+    filesystem_rows.rows.reserve(event.file_systems_size());
+    for (const auto& fs : event.file_systems()) {
+        AppendFileSystemStatus(fs, host_handle, sample_time, filesystem_rows.rows);
     }
 
+    process_rows.rows.reserve(event.processes_size());
     for (const auto& p : event.processes()) {
-        ProcessProcessStatus(p, hostname, time_str);
+        AppendProcessStatus(p, host_handle, sample_time, process_rows.rows);
     }
+
+    const double cpu_utilization = event.cpu_utilization();
+    const double phys_mem_utilization = event.phys_mem_utilization();
+    const google::protobuf::Timestamp timestamp = event.timestamp();
+    database_->InsertMultipleValues(
+        {system_rows, interface_rows, filesystem_rows, process_rows},
+        experiment_run_id_,
+        sample_time,
+        [this, on_written, system_id, cpu_utilization, phys_mem_utilization, timestamp](bool committed) {
+            if (committed) {
+                // Only rolled up once committed, so a spooled retry of this event isn't counted twice
+                status_rollup_.Add(system_id, cpu_utilization, phys_mem_utilization, timestamp);
+                if (status_rollup_.HasRowsToWrite()) {
+                    WriteStatusRollup(status_rollup_.IsOpenRefreshDue());
+                }
+            }
+            if (on_written) {
+                on_written(committed);
+            }
+        }
+    );
 }
 
-void SystemEventProtoHandler::ProcessInterfaceStatus(
-    const SystemEvent::InterfaceStatus& if_status,
-    const std::string& hostname,
-    const std::string& timestamp
-) {
-    const auto& rec_packets = std::to_string(if_status.rx_packets());
-    const auto& rec_bytes = std::to_string(if_status.rx_bytes());
-    const auto& sent_packets = std::to_string(if_status.tx_packets());
-    const auto& sent_bytes = std::to_string(if_status.tx_bytes());
+void SystemEventProtoHandler::FlushStatusRollup() {
+    ingest_worker_.Enqueue([this]() {
+        WriteStatusRollup(true);
+    });
+}
 
-    std::string interface_id = "-1";
+void SystemEventProtoHandler::WriteStatusRollup(bool include_open) {
+    const auto& rollup_rows = status_rollup_.GetRows(include_open);
+    if (rollup_rows.rows.empty()) {
+        return;
+    }
     try {
-        interface_id = std::to_string(interface_id_cache_.at(GetInterfaceKey(hostname, if_status.name())));
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "Failed to insert InterfaceStatus for hostname '" << hostname << "', " << oor_ex.what() << "\n";
-        throw;
+        database_->InsertMultipleValues({rollup_rows}, experiment_run_id_, DatabaseValue());
+        status_rollup_.DiscardRows(include_open);
+    } catch (const std::exception& e) {
+        // Intervals are kept and retried with the next write, the raw status rows are already written
+        std::cerr << "An exception occured while trying to write " << rollup_rows.rows.size() << " SystemStatusRollup rows: " << e.what() << std::endl;
+    }
+}
+
+AggServer::DeferredMetrics SystemEventProtoHandler::GetDeferredMetrics() const {
+    AggServer::DeferredMetrics total;
+    for (const auto& metrics : {
+        deferred_status_events_.GetMetrics(),
+        deferred_interface_status_.GetMetrics(),
+        deferred_filesystem_status_.GetMetrics(),
+        deferred_process_status_.GetMetrics()
+    }) {
+        total.parked_count += metrics.parked_count;
+        total.released_count += metrics.released_count;
+        total.dropped_count += metrics.dropped_count;
+        total.pending_count += metrics.pending_count;
     }
+    return total;
+}
 
-    database_->InsertValues(
+DatabaseClient::TableRows SystemEventProtoHandler::MakeInterfaceStatusRows() {
+    return {
         "Hardware.InterfaceStatus",
-        {"InterfaceID", "PacketsReceived", "BytesReceived", "PacketsTransmitted", "BytesTransmitted", "SampleTime"},
-        {interface_id, rec_packets, rec_bytes, sent_packets, sent_bytes, timestamp}
-    );
-    database_->UpdateLastSampleTime(experiment_run_id_, timestamp);
+        {"ExperimentRunID", "InterfaceID", "PacketsReceived", "BytesReceived", "PacketsTransmitted", "BytesTransmitted", "SampleTime"},
+        {}
+    };
 }
 
-void SystemEventProtoHandler::ProcessFileSystemStatus(
-    const SystemEvent::FileSystemStatus& fs_status,
-    const std::string& hostname,
-    const std::string& timestamp
-) {
-    const auto& util = std::to_string(fs_status.utilization());
+DatabaseClient::TableRows SystemEventProtoHandler::MakeFileSystemStatusRows() {
+    return {
+        "Hardware.FilesystemStatus",
+        {"ExperimentRunID", "FilesystemID", "Utilisation", "SampleTime"},
+        {}
+    };
+}
 
-    std::string filesystem_id = "-1";
+DatabaseClient::TableRows SystemEventProtoHandler::MakeProcessStatusRows() {
+    return {
+        "Hardware.ProcessStatus",
+        {"ExperimentRunID", "ProcessID", "CoreID", "CPUUtilisation", "PhysMemUtilisation", "PhysMemUsedKB", "ThreadCount", "DiskRead", "DiskWritten", "DiskTotal", "CPUTime", "State", "SampleTime"},
+        {}
+    };
+}
+
+void SystemEventProtoHandler::ReleaseDeferredStatusEvents(const std::string& hostname) {
+    auto events = deferred_status_events_.Release(hostname);
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const auto& event = events[i];
+        try {
+            InsertStatusEvent(event, [this, hostname, event](bool committed) {
+                if (!committed) {
+                    deferred_status_events_.Restore(hostname, {event});
+                }
+            });
+        } catch (const std::exception& e) {
+            deferred_status_events_.Restore(hostname, std::vector<SystemEvent::StatusEvent>(events.begin() + i, events.end()));
+            throw;
+        }
+    }
+}
+
+template <class Status, class Key, class KeyHash>
+void SystemEventProtoHandler::ReleaseDeferredRows(
+    AggServer::DeferredQueue<Key, DeferredStatus<Status>, KeyHash>& queue,
+    const Key& key,
+    DatabaseClient::TableRows table,
+    std::function<bool (const Status&, const DatabaseValue&, std::vector<DatabaseRow>&)> append
+) {
+    auto parked = queue.Release(key);
+    if (parked.empty()) {
+        return;
+    }
+    for (const auto& deferred : parked) {
+        append(deferred.status, deferred.sample_time, table.rows);
+    }
     try {
-        filesystem_id = std::to_string(filesystem_id_cache_.at(GetFileSystemKey(hostname, fs_status.name())));
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "Failed to insert FileSytemStatus for hostname '" << hostname << "', " << oor_ex.what() << "\n";
+        database_->InsertMultipleValues({table}, experiment_run_id_, DatabaseValue(), [&queue, key, parked](bool committed) {
+            if (!committed) {
+                queue.Restore(key, parked);
+            }
+        });
+    } catch (const std::exception& e) {
+        queue.Restore(key, std::move(parked));
         throw;
     }
+}
 
-    database_->InsertValues(
-        "Hardware.FilesystemStatus",
-        {"FilesystemID", "Utilisation", "SampleTime"},
-        {filesystem_id, util, timestamp}
-    );
-    database_->UpdateLastSampleTime(experiment_run_id_, timestamp);
+bool SystemEventProtoHandler::AppendInterfaceStatus(
+    const SystemEvent::InterfaceStatus& if_status,
+    int host_handle,
+    const DatabaseValue& sample_time,
+    std::vector<DatabaseRow>& rows
+) {
+    const int interface_id = interface_id_cache_.Get(GetInterfaceKey(host_handle, FindNameHandle(if_status.name())));
+    if (interface_id == AggServer::IDCache<uint64_t>::invalid_id) {
+        deferred_interface_status_.Park(GetInterfaceKey(host_handle, name_handles_.Intern(if_status.name())), {if_status, sample_time});
+        return false;
+    }
+
+    rows.push_back({
+        experiment_run_id_,
+        interface_id,
+        if_status.rx_packets(),
+        if_status.rx_bytes(),
+        if_status.tx_packets(),
+        if_status.tx_bytes(),
+        sample_time
+    });
+    return true;
+}
+
+bool SystemEventProtoHandler::AppendFileSystemStatus(
+    const SystemEvent::FileSystemStatus& fs_status,
+    int host_handle,
+    const DatabaseValue& sample_time,
+    std::vector<DatabaseRow>& rows
+) {
+    const int filesystem_id = filesystem_id_cache_.Get(GetFileSystemKey(host_handle, FindNameHandle(fs_status.name())));
+    if (filesystem_id == AggServer::IDCache<uint64_t>::invalid_id) {
+        deferred_filesystem_status_.Park(GetFileSystemKey(host_handle, name_handles_.Intern(fs_status.name())), {fs_status, sample_time});
+        return false;
+    }
+
+    rows.push_back({
+        experiment_run_id_,
+        filesystem_id,
+        fs_status.utilization(),
+        sample_time
+    });
+    return true;
 }
 
-void SystemEventProtoHandler::ProcessProcessStatus(
+bool SystemEventProtoHandler::AppendProcessStatus(
     const SystemEvent::ProcessStatus& p_status,
-    const std::string& hostname,
-    const std::string& timestamp
+    int host_handle,
+    const DatabaseValue& sample_time,
+    std::vector<DatabaseRow>& rows
 ) {
-    const auto& pid = std::to_string(p_status.pid());
-    const auto& name = p_status.name();
-
-    const auto& core_id = std::to_string(p_status.cpu_core_id());
-    const auto& cpu_util = std::to_string(p_status.cpu_utilization());
-    const auto& phys_mem_util = std::to_string(p_status.phys_mem_utilization());
-    const auto& phys_mem_used_kb = std::to_string(p_status.phys_mem_used_kb());
-
-    const auto& threads = std::to_string(p_status.thread_count());
-    const auto& disk_read_kb = std::to_string(p_status.disk_read_kilobytes());
-    const auto& disk_write_kb = std::to_string(p_status.disk_written_kilobytes());
-    const auto& disk_total_kb = std::to_string(p_status.disk_total_kilobytes());
-
-    const auto& cpu_time = TimeUtil::ToString(p_status.cpu_time());
-    const auto& state = SystemEvent::ProcessStatus::State_Name(p_status.state());
-    const auto& start_time = TimeUtil::ToString(p_status.start_time());
-    
-    std::string process_id = "-1";
-    try {
-        process_id = std::to_string(process_id_cache_.at(GetProcessKey(hostname, p_status.pid(), start_time)));
-    } catch (const std::out_of_range& oor_ex) {
-        std::cerr << "Failed to insert ProcessStatus for hostname '" << hostname << "', " << oor_ex.what() << "\n";
-        throw;
+    const auto& process_key = GetProcessKey(host_handle, p_status.pid(), p_status.start_time());
+    const int process_id = process_id_cache_.Get(process_key);
+    if (process_id == AggServer::IDCache<ProcessKey, ProcessKeyHash>::invalid_id) {
+        deferred_process_status_.Park(process_key, {p_status, sample_time});
+        return false;
     }
-    
-    database_->InsertValues(
-        "Hardware.ProcessStatus",
-        {"ProcessID", "CoreID", "CPUUtilisation", "PhysMemUtilisation", "PhysMemUsedKB", "ThreadCount", "DiskRead", "DiskWritten", "DiskTotal", "CPUTime", "State", "SampleTime"},
-        {process_id, core_id, cpu_util, phys_mem_util, phys_mem_used_kb, threads, disk_read_kb, disk_write_kb, disk_total_kb, cpu_time, state, timestamp}
-    );
-    database_->UpdateLastSampleTime(experiment_run_id_, timestamp);
+
+    rows.push_back({
+        experiment_run_id_,
+        process_id,
+        p_status.cpu_core_id(),
+        p_status.cpu_utilization(),
+        p_status.phys_mem_utilization(),
+        p_status.phys_mem_used_kb(),
+        p_status.thread_count(),
+        p_status.disk_read_kilobytes(),
+        p_status.disk_written_kilobytes(),
+        p_status.disk_total_kilobytes(),
+        TimeUtil::ToString(p_status.cpu_time()),
+        SystemEvent::ProcessStatus::State_Name(p_status.state()),
+        sample_time
+    });
+    return true;
 }
 
 void SystemEventProtoHandler::ProcessInfoEvent(const SystemEvent::InfoEvent& info) {
@@ -168,7 +332,7 @@ void SystemEventProtoHandler::ProcessInfoEvent(const SystemEvent::InfoEvent& inf
         {"NodeID"}
     );
 
-    system_id_cache_.emplace(std::make_pair(hostname, system_id));
+    system_id_cache_.Insert(hostname, system_id);
     std::cout << "Adding system info for hostname: " << hostname << " with id " << system_id << std::endl;
 
     for (const auto& fs_info : info.file_system_info()) {
@@ -178,6 +342,9 @@ void SystemEventProtoHandler::ProcessInfoEvent(const SystemEvent::InfoEvent& inf
     for (const auto& i_info : info.interface_info()) {
         ProcessInterfaceInfo(i_info, hostname, node_id);
     }
+
+    // Interfaces and filesystems are registered first, so none of the released events' rows are parked again
+    ReleaseDeferredStatusEvents(hostname);
 }
 
 
@@ -198,8 +365,18 @@ void SystemEventProtoHandler::ProcessFileSystemInfo(
         {"NodeID", "Name"}
     );
 
-    filesystem_id_cache_.emplace(
-        std::make_pair(GetFileSystemKey(hostname, name), filesystem_id)
+    const int host_handle = hostname_handles_.Intern(hostname);
+    const auto& filesystem_key = GetFileSystemKey(host_handle, name_handles_.Intern(name));
+    filesystem_id_cache_.Insert(filesystem_key, filesystem_id);
+
+    ReleaseFileSystemStatus(filesystem_key, host_handle);
+}
+
+void SystemEventProtoHandler::ReleaseFileSystemStatus(uint64_t filesystem_key, int host_handle) {
+    ReleaseDeferredRows<SystemEvent::FileSystemStatus>(deferred_filesystem_status_, filesystem_key, MakeFileSystemStatusRows(),
+        [this, host_handle](const SystemEvent::FileSystemStatus& fs_status, const DatabaseValue& sample_time, std::vector<DatabaseRow>& rows) {
+            return AppendFileSystemStatus(fs_status, host_handle, sample_time, rows);
+        }
     );
 }
 
@@ -224,8 +401,18 @@ void SystemEventProtoHandler::ProcessInterfaceInfo(
         {"NodeID", "Name"}
     );
 
-    interface_id_cache_.emplace(
-        std::make_pair(GetInterfaceKey(hostname, name), interface_id)
+    const int host_handle = hostname_handles_.Intern(hostname);
+    const auto& interface_key = GetInterfaceKey(host_handle, name_handles_.Intern(name));
+    interface_id_cache_.Insert(interface_key, interface_id);
+
+    ReleaseInterfaceStatus(interface_key, host_handle);
+}
+
+void SystemEventProtoHandler::ReleaseInterfaceStatus(uint64_t interface_key, int host_handle) {
+    ReleaseDeferredRows<SystemEvent::InterfaceStatus>(deferred_interface_status_, interface_key, MakeInterfaceStatusRows(),
+        [this, host_handle](const SystemEvent::InterfaceStatus& if_status, const DatabaseValue& sample_time, std::vector<DatabaseRow>& rows) {
+            return AppendInterfaceStatus(if_status, host_handle, sample_time, rows);
+        }
     );
 }
 
@@ -245,31 +432,183 @@ void SystemEventProtoHandler::ProcessProcessInfo(const SystemEvent::ProcessInfo&
         {"NodeID", "pID", "StartTime"}
     );
 
-    process_id_cache_.emplace(
-        std::make_pair(GetProcessKey(hostname, p_info.pid(), time_str), process_id)
+    const int host_handle = hostname_handles_.Intern(hostname);
+    const auto& process_key = GetProcessKey(host_handle, p_info.pid(), p_info.start_time());
+    process_id_cache_.Insert(process_key, process_id);
+
+    ReleaseProcessStatus(process_key);
+}
+
+void SystemEventProtoHandler::ReleaseProcessStatus(const ProcessKey& process_key) {
+    const int host_handle = process_key.host_handle;
+    ReleaseDeferredRows<SystemEvent::ProcessStatus>(deferred_process_status_, process_key, MakeProcessStatusRows(),
+        [this, host_handle](const SystemEvent::ProcessStatus& p_status, const DatabaseValue& sample_time, std::vector<DatabaseRow>& rows) {
+            return AppendProcessStatus(p_status, host_handle, sample_time, rows);
+        }
     );
 }
 
+void SystemEventProtoHandler::FlushDeferredStatus() {
+    ingest_worker_.Enqueue([this]() {
+        WriteDeferredStatus();
+    });
+}
 
+void SystemEventProtoHandler::WriteDeferredStatus() {
+    // Whole events first, writing them can park rows of their own
+    for (const auto& hostname : deferred_status_events_.GetKeys()) {
+        try {
+            if (LoadSystemID(hostname)) {
+                ReleaseDeferredStatusEvents(hostname);
+            } else {
+                deferred_status_events_.Drop(hostname);
+            }
+        } catch (const std::exception& e) {
+            // Restored by the release, left parked
+            std::cerr << "An exception occured while writing parked StatusEvents for " << hostname << ": " << e.what() << std::endl;
+        }
+    }
 
-std::string SystemEventProtoHandler::GetInterfaceKey(
-    const std::string& hostname,
-    const std::string& if_name
+    for (const auto& interface_key : deferred_interface_status_.GetKeys()) {
+        try {
+            if (LoadInterfaceID(interface_key)) {
+                ReleaseInterfaceStatus(interface_key, static_cast<int>(interface_key >> 32));
+            } else {
+                deferred_interface_status_.Drop(interface_key);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "An exception occured while writing parked InterfaceStatus rows: " << e.what() << std::endl;
+        }
+    }
+
+    for (const auto& filesystem_key : deferred_filesystem_status_.GetKeys()) {
+        try {
+            if (LoadFileSystemID(filesystem_key)) {
+                ReleaseFileSystemStatus(filesystem_key, static_cast<int>(filesystem_key >> 32));
+            } else {
+                deferred_filesystem_status_.Drop(filesystem_key);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "An exception occured while writing parked FileSystemStatus rows: " << e.what() << std::endl;
+        }
+    }
+
+    for (const auto& process_key : deferred_process_status_.GetKeys()) {
+        try {
+            if (LoadProcessID(process_key)) {
+                ReleaseProcessStatus(process_key);
+            } else {
+                deferred_process_status_.Drop(process_key);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "An exception occured while writing parked ProcessStatus rows: " << e.what() << std::endl;
+        }
+    }
+}
+
+bool SystemEventProtoHandler::LoadSystemID(const std::string& hostname) {
+    int node_id = -1;
+    try {
+        node_id = experiment_tracker_.GetNodeIDFromHostname(experiment_run_id_, hostname);
+    } catch (const std::runtime_error& e) {
+        // Not a node of this run
+        return false;
+    }
+    const int system_id = database_->FindID("Hardware.System", "SystemID", {"NodeID"}, {std::to_string(node_id)});
+    if (system_id == -1) {
+        return false;
+    }
+    system_id_cache_.Insert(hostname, system_id);
+    return true;
+}
+
+bool SystemEventProtoHandler::LoadInterfaceID(uint64_t interface_key) {
+    // Keys pack the host and interface name handles, see GetInterfaceKey
+    const auto& hostname = hostname_handles_.Lookup(static_cast<int>(interface_key >> 32));
+    const auto& name = name_handles_.Lookup(static_cast<int>(static_cast<uint32_t>(interface_key)));
+    const int node_id = experiment_tracker_.GetNodeIDFromHostname(experiment_run_id_, hostname);
+    const int interface_id = database_->FindID("Hardware.Interface", "InterfaceID", {"NodeID", "Name"}, {std::to_string(node_id), name});
+    if (interface_id == -1) {
+        return false;
+    }
+    interface_id_cache_.Insert(interface_key, interface_id);
+    return true;
+}
+
+bool SystemEventProtoHandler::LoadFileSystemID(uint64_t filesystem_key) {
+    const auto& hostname = hostname_handles_.Lookup(static_cast<int>(filesystem_key >> 32));
+    const auto& name = name_handles_.Lookup(static_cast<int>(static_cast<uint32_t>(filesystem_key)));
+    const int node_id = experiment_tracker_.GetNodeIDFromHostname(experiment_run_id_, hostname);
+    const int filesystem_id = database_->FindID("Hardware.Filesystem", "FilesystemID", {"NodeID", "Name"}, {std::to_string(node_id), name});
+    if (filesystem_id == -1) {
+        return false;
+    }
+    filesystem_id_cache_.Insert(filesystem_key, filesystem_id);
+    return true;
+}
+
+bool SystemEventProtoHandler::LoadProcessID(const ProcessKey& process_key) {
+    const auto& hostname = hostname_handles_.Lookup(process_key.host_handle);
+    const int node_id = experiment_tracker_.GetNodeIDFromHostname(experiment_run_id_, hostname);
+    google::protobuf::Timestamp start_time;
+    start_time.set_seconds(process_key.start_seconds);
+    start_time.set_nanos(process_key.start_nanos);
+    const int process_id = database_->FindID(
+        "Hardware.Process",
+        "ProcessID",
+        {"NodeID", "pID", "StartTime"},
+        {std::to_string(node_id), std::to_string(process_key.pid), TimeUtil::ToString(start_time)}
+    );
+    if (process_id == -1) {
+        return false;
+    }
+    process_id_cache_.Insert(process_key, process_id);
+    return true;
+}
+
+
+
+bool SystemEventProtoHandler::ProcessKey::operator==(const ProcessKey& other) const {
+    return host_handle == other.host_handle &&
+        pid == other.pid &&
+        start_seconds == other.start_seconds &&
+        start_nanos == other.start_nanos;
+}
+
+std::size_t SystemEventProtoHandler::ProcessKeyHash::operator()(const ProcessKey& key) const {
+    std::size_t hash = std::hash<int>()(key.host_handle);
+    hash = AggServer::HashCombine(hash, std::hash<int>()(key.pid));
+    hash = AggServer::HashCombine(hash, std::hash<int64_t>()(key.start_seconds));
+    return AggServer::HashCombine(hash, std::hash<int32_t>()(key.start_nanos));
+}
+
+int SystemEventProtoHandler::FindNameHandle(const std::string& name) const {
+    return name_handles_.Find(name);
+}
+
+uint64_t SystemEventProtoHandler::GetInterfaceKey(
+    int host_handle,
+    int if_name_handle
 ) const {
-    return hostname + "/" + if_name;
+    return AggServer::MakeHandlePairKey(host_handle, if_name_handle);
 }
 
-std::string SystemEventProtoHandler::GetFileSystemKey(
-    const std::string& hostname,
-    const std::string& fs_name
+uint64_t SystemEventProtoHandler::GetFileSystemKey(
+    int host_handle,
+    int fs_name_handle
 ) const {
-    return hostname + "/" + fs_name;
+    return AggServer::MakeHandlePairKey(host_handle, fs_name_handle);
 }
 
-std::string SystemEventProtoHandler::GetProcessKey(
-    const std::string& hostname,
+SystemEventProtoHandler::ProcessKey SystemEventProtoHandler::GetProcessKey(
+    int host_handle,
     int pid,
-    const std::string& starttime
+    const google::protobuf::Timestamp& start_time
 ) const {
-    return hostname + "/" + std::to_string(pid) + "_" + starttime;
+    ProcessKey key;
+    key.host_handle = host_handle;
+    key.pid = pid;
+    key.start_seconds = start_time.seconds();
+    key.start_nanos = start_time.nanos();
+    return key;
 }
@@ -2,37 +2,84 @@
 #define SYSTEMEVENTPROTOHANDLER_H
 
 #include "aggregationprotohandler.h"
+#include "ingestworker.h"
+#include "idcache.h"
+#include "sequencetracker.h"
+#include "systemstatusrollup.h"
+#include "deferredqueue.h"
+#include "databasevalue.h"
 
 #include <proto/systemevent/systemevent.pb.h>
 
-#include <map>
+#include <string>
+#include <vector>
 
 class SystemEventProtoHandler : public AggregationProtoHandler {
 public:
-    SystemEventProtoHandler(std::shared_ptr<DatabaseClient> db_client, ExperimentTracker& exp_tracker, int experiment_run_id) 
-        : AggregationProtoHandler(db_client, exp_tracker), experiment_run_id_(experiment_run_id) {};
+    SystemEventProtoHandler(std::shared_ptr<DatabaseClient> db_client, ExperimentTracker& exp_tracker, int experiment_run_id, IngestWorker& ingest_worker)
+        : AggregationProtoHandler(db_client, exp_tracker), experiment_run_id_(experiment_run_id), ingest_worker_(ingest_worker),
+          status_rollup_(experiment_run_id) {};
 
     void BindCallbacks(zmq::ProtoReceiver& ProtoReceiver);
 
+    // Duplicate and gap counts for StatusEvents, tracked per hostname
+    SequenceTracker::Metrics GetSequenceMetrics() const;
+
+    // Queues a write of every Hardware.SystemStatusRollup interval on the writer thread, including those still open
+    void FlushStatusRollup();
+
+    // Status samples parked because they arrived before the InfoEvent or ProcessInfo registering their IDs
+    AggServer::DeferredMetrics GetDeferredMetrics() const;
+
+    // Queues a last attempt, on the writer thread, at the samples still parked. Their IDs are looked up in the database,
+    // ie. registered by an earlier process of a resumed run, and any sample whose ID still isn't found is dropped
+    void FlushDeferredStatus();
+
 private:
     // Hardware callbacks
     void ProcessStatusEvent(const SystemEvent::StatusEvent& status);
-    void ProcessInterfaceStatus(
+    // on_written is told whether the event's rows were committed, a parked event counts as handled
+    void InsertStatusEvent(const SystemEvent::StatusEvent& status, const DatabaseClient::WriteCallback& on_written);
+    void WriteStatusRollup(bool include_open);
+    // Status rows are collected per table and written together, rows whose IDs are unknown are parked until registered
+    bool AppendInterfaceStatus(
         const SystemEvent::InterfaceStatus& if_status,
-        const std::string& hostname,
-        const std::string& timestamp
+        int host_handle,
+        const DatabaseValue& sample_time,
+        std::vector<DatabaseRow>& rows
     );
-    void ProcessFileSystemStatus(
+    bool AppendFileSystemStatus(
         const SystemEvent::FileSystemStatus& fs_status,
-        const std::string& hostname,
-        const std::string& timestamp
+        int host_handle,
+        const DatabaseValue& sample_time,
+        std::vector<DatabaseRow>& rows
     );
-    void ProcessProcessStatus(
+    bool AppendProcessStatus(
         const SystemEvent::ProcessStatus& p_status,
-        const std::string& hostname,
-        const std::string& timestamp
+        int host_handle,
+        const DatabaseValue& sample_time,
+        std::vector<DatabaseRow>& rows
     );
     void ProcessInfoEvent(const SystemEvent::InfoEvent& info);
+
+    template <class Status>
+    struct DeferredStatus {
+        Status status;
+        DatabaseValue sample_time;
+    };
+    // Writes the events or rows parked under a newly registered ID, they are parked again if the write fails
+    void ReleaseDeferredStatusEvents(const std::string& hostname);
+    template <class Status, class Key, class KeyHash>
+    void ReleaseDeferredRows(
+        AggServer::DeferredQueue<Key, DeferredStatus<Status>, KeyHash>& queue,
+        const Key& key,
+        DatabaseClient::TableRows table,
+        std::function<bool (const Status&, const DatabaseValue&, std::vector<DatabaseRow>&)> append
+    );
+    static DatabaseClient::TableRows MakeInterfaceStatusRows();
+    static DatabaseClient::TableRows MakeFileSystemStatusRows();
+    static DatabaseClient::TableRows MakeProcessStatusRows();
+
     void ProcessFileSystemInfo(
         const SystemEvent::FileSystemInfo& fs_info,
         const std::string& hostname,
@@ -48,19 +95,58 @@ private:
         const std::string& hostname
     );
 
-    // ID lookup key generator helper functions
-    std::string GetInterfaceKey(const std::string& hostname, const std::string& if_name) const;
-    std::string GetFileSystemKey(const std::string& hostname, const std::string& fs_name) const;
-    std::string GetProcessKey(const std::string& hostname, int pid, const std::string& starttime) const;
+    // ID lookup keys, built from interned handles so per sample lookups don't allocate
+    struct ProcessKey {
+        int host_handle = -1;
+        int pid = 0;
+        int64_t start_seconds = 0;
+        int32_t start_nanos = 0;
+        bool operator==(const ProcessKey& other) const;
+    };
+    struct ProcessKeyHash {
+        std::size_t operator()(const ProcessKey& key) const;
+    };
+
+    // Returns IDCache::invalid_id if the name was never registered by an InfoEvent
+    int FindNameHandle(const std::string& name) const;
+    uint64_t GetInterfaceKey(int host_handle, int if_name_handle) const;
+    uint64_t GetFileSystemKey(int host_handle, int fs_name_handle) const;
+    ProcessKey GetProcessKey(int host_handle, int pid, const google::protobuf::Timestamp& start_time) const;
+
+    // Write whatever was parked under a newly registered ID
+    void ReleaseInterfaceStatus(uint64_t interface_key, int host_handle);
+    void ReleaseFileSystemStatus(uint64_t filesystem_key, int host_handle);
+    void ReleaseProcessStatus(const ProcessKey& process_key);
+
+    void WriteDeferredStatus();
+    // Each returns false if the ID isn't in the database either
+    bool LoadSystemID(const std::string& hostname);
+    bool LoadInterfaceID(uint64_t interface_key);
+    bool LoadFileSystemID(uint64_t filesystem_key);
+    bool LoadProcessID(const ProcessKey& process_key);
 
     // Experiment info
     int experiment_run_id_;
+    IngestWorker& ingest_worker_;
+
+    SequenceTracker status_sequences_;
+    SystemStatusRollup status_rollup_;
+
+    // Interned hostnames and interface/filesystem names
+    AggServer::StringInterner hostname_handles_;
+    AggServer::StringInterner name_handles_;
 
     // Cache maps
-    std::map<std::string, int> system_id_cache_; // hostname -> SystemID
-    std::map<std::string, int> filesystem_id_cache_; // hostname/fs_name -> FileSystemID
-    std::map<std::string, int> interface_id_cache_; // hostname/if_name -> InterfaceID
-    std::map<std::string, int> process_id_cache_; // hostname/pID/starttime -> InterfaceID
+    AggServer::IDCache<std::string> system_id_cache_; // hostname -> SystemID
+    AggServer::IDCache<uint64_t> filesystem_id_cache_; // hostname/fs_name -> FileSystemID
+    AggServer::IDCache<uint64_t> interface_id_cache_; // hostname/if_name -> InterfaceID
+    AggServer::IDCache<ProcessKey, ProcessKeyHash> process_id_cache_; // hostname/pID/starttime -> ProcessID
+
+    // Samples waiting on their IDs, keyed the same way as the caches above
+    AggServer::DeferredQueue<std::string, SystemEvent::StatusEvent> deferred_status_events_;
+    AggServer::DeferredQueue<uint64_t, DeferredStatus<SystemEvent::InterfaceStatus> > deferred_interface_status_;
+    AggServer::DeferredQueue<uint64_t, DeferredStatus<SystemEvent::FileSystemStatus> > deferred_filesystem_status_;
+    AggServer::DeferredQueue<ProcessKey, DeferredStatus<SystemEvent::ProcessStatus>, ProcessKeyHash> deferred_process_status_;
 };
 
 
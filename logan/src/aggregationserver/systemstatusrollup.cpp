@@ -0,0 +1,179 @@
+#include "systemstatusrollup.h"
+
+#include <algorithm>
+
+#include <google/protobuf/util/time_util.h>
+
+using google::protobuf::util::TimeUtil;
+
+namespace {
+    const int64_t microseconds_per_second = 1000000;
+
+    int64_t FloorToInterval(int64_t time_us, int64_t interval_us) {
+        int64_t interval_start = (time_us / interval_us) * interval_us;
+        if (interval_start > time_us) {
+            interval_start -= interval_us;
+        }
+        return interval_start;
+    }
+}
+
+SystemStatusRollup::SystemStatusRollup(int experiment_run_id) :
+    experiment_run_id_(experiment_run_id),
+    intervals_(GetResolutions().size())
+{
+}
+
+const std::vector<int>& SystemStatusRollup::GetResolutions() {
+    static const std::vector<int> resolutions = {1, 10, 60, 600};
+    return resolutions;
+}
+
+void SystemStatusRollup::AddToSummary(Summary& summary, double value, bool first, bool latest) {
+    if (first) {
+        summary.min = value;
+        summary.max = value;
+    } else {
+        summary.min = std::min(summary.min, value);
+        summary.max = std::max(summary.max, value);
+    }
+    summary.total += value;
+    if (latest) {
+        summary.last = value;
+    }
+}
+
+void SystemStatusRollup::Add(int system_id, double cpu_utilisation, double mem_utilisation, const google::protobuf::Timestamp& sample_time) {
+    const int64_t sample_us = TimeUtil::TimestampToMicroseconds(sample_time);
+
+    for (std::size_t i = 0; i < intervals_.size(); i++) {
+        const int64_t interval_us = GetResolutions()[i] * microseconds_per_second;
+        auto& interval = intervals_[i][std::make_pair(FloorToInterval(sample_us, interval_us), system_id)];
+
+        const bool first = (interval.sample_count == 0);
+        const bool latest = first || sample_us >= interval.last_sample_time;
+        AddToSummary(interval.cpu, cpu_utilisation, first, latest);
+        AddToSummary(interval.mem, mem_utilisation, first, latest);
+        if (latest) {
+            interval.last_sample_time = sample_us;
+        }
+        interval.sample_count++;
+    }
+
+    watermark_us_ = std::max(watermark_us_, sample_us);
+    if (last_open_refresh_us_ == INT64_MIN) {
+        last_open_refresh_us_ = sample_us;
+    }
+}
+
+bool SystemStatusRollup::IsComplete(int64_t interval_start, std::size_t resolution_index) const {
+    return interval_start + GetResolutions()[resolution_index] * microseconds_per_second <= watermark_us_;
+}
+
+bool SystemStatusRollup::IsOpenRefreshDue() const {
+    return last_open_refresh_us_ != INT64_MIN
+        && watermark_us_ - last_open_refresh_us_ >= open_refresh_seconds * microseconds_per_second;
+}
+
+bool SystemStatusRollup::HasRowsToWrite() const {
+    if (IsOpenRefreshDue()) {
+        return true;
+    }
+    for (std::size_t i = 0; i < intervals_.size(); i++) {
+        if (!intervals_[i].empty() && IsComplete(intervals_[i].begin()->first.first, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+DatabaseClient::TableRows SystemStatusRollup::GetRows(bool include_open) const {
+    DatabaseClient::TableRows table{
+        "Hardware.SystemStatusRollup",
+        {"ExperimentRunID", "SystemID", "ResolutionSeconds", "IntervalStart", "SampleCount", "LastSampleTime",
+            "CPUMin", "CPUMax", "CPUAvg", "CPULast", "PhysMemMin", "PhysMemMax", "PhysMemAvg", "PhysMemLast"},
+        {}
+    };
+    // Rows written twice for the same interval are merged, the averages are weighted by each row's SampleCount
+    table.on_conflict =
+        "(ExperimentRunID, SystemID, ResolutionSeconds, IntervalStart) DO UPDATE SET"
+        " SampleCount = SystemStatusRollup.SampleCount + EXCLUDED.SampleCount,"
+        " LastSampleTime = GREATEST(SystemStatusRollup.LastSampleTime, EXCLUDED.LastSampleTime),"
+        " CPUMin = LEAST(SystemStatusRollup.CPUMin, EXCLUDED.CPUMin),"
+        " CPUMax = GREATEST(SystemStatusRollup.CPUMax, EXCLUDED.CPUMax),"
+        " CPUAvg = (SystemStatusRollup.CPUAvg * SystemStatusRollup.SampleCount + EXCLUDED.CPUAvg * EXCLUDED.SampleCount)"
+        " / (SystemStatusRollup.SampleCount + EXCLUDED.SampleCount),"
+        " CPULast = CASE WHEN EXCLUDED.LastSampleTime >= SystemStatusRollup.LastSampleTime THEN EXCLUDED.CPULast ELSE SystemStatusRollup.CPULast END,"
+        " PhysMemMin = LEAST(SystemStatusRollup.PhysMemMin, EXCLUDED.PhysMemMin),"
+        " PhysMemMax = GREATEST(SystemStatusRollup.PhysMemMax, EXCLUDED.PhysMemMax),"
+        " PhysMemAvg = (SystemStatusRollup.PhysMemAvg * SystemStatusRollup.SampleCount + EXCLUDED.PhysMemAvg * EXCLUDED.SampleCount)"
+        " / (SystemStatusRollup.SampleCount + EXCLUDED.SampleCount),"
+        " PhysMemLast = CASE WHEN EXCLUDED.LastSampleTime >= SystemStatusRollup.LastSampleTime THEN EXCLUDED.PhysMemLast ELSE SystemStatusRollup.PhysMemLast END";
+
+    for (std::size_t i = 0; i < intervals_.size(); i++) {
+        for (const auto& interval_pair : intervals_[i]) {
+            const int64_t interval_start = interval_pair.first.first;
+            if (!include_open && !IsComplete(interval_start, i)) {
+                break;
+            }
+            const auto& interval = interval_pair.second;
+            const double sample_count = static_cast<double>(interval.sample_count);
+
+            table.rows.push_back({
+                experiment_run_id_,
+                interval_pair.first.second,
+                GetResolutions()[i],
+                TimeUtil::MicrosecondsToTimestamp(interval_start),
+                interval.sample_count,
+                TimeUtil::MicrosecondsToTimestamp(interval.last_sample_time),
+                interval.cpu.min,
+                interval.cpu.max,
+                interval.cpu.total / sample_count,
+                interval.cpu.last,
+                interval.mem.min,
+                interval.mem.max,
+                interval.mem.total / sample_count,
+                interval.mem.last
+            });
+        }
+    }
+    return table;
+}
+
+void SystemStatusRollup::DiscardRows(bool include_open) {
+    for (std::size_t i = 0; i < intervals_.size(); i++) {
+        auto interval_it = intervals_[i].begin();
+        while (interval_it != intervals_[i].end() && (include_open || IsComplete(interval_it->first.first, i))) {
+            interval_it = intervals_[i].erase(interval_it);
+        }
+    }
+    if (include_open) {
+        last_open_refresh_us_ = watermark_us_;
+    }
+}
+
+const std::string& SystemStatusRollup::GetCreateTableQuery() {
+    static const std::string query =
+        "CREATE TABLE IF NOT EXISTS Hardware.SystemStatusRollup\n"
+        "(\n"
+        "  ExperimentRunID      INT NOT NULL ,\n"
+        "  SystemID             INT NOT NULL ,\n"
+        "  ResolutionSeconds    INT NOT NULL ,\n"
+        "  IntervalStart        TIMESTAMP NOT NULL ,\n"
+        "  SampleCount          BIGINT NOT NULL ,\n"
+        "  LastSampleTime       TIMESTAMP NOT NULL ,\n"
+        "  CPUMin               DOUBLE PRECISION NOT NULL ,\n"
+        "  CPUMax               DOUBLE PRECISION NOT NULL ,\n"
+        "  CPUAvg               DOUBLE PRECISION NOT NULL ,\n"
+        "  CPULast              DOUBLE PRECISION NOT NULL ,\n"
+        "  PhysMemMin           DOUBLE PRECISION NOT NULL ,\n"
+        "  PhysMemMax           DOUBLE PRECISION NOT NULL ,\n"
+        "  PhysMemAvg           DOUBLE PRECISION NOT NULL ,\n"
+        "  PhysMemLast          DOUBLE PRECISION NOT NULL ,\n"
+        "\n"
+        "  PRIMARY KEY (ExperimentRunID, SystemID, ResolutionSeconds, IntervalStart),\n"
+        "  CONSTRAINT FK_SystemStatusRollup_ExperimentRunID_ExperimentRun_ExperimentRunID FOREIGN KEY (ExperimentRunID) REFERENCES ExperimentRun (ExperimentRunID),\n"
+        "  CONSTRAINT FK_SystemStatusRollup_SystemID_System_SystemID FOREIGN KEY (SystemID) REFERENCES Hardware.System (SystemID)\n"
+        ");\n";
+    return query;
+}
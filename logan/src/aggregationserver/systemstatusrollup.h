@@ -0,0 +1,69 @@
+#ifndef SYSTEMSTATUSROLLUP_H
+#define SYSTEMSTATUSROLLUP_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <google/protobuf/timestamp.pb.h>
+
+#include "databaseclient.h"
+
+// Maintains Hardware.SystemStatusRollup, a min/max/avg/last summary of each system's CPU and memory utilisation
+// at every resolution in GetResolutions(), so charts over long runs can read one row per interval instead of every sample.
+// An interval is written once the run has seen a sample past its end. Open intervals are also refreshed every
+// open_refresh_seconds of SampleTime so coarse charts of a live run stay current; rows upsert, so a refreshed
+// interval is merged with whatever is written for it later.
+// Not thread safe, only used from the run's writer thread.
+class SystemStatusRollup {
+public:
+    SystemStatusRollup(int experiment_run_id);
+
+    void Add(int system_id, double cpu_utilisation, double mem_utilisation, const google::protobuf::Timestamp& sample_time);
+
+    // True if any interval has completed, or the open intervals are due a refresh
+    bool HasRowsToWrite() const;
+    bool IsOpenRefreshDue() const;
+
+    // Rows for every completed interval, or for every interval when include_open is set.
+    // The intervals are kept until DiscardRows is called, so nothing is lost if the insert fails.
+    DatabaseClient::TableRows GetRows(bool include_open) const;
+    void DiscardRows(bool include_open);
+
+    // Interval lengths in seconds, finest first
+    static const std::vector<int>& GetResolutions();
+    // Run once by the SchemaMigrator
+    static const std::string& GetCreateTableQuery();
+
+    static const int open_refresh_seconds = 10;
+
+private:
+    struct Summary {
+        double min = 0;
+        double max = 0;
+        double total = 0;
+        double last = 0;
+    };
+    struct Interval {
+        uint64_t sample_count = 0;
+        int64_t last_sample_time = 0;
+        Summary cpu;
+        Summary mem;
+    };
+    // (IntervalStart, SystemID), one map per resolution so each is ordered by interval start
+    typedef std::map<std::pair<int64_t, int>, Interval> IntervalMap;
+
+    static void AddToSummary(Summary& summary, double value, bool first, bool latest);
+    bool IsComplete(int64_t interval_start, std::size_t resolution_index) const;
+
+    const int experiment_run_id_;
+
+    std::vector<IntervalMap> intervals_;
+    // Latest SampleTime seen across the whole run
+    int64_t watermark_us_ = INT64_MIN;
+    int64_t last_open_refresh_us_ = INT64_MIN;
+};
+
+#endif //SYSTEMSTATUSROLLUP_H